@@ -0,0 +1,178 @@
+#include "asset_loader.h"
+#include "engine.h"
+#include "job_system.h"
+#include "mesh_cache.h"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+
+struct AsyncLoadState
+{
+	std::mutex                          mutex;
+	std::deque<std::coroutine_handle<>> mainThreadQueue;
+	std::atomic<u32>                    pendingTaskCount;
+};
+
+static AsyncLoadState GlobalAsyncLoads;
+
+void OnAssetTaskStarted()
+{
+	++GlobalAsyncLoads.pendingTaskCount;
+}
+
+void OnAssetTaskFinished()
+{
+	--GlobalAsyncLoads.pendingTaskCount;
+}
+
+void WorkerThreadAwaitable::await_suspend(std::coroutine_handle<> handle)
+{
+	SubmitJob([handle] { handle.resume(); });
+}
+
+void ResumeOnMainThread(std::coroutine_handle<> handle)
+{
+	std::lock_guard<std::mutex> lock(GlobalAsyncLoads.mutex);
+	GlobalAsyncLoads.mainThreadQueue.push_back(handle);
+}
+
+void MainThreadAwaitable::await_suspend(std::coroutine_handle<> handle)
+{
+	ResumeOnMainThread(handle);
+}
+
+void UpdateAsyncLoads(f64 budgetSeconds)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (;;)
+	{
+		std::coroutine_handle<> handle;
+		{
+			std::lock_guard<std::mutex> lock(GlobalAsyncLoads.mutex);
+			if (GlobalAsyncLoads.mainThreadQueue.empty())
+				return;
+			handle = GlobalAsyncLoads.mainThreadQueue.front();
+			GlobalAsyncLoads.mainThreadQueue.pop_front();
+		}
+
+		handle.resume();
+
+		if (std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count() >= budgetSeconds)
+			return;
+	}
+}
+
+u32 GetPendingAssetTaskCount()
+{
+	return GlobalAsyncLoads.pendingTaskCount;
+}
+
+// Materials are referenced by index, app->materials can grow while the texture loads
+static AssetTask<u32> StreamMaterialTexture(App* app, u32 materialIdx, u32 slot, std::string filepath)
+{
+	u32 textureIdx = co_await LoadTexture2DAsync(app, filepath, GetMaterialTextureUsage(slot));
+	if (textureIdx != UINT32_MAX)
+		GetMaterialTexture(app->materials[materialIdx], slot) = textureIdx;
+	co_return textureIdx;
+}
+
+u32 CreateMaterialAsync(App* app, const CachedMaterial& cachedMaterial, String directory)
+{
+	Material material = {};
+	material.name = cachedMaterial.name;
+	material.albedo = cachedMaterial.albedo;
+	material.emissive = cachedMaterial.emissive;
+	for (u32 slot = 0; slot < MaterialTexture_Count; ++slot)
+	{
+		GetMaterialTexture(material, slot) = GetDefaultMaterialTexture(app, slot);
+	}
+
+	u32 materialIdx = (u32)app->materials.size();
+	app->materials.push_back(material);
+
+	for (u32 slot = 0; slot < MaterialTexture_Count; ++slot)
+	{
+		const std::string& textureFilename = cachedMaterial.textureFilenames[slot];
+		if (textureFilename.empty())
+			continue;
+
+		// The paths are built here, the frame arena is gone by the time the texture is decoded
+		String filepath = MakePath(directory, MakeString(textureFilename.c_str()));
+		StreamMaterialTexture(app, materialIdx, slot, filepath.str);
+	}
+
+	return materialIdx;
+}
+
+u32 CreatePlaceholderModel(App* app)
+{
+	// Four vertices per face so every face keeps its own normal
+	const vec3 faceNormals[6] = {
+		vec3(1.0f, 0.0f, 0.0f), vec3(-1.0f, 0.0f, 0.0f),
+		vec3(0.0f, 1.0f, 0.0f), vec3(0.0f, -1.0f, 0.0f),
+		vec3(0.0f, 0.0f, 1.0f), vec3(0.0f, 0.0f, -1.0f)
+	};
+	const vec2 corners[4] = { vec2(-1.0f, -1.0f), vec2(1.0f, -1.0f), vec2(1.0f, 1.0f), vec2(-1.0f, 1.0f) };
+
+	std::vector<float> vertices;
+	std::vector<u16> indices;
+	for (u32 face = 0; face < 6; ++face)
+	{
+		// u x v = normal, so the corners are counter-clockwise seen from outside
+		const vec3 n = faceNormals[face];
+		const vec3 u = vec3(n.y, n.z, n.x);
+		const vec3 v = glm::cross(n, u);
+
+		const u16 firstVertex = (u16)(face * 4);
+		for (u32 i = 0; i < 4; ++i)
+		{
+			const vec3 position = 0.5f * (n + corners[i].x * u + corners[i].y * v);
+			vertices.insert(vertices.end(), { position.x, position.y, position.z, n.x, n.y, n.z });
+			vertices.insert(vertices.end(), { 0.5f * corners[i].x + 0.5f, 0.5f * corners[i].y + 0.5f });
+		}
+		indices.insert(indices.end(), { firstVertex, (u16)(firstVertex + 1), (u16)(firstVertex + 2), firstVertex, (u16)(firstVertex + 2), (u16)(firstVertex + 3) });
+	}
+
+	Submesh submesh = {};
+	submesh.vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 0, 3, 0 });
+	submesh.vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 1, 3, 3 * sizeof(float) });
+	submesh.vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 2, 2, 6 * sizeof(float) });
+	submesh.vertexBufferLayout.stride = 8 * sizeof(float);
+	submesh.vertexFormat = VertexFormat_Float;
+	submesh.positionScale = vec3(1.0f);
+	submesh.positionOffset = vec3(0.0f);
+	submesh.vertexCount = 24;
+	submesh.indexCount = (u32)indices.size();
+	submesh.indexType = GL_UNSIGNED_SHORT;
+	submesh.boundsMin = vec3(-0.5f);
+	submesh.boundsMax = vec3(0.5f);
+	submesh.boundsCenter = vec3(0.0f);
+	submesh.boundsRadius = glm::sqrt(0.75f);
+	UploadSubmeshGeometry(app->geometryPool, submesh, vertices.data(), indices.data());
+
+	Material material = {};
+	material.name = "Placeholder";
+	material.albedo = vec3(1.0f);
+	for (u32 slot = 0; slot < MaterialTexture_Count; ++slot)
+	{
+		GetMaterialTexture(material, slot) = GetDefaultMaterialTexture(app, slot);
+	}
+	app->materials.push_back(material);
+
+	app->meshes.push_back(Mesh{});
+	Mesh& mesh = app->meshes.back();
+	mesh.submeshes.push_back(submesh);
+	mesh.vertexBufferSize = (u32)(vertices.size() * sizeof(float));
+	mesh.indexBufferSize = (u32)(indices.size() * sizeof(u16));
+
+	app->models.push_back(Model{});
+	Model& model = app->models.back();
+	model.meshIdx = (u32)app->meshes.size() - 1u;
+	model.materialIdx.push_back((u32)app->materials.size() - 1u);
+	UpdateMeshBounds(mesh);
+	UpdateModelBounds(model, mesh);
+
+	return (u32)app->models.size() - 1u;
+}
@@ -0,0 +1,139 @@
+//
+// asset_loader.h: Coroutine based asynchronous asset loading. A load starts on the main thread,
+// hops to the job system for file I/O and decoding (co_await SwitchToWorkerThread()) and comes
+// back to the main thread for the GL work (co_await SwitchToMainThread()). The main thread
+// continuations are resumed by UpdateAsyncLoads within a per-frame time budget.
+//
+
+#pragma once
+
+#include "platform.h"
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+struct App;
+struct String;
+struct CachedMaterial;
+
+#define ASYNC_LOAD_FRAME_BUDGET_SECONDS 0.004
+
+void OnAssetTaskStarted();
+void OnAssetTaskFinished();
+
+/**
+ * Result of an asynchronous load. It starts running as soon as it is called and can be
+ * co_awaited once from another task. Tasks always finish on the main thread, and must only
+ * be awaited there. Dropping a task that is still running lets it finish on its own.
+ */
+template <typename T>
+struct AssetTask
+{
+	struct promise_type
+	{
+		T                       value = {};
+		std::coroutine_handle<> continuation;
+		bool                    finished = false;
+		bool                    detached = false;
+
+		promise_type() { OnAssetTaskStarted(); }
+
+		AssetTask get_return_object() { return AssetTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+
+		struct FinalAwaitable
+		{
+			bool await_ready() noexcept { return false; }
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+			{
+				promise_type& promise = handle.promise();
+				promise.finished = true;
+				OnAssetTaskFinished();
+
+				std::coroutine_handle<> continuation = promise.continuation;
+				if (promise.detached)
+					handle.destroy();
+				return continuation ? continuation : std::noop_coroutine();
+			}
+			void await_resume() noexcept {}
+		};
+		FinalAwaitable final_suspend() noexcept { return {}; }
+
+		void return_value(T result) { value = std::move(result); }
+		void unhandled_exception() { std::terminate(); }
+	};
+
+	std::coroutine_handle<promise_type> handle;
+
+	explicit AssetTask(std::coroutine_handle<promise_type> h) : handle(h) {}
+	AssetTask(AssetTask&& other) noexcept : handle(std::exchange(other.handle, {})) {}
+	AssetTask(const AssetTask&) = delete;
+	AssetTask& operator=(const AssetTask&) = delete;
+
+	~AssetTask()
+	{
+		if (!handle)
+			return;
+		if (handle.promise().finished)
+			handle.destroy();
+		else
+			handle.promise().detached = true;
+	}
+
+	bool await_ready() const noexcept { return handle.promise().finished; }
+	void await_suspend(std::coroutine_handle<> awaiting) noexcept { handle.promise().continuation = awaiting; }
+	T await_resume() { return std::move(handle.promise().value); }
+};
+
+struct WorkerThreadAwaitable
+{
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> handle);
+	void await_resume() const noexcept {}
+};
+
+struct MainThreadAwaitable
+{
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> handle);
+	void await_resume() const noexcept {}
+};
+
+/**
+ * Moves the calling coroutine to a worker thread of the job system. Nothing that touches GL
+ * or the frame arena (MakeString, MakePath...) may run until it switches back.
+ */
+inline WorkerThreadAwaitable SwitchToWorkerThread() { return {}; }
+
+/**
+ * Queues the calling coroutine to be resumed by UpdateAsyncLoads on the main thread.
+ */
+inline MainThreadAwaitable SwitchToMainThread() { return {}; }
+
+/**
+ * Queues a suspended coroutine to be resumed by UpdateAsyncLoads, from any thread.
+ */
+void ResumeOnMainThread(std::coroutine_handle<> handle);
+
+/**
+ * Resumes the coroutines waiting for the main thread until the budget is spent.
+ * At least one is resumed per call, so loads always make progress.
+ */
+void UpdateAsyncLoads(f64 budgetSeconds = ASYNC_LOAD_FRAME_BUDGET_SECONDS);
+
+/**
+ * Number of asset tasks that have not finished yet.
+ */
+u32 GetPendingAssetTaskCount();
+
+/**
+ * Creates a material that uses the default textures, and streams its texture maps in the
+ * background. Each map replaces its default texture as soon as it has been uploaded.
+ */
+u32 CreateMaterialAsync(App* app, const CachedMaterial& cachedMaterial, String directory);
+
+/**
+ * A unit cube with the default textures, drawn in place of the models that are still loading.
+ */
+u32 CreatePlaceholderModel(App* app);
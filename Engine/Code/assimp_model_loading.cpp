@@ -1,14 +1,405 @@
 #define _CRT_SECURE_NO_WARNINGS
 
 #include "engine.h"
+#include "assimp_model_loading.h"
 #include "geometry.h"
-
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "meshlet.h"
+#include "orm_packer.h"
+#include "gpu_uploader.h"
+#include "job_system.h"
+
+#include <assimp/Importer.hpp>
 #include <assimp/cimport.h>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <glad/glad.h>
 
-void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define VERTEX_INTERLEAVE_SSE 1
+#else
+#define VERTEX_INTERLEAVE_SSE 0
+#endif
+
+#ifdef ENGINE_BENCHMARKS
+#include <chrono>
+#endif
+
+#define MODEL_IMPORT_FLAGS (aiProcess_Triangulate | \
+	aiProcess_GenSmoothNormals | \
+	aiProcess_CalcTangentSpace | \
+	aiProcess_JoinIdenticalVertices | \
+	aiProcess_PreTransformVertices | \
+	aiProcess_ImproveCacheLocality | \
+	aiProcess_OptimizeMeshes | \
+	aiProcess_SortByPType)
+
+// Without aiProcess_PreTransformVertices every aiMesh is kept once, in its own local space
+#define MODEL_HIERARCHY_IMPORT_FLAGS (MODEL_IMPORT_FLAGS & ~aiProcess_PreTransformVertices)
+
+// Welding and cache ordering done by OptimizeSubmesh instead, on the final vertex stream
+#define MODEL_OPTIMIZER_REPLACED_FLAGS (aiProcess_JoinIdenticalVertices | aiProcess_ImproveCacheLocality)
+
+struct ModelImport
+{
+	const char*        filename;
+	ModelImportSettings settings;
+	bool               fromCache;
+	Assimp::Importer*  importer;
+	const aiScene*     scene;
+	std::vector<aiMesh*> nodeMeshes;   // In node traversal order, one per submesh. In scene order with preserveHierarchy
+	std::vector<Submesh> submeshes;
+	std::vector<ModelNode> nodes;      // Only with preserveHierarchy
+	std::vector<ModelDraw> draws;
+	std::vector<MeshOptimizationStats> optimizationStats; // One per submesh, only with optimizeMeshes
+	std::vector<CachedMaterial> materials; // Of every aiMaterial, with their ORM maps packed
+	std::vector<u8>    geometryStaging;  // The streams of every submesh, until the upload thread has them
+	std::vector<StagedSubmeshGeometry> stagedSubmeshes;
+	GLuint             stagedGeometry;   // Buffer made from geometryStaging on the upload thread, 0 if none
+};
+
+// For some reason ASSIMP gives me the bitangents flipped.
+// Maybe it's my fault, but when I generate my own geometry
+// in other files (see the generation of standard assets)
+// and all the bitangents have the orientation I expect,
+// everything works ok.
+// I think that (even if the documentation says the opposite)
+// it returns a left-handed tangent space matrix.
+// SOLUTION: I invert the components of the bitangent when interleaving.
+
+// Writes one vertex with plain scalar copies
+template <bool HasTexCoords, bool HasTangentSpace>
+static float* WriteVertexScalar(const aiMesh* mesh, u32 i, float* dst)
+{
+	*dst++ = mesh->mVertices[i].x;
+	*dst++ = mesh->mVertices[i].y;
+	*dst++ = mesh->mVertices[i].z;
+	*dst++ = mesh->mNormals[i].x;
+	*dst++ = mesh->mNormals[i].y;
+	*dst++ = mesh->mNormals[i].z;
+	if (HasTexCoords)
+	{
+		*dst++ = mesh->mTextureCoords[0][i].x;
+		*dst++ = mesh->mTextureCoords[0][i].y;
+	}
+	if (HasTangentSpace)
+	{
+		*dst++ = mesh->mTangents[i].x;
+		*dst++ = mesh->mTangents[i].y;
+		*dst++ = mesh->mTangents[i].z;
+		*dst++ = -mesh->mBitangents[i].x;
+		*dst++ = -mesh->mBitangents[i].y;
+		*dst++ = -mesh->mBitangents[i].z;
+	}
+	return dst;
+}
+
+// Fills the interleaved stream of a mesh with a loop specialized for its layout. With SSE
+// every 3-float attribute is moved with one 4-wide load and store: the extra lane spills
+// into the next attribute (or the next vertex), which is written right after. The last
+// vertex goes through the scalar path so nothing is read or written out of bounds.
+template <bool HasTexCoords, bool HasTangentSpace>
+static void InterleaveVertices(const aiMesh* mesh, float* dst)
+{
+	const u32 vertexCount = mesh->mNumVertices;
+	if (vertexCount == 0)
+		return;
+
+	u32 i = 0;
+
+#if VERTEX_INTERLEAVE_SSE
+	const float* positions = &mesh->mVertices[0].x;
+	const float* normals = &mesh->mNormals[0].x;
+	const float* texCoords = HasTexCoords ? &mesh->mTextureCoords[0][0].x : nullptr;
+	const float* tangents = HasTangentSpace ? &mesh->mTangents[0].x : nullptr;
+	const float* bitangents = HasTangentSpace ? &mesh->mBitangents[0].x : nullptr;
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+
+	for (; i + 1 < vertexCount; ++i)
+	{
+		const u32 src = i * 3;
+		_mm_storeu_ps(dst, _mm_loadu_ps(positions + src)); dst += 3;
+		_mm_storeu_ps(dst, _mm_loadu_ps(normals + src));   dst += 3;
+		if (HasTexCoords)
+		{
+			_mm_storeu_ps(dst, _mm_loadu_ps(texCoords + src)); dst += 2;
+		}
+		if (HasTangentSpace)
+		{
+			_mm_storeu_ps(dst, _mm_loadu_ps(tangents + src)); dst += 3;
+			_mm_storeu_ps(dst, _mm_xor_ps(_mm_loadu_ps(bitangents + src), signMask)); dst += 3;
+		}
+	}
+#endif
+
+	for (; i < vertexCount; ++i)
+	{
+		dst = WriteVertexScalar<HasTexCoords, HasTangentSpace>(mesh, i, dst);
+	}
+}
+
+static void BuildFloatVertices(aiMesh* mesh, bool hasTexCoords, bool hasTangentSpace, Submesh& submesh)
+{
+	// create the vertex format
+	VertexBufferLayout vertexBufferLayout = {};
+	vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 0, 3, 0 });
+	vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 1, 3, 3 * sizeof(float) });
+	vertexBufferLayout.stride = 6 * sizeof(float);
+	if (hasTexCoords)
+	{
+		vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 2, 2, vertexBufferLayout.stride });
+		vertexBufferLayout.stride += 2 * sizeof(float);
+	}
+	if (hasTangentSpace)
+	{
+		vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 3, 3, vertexBufferLayout.stride });
+		vertexBufferLayout.stride += 3 * sizeof(float);
+
+		vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 4, 3, vertexBufferLayout.stride });
+		vertexBufferLayout.stride += 3 * sizeof(float);
+	}
+
+	// process vertices into a stream of the exact final size
+	std::vector<u8> vertices((size_t)mesh->mNumVertices * vertexBufferLayout.stride);
+	float* dst = (float*)vertices.data();
+	if (hasTexCoords && hasTangentSpace) InterleaveVertices<true, true>(mesh, dst);
+	else if (hasTexCoords)               InterleaveVertices<true, false>(mesh, dst);
+	else if (hasTangentSpace)            InterleaveVertices<false, true>(mesh, dst);
+	else                                 InterleaveVertices<false, false>(mesh, dst);
+
+	submesh.vertexBufferLayout = vertexBufferLayout;
+	submesh.vertexFormat = VertexFormat_Float;
+	submesh.positionScale = vec3(1.0f);
+	submesh.positionOffset = vec3(0.0f);
+	submesh.vertices.swap(vertices);
+}
+
+static vec2 EncodeOctahedral(vec3 n)
+{
+	n /= glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z) + 1e-20f;
+	vec2 e = vec2(n.x, n.y);
+	if (n.z < 0.0f)
+	{
+		vec2 signs = vec2(e.x >= 0.0f ? 1.0f : -1.0f, e.y >= 0.0f ? 1.0f : -1.0f);
+		e = (1.0f - glm::abs(vec2(e.y, e.x))) * signs;
+	}
+	return e;
+}
+
+static i16 PackSnorm16(float value)
+{
+	return (i16)glm::round(glm::clamp(value, -1.0f, 1.0f) * 32767.0f);
+}
+
+// Compact layout (24 bytes with all the attributes and quantized positions, 56 as floats):
+//  0: position   3 x float, or 3 x unorm16 (+ padding) relative to the submesh bounds
+//  1: normal     2 x snorm16, octahedral encoded
+//  2: texcoords  2 x half
+//  3: tangent    4 x snorm16: octahedral tangent, bitangent sign, padding
+// The bitangent is rebuilt in the shader as sign * cross(normal, tangent).
+static void BuildCompactVertices(aiMesh* mesh, bool hasTexCoords, bool hasTangentSpace, bool quantizePositions, Submesh& submesh)
+{
+	VertexBufferLayout vertexBufferLayout = {};
+	if (quantizePositions)
+	{
+		vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 0, 3, 0, GL_UNSIGNED_SHORT, true });
+		vertexBufferLayout.stride = 4 * sizeof(u16);
+	}
+	else
+	{
+		vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 0, 3, 0, GL_FLOAT, false });
+		vertexBufferLayout.stride = 3 * sizeof(float);
+	}
+	const u32 normalOffset = vertexBufferLayout.stride;
+	vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 1, 2, (u8)normalOffset, GL_SHORT, true });
+	vertexBufferLayout.stride += 2 * sizeof(i16);
+	const u32 texCoordsOffset = vertexBufferLayout.stride;
+	if (hasTexCoords)
+	{
+		vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 2, 2, (u8)texCoordsOffset, GL_HALF_FLOAT, false });
+		vertexBufferLayout.stride += 2 * sizeof(u16);
+	}
+	const u32 tangentOffset = vertexBufferLayout.stride;
+	if (hasTangentSpace)
+	{
+		vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 3, 4, (u8)tangentOffset, GL_SHORT, true });
+		vertexBufferLayout.stride += 4 * sizeof(i16);
+	}
+
+	// quantization range: the bounds of the submesh
+	vec3 boundsMin = vec3(FLT_MAX);
+	vec3 boundsMax = vec3(-FLT_MAX);
+	for (u32 i = 0; i < mesh->mNumVertices; ++i)
+	{
+		const vec3 position = vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+		boundsMin = glm::min(boundsMin, position);
+		boundsMax = glm::max(boundsMax, position);
+	}
+	const vec3 extent = glm::max(boundsMax - boundsMin, vec3(1e-6f));
+
+	const u32 stride = vertexBufferLayout.stride;
+	std::vector<u8> vertices((size_t)mesh->mNumVertices * stride);
+	for (u32 i = 0; i < mesh->mNumVertices; ++i)
+	{
+		u8* vertex = vertices.data() + (size_t)i * stride;
+
+		const vec3 position = vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+		if (quantizePositions)
+		{
+			const vec3 unit = glm::clamp((position - boundsMin) / extent, 0.0f, 1.0f);
+			const u16 quantized[4] = { (u16)glm::round(unit.x * 65535.0f), (u16)glm::round(unit.y * 65535.0f), (u16)glm::round(unit.z * 65535.0f), 0 };
+			memcpy(vertex, quantized, sizeof(quantized));
+		}
+		else
+		{
+			memcpy(vertex, &position, sizeof(position));
+		}
+
+		const vec3 normal = vec3(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z);
+		const vec2 octNormal = EncodeOctahedral(normal);
+		const i16 packedNormal[2] = { PackSnorm16(octNormal.x), PackSnorm16(octNormal.y) };
+		memcpy(vertex + normalOffset, packedNormal, sizeof(packedNormal));
+
+		if (hasTexCoords)
+		{
+			const u32 packedTexCoords = glm::packHalf2x16(vec2(mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y));
+			memcpy(vertex + texCoordsOffset, &packedTexCoords, sizeof(packedTexCoords));
+		}
+
+		if (hasTangentSpace)
+		{
+			const vec3 tangent = vec3(mesh->mTangents[i].x, mesh->mTangents[i].y, mesh->mTangents[i].z);
+			const vec3 bitangent = -vec3(mesh->mBitangents[i].x, mesh->mBitangents[i].y, mesh->mBitangents[i].z);
+			const float bitangentSign = glm::dot(glm::cross(normal, tangent), bitangent) < 0.0f ? -1.0f : 1.0f;
+			const vec2 octTangent = EncodeOctahedral(tangent);
+			const i16 packedTangent[4] = { PackSnorm16(octTangent.x), PackSnorm16(octTangent.y), PackSnorm16(bitangentSign), 0 };
+			memcpy(vertex + tangentOffset, packedTangent, sizeof(packedTangent));
+		}
+	}
+
+	submesh.vertexBufferLayout = vertexBufferLayout;
+	submesh.vertexFormat = VertexFormat_Compact;
+	submesh.positionScale = quantizePositions ? extent : vec3(1.0f);
+	submesh.positionOffset = quantizePositions ? boundsMin : vec3(0.0f);
+	submesh.vertices.swap(vertices);
+}
+
+// Stores the indices with the narrowest type that can address every vertex of the submesh
+static void StoreSubmeshIndices(const std::vector<u32>& indices, u32 vertexCount, Submesh& submesh)
+{
+	submesh.indexCount = (u32)indices.size();
+	submesh.indexType = vertexCount <= 0x10000 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	submesh.indices.resize((size_t)submesh.indexCount * GetIndexSize(submesh.indexType));
+
+	if (submesh.indexType == GL_UNSIGNED_SHORT)
+	{
+		u16* dst = (u16*)submesh.indices.data();
+		for (u32 i = 0; i < submesh.indexCount; ++i)
+		{
+			dst[i] = (u16)indices[i];
+		}
+	}
+	else
+	{
+		memcpy(submesh.indices.data(), indices.data(), submesh.indices.size());
+	}
+}
+
+// The sphere is centered on the box, which is close enough to the minimal sphere for culling and LOD selection
+static void ComputeSubmeshBounds(const aiMesh* mesh, Submesh& submesh)
+{
+	vec3 boundsMin = vec3(FLT_MAX);
+	vec3 boundsMax = vec3(-FLT_MAX);
+	for (u32 i = 0; i < mesh->mNumVertices; ++i)
+	{
+		const vec3 position = vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+		boundsMin = glm::min(boundsMin, position);
+		boundsMax = glm::max(boundsMax, position);
+	}
+
+	submesh.boundsMin = mesh->mNumVertices > 0 ? boundsMin : vec3(0.0f);
+	submesh.boundsMax = mesh->mNumVertices > 0 ? boundsMax : vec3(0.0f);
+	submesh.boundsCenter = 0.5f * (submesh.boundsMin + submesh.boundsMax);
+	submesh.boundsRadius = 0.0f;
+	for (u32 i = 0; i < mesh->mNumVertices; ++i)
+	{
+		const vec3 position = vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+		submesh.boundsRadius = glm::max(submesh.boundsRadius, glm::length(position - submesh.boundsCenter));
+	}
+}
+
+void ProcessAssimpMesh(aiMesh* mesh, Submesh& submesh, const ModelImportSettings& settings, MeshOptimizationStats* stats)
+{
+	// the attributes are decided once per mesh, not per vertex
+	static_assert(sizeof(aiVector3D) == 3 * sizeof(float), "Vertex interleaving expects single precision Assimp vectors");
+	const bool hasTexCoords = mesh->mTextureCoords[0] != nullptr; // does the mesh contain texture coordinates?
+	const bool hasTangentSpace = mesh->mTangents != nullptr && mesh->mBitangents != nullptr;
+
+	// process vertices
+	if (settings.vertexFormat == VertexFormat_Compact)
+	{
+		BuildCompactVertices(mesh, hasTexCoords, hasTangentSpace, settings.quantizePositions, submesh);
+	}
+	else
+	{
+		BuildFloatVertices(mesh, hasTexCoords, hasTangentSpace, submesh);
+	}
+
+	// process indices
+	std::vector<u32> indices;
+	if (mesh->mPrimitiveTypes == aiPrimitiveType_TRIANGLE)
+	{
+		indices.resize((size_t)mesh->mNumFaces * 3);
+		u32* dst = indices.data();
+		for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+		{
+			const unsigned int* faceIndices = mesh->mFaces[i].mIndices;
+			dst[0] = faceIndices[0];
+			dst[1] = faceIndices[1];
+			dst[2] = faceIndices[2];
+			dst += 3;
+		}
+	}
+	else
+	{
+		for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+		{
+			const aiFace& face = mesh->mFaces[i];
+			indices.insert(indices.end(), face.mIndices, face.mIndices + face.mNumIndices);
+		}
+	}
+
+	submesh.vertexCount = mesh->mNumVertices;
+	if (settings.optimizeMeshes && mesh->mPrimitiveTypes == aiPrimitiveType_TRIANGLE)
+		OptimizeSubmesh(submesh, indices, stats);
+
+	submesh.meshlets.clear();
+	if (settings.generateMeshlets && mesh->mPrimitiveTypes == aiPrimitiveType_TRIANGLE)
+	{
+		BuildSubmeshMeshlets(submesh, indices);
+#ifdef _DEBUG
+		if (!ValidateSubmeshMeshlets(submesh, indices))
+			ELOG("The meshlets of mesh %s don't cover its triangles", mesh->mName.C_Str());
+#endif
+	}
+
+	// The LODs reuse the vertices, their indices go after LOD 0 in the same block
+	const u32 lod0IndexCount = (u32)indices.size();
+	submesh.lods.clear();
+	if (settings.generateLods && mesh->mPrimitiveTypes == aiPrimitiveType_TRIANGLE)
+		BuildSubmeshLods(submesh, indices);
+
+	StoreSubmeshIndices(indices, submesh.vertexCount, submesh);
+	submesh.indexCount = lod0IndexCount;
+	ComputeSubmeshBounds(mesh, submesh);
+}
+
+#ifdef ENGINE_BENCHMARKS
+// The original per-vertex push_back path, kept as the benchmark baseline
+static void ProcessAssimpMeshReference(aiMesh* mesh, Submesh& submesh)
 {
 	std::vector<float> vertices;
 	std::vector<u32> indices;
@@ -64,9 +455,6 @@ void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 bas
 		}
 	}
 
-	// store the proper (previously proceessed) material for this mesh
-	submeshMaterialIndices.push_back(baseMeshMaterialIndex + mesh->mMaterialIndex);
-
 	// create the vertex format
 	VertexBufferLayout vertexBufferLayout = {};
 	vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 0, 3, 0 });
@@ -86,144 +474,338 @@ void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 bas
 		vertexBufferLayout.stride += 3 * sizeof(float);
 	}
 
-	// add the submesh into the mesh
-	Submesh submesh = {};
+	// fill the submesh
 	submesh.vertexBufferLayout = vertexBufferLayout;
-	submesh.vertices.swap(vertices);
-	submesh.indices.swap(indices);
-	myMesh->submeshes.push_back(submesh);
+	submesh.vertices.assign((const u8*)vertices.data(), (const u8*)(vertices.data() + vertices.size()));
+	StoreSubmeshIndices(indices, mesh->mNumVertices, submesh);
 }
 
-void ProcessAssimpMaterial(App* app, aiMaterial* material, Material& myMaterial, String directory)
+void BenchmarkProcessAssimpMesh(const char* filename, u32 iterations)
 {
-	GLenum err;
+	Assimp::Importer importer;
+	const aiScene* scene = importer.ReadFile(filename, MODEL_IMPORT_FLAGS);
+	if (!scene)
+	{
+		ELOG("Error loading mesh %s: %s", filename, importer.GetErrorString());
+		return;
+	}
+
+	u64 vertexCount = 0;
+	for (u32 m = 0; m < scene->mNumMeshes; ++m)
+		vertexCount += scene->mMeshes[m]->mNumVertices;
+
+	f64 referenceSeconds = 0.0;
+	f64 interleavedSeconds = 0.0;
+	bool outputsMatch = true;
+
+	for (u32 it = 0; it < iterations; ++it)
+	{
+		for (u32 m = 0; m < scene->mNumMeshes; ++m)
+		{
+			Submesh reference = {};
+			Submesh interleaved = {};
+
+			auto t0 = std::chrono::high_resolution_clock::now();
+			ProcessAssimpMeshReference(scene->mMeshes[m], reference);
+			auto t1 = std::chrono::high_resolution_clock::now();
+			ProcessAssimpMesh(scene->mMeshes[m], interleaved, ModelImportSettings{});
+			auto t2 = std::chrono::high_resolution_clock::now();
+
+			referenceSeconds += std::chrono::duration<f64>(t1 - t0).count();
+			interleavedSeconds += std::chrono::duration<f64>(t2 - t1).count();
+			outputsMatch = outputsMatch &&
+				reference.vertices == interleaved.vertices &&
+				reference.indices == interleaved.indices &&
+				reference.vertexBufferLayout.stride == interleaved.vertexBufferLayout.stride;
+		}
+	}
+
+	ILOG("ProcessAssimpMesh benchmark on %s (%u meshes, %llu vertices, %u iterations):", filename, scene->mNumMeshes, vertexCount, iterations);
+	ILOG(" - push_back path:   %.3f ms per import", 1000.0 * referenceSeconds / iterations);
+	ILOG(" - interleaved path: %.3f ms per import (%.2fx)", 1000.0 * interleavedSeconds / iterations, referenceSeconds / interleavedSeconds);
+	ILOG(" - outputs %s", outputsMatch ? "match" : "DIFFER");
+}
+#endif // ENGINE_BENCHMARKS
+
+void ProcessAssimpMaterial(App* app, const CachedMaterial& cachedMaterial, Material& myMaterial, String directory)
+{
+	LoadCachedMaterial(app, cachedMaterial, myMaterial, directory);
+}
 
+// Where the occlusion, roughness and metallic values of the material are
+static OrmSources GetAssimpOrmSources(aiMaterial* material, const std::string& directory)
+{
+	static const aiTextureType ormTextureTypes[OrmChannel_Count] = {
+		aiTextureType_LIGHTMAP,  // OrmChannel_Occlusion
+		aiTextureType_SHININESS, // OrmChannel_Roughness
+		aiTextureType_SPECULAR   // OrmChannel_Metallic
+	};
+
+	OrmSources sources = {};
+	bool labelled[OrmChannel_Count] = {};
+	for (u32 i = 0; i < OrmChannel_Count; ++i)
+	{
+		if (material->GetTextureCount(ormTextureTypes[i]) > 0)
+		{
+			aiString aiFilename;
+			material->GetTexture(ormTextureTypes[i], 0, &aiFilename);
+			sources.filenames[i] = aiFilename.C_Str();
+		}
+	}
+
+	// glTF metallic-roughness maps come as unknown textures
+	if (sources.filenames[OrmChannel_Roughness].empty() && sources.filenames[OrmChannel_Metallic].empty() && material->GetTextureCount(aiTextureType_UNKNOWN) > 0)
+	{
+		aiString aiFilename;
+		material->GetTexture(aiTextureType_UNKNOWN, 0, &aiFilename);
+		sources.filenames[OrmChannel_Roughness] = sources.filenames[OrmChannel_Metallic] = aiFilename.C_Str();
+	}
+
+	// Without any map, a packed one the material file doesn't mention may sit next to the model
+	if (sources.filenames[0].empty() && sources.filenames[1].empty() && sources.filenames[2].empty())
+	{
+		u32 channels[OrmChannel_Count];
+		const std::string filename = FindPackedOrmMap(directory, channels);
+		for (u32 i = 0; i < OrmChannel_Count && !filename.empty(); ++i)
+		{
+			if (channels[i] != UINT32_MAX)
+			{
+				sources.filenames[i] = filename;
+				sources.channels[i] = channels[i];
+				labelled[i] = true;
+			}
+		}
+	}
+
+	// A map whose name labels its channels provides every channel it labels
+	for (u32 i = 0; i < OrmChannel_Count; ++i)
+	{
+		u32 channels[OrmChannel_Count];
+		if (labelled[i] || !DetectPackedOrmMap(sources.filenames[i], channels))
+			continue;
+
+		const std::string filename = sources.filenames[i];
+		for (u32 j = 0; j < OrmChannel_Count; ++j)
+		{
+			if (channels[j] != UINT32_MAX && (sources.filenames[j].empty() || sources.filenames[j] == filename))
+			{
+				sources.filenames[j] = filename;
+				sources.channels[j] = channels[j];
+				labelled[j] = true;
+			}
+		}
+	}
+
+	// Otherwise one image for several channels is laid out like glTF (occlusion, roughness and
+	// metallic in red, green and blue), and separate masks are read from red
+	for (u32 i = 0; i < OrmChannel_Count; ++i)
+	{
+		if (labelled[i] || sources.filenames[i].empty())
+			continue;
+
+		bool shared = false;
+		for (u32 j = 0; j < OrmChannel_Count; ++j)
+			shared = shared || (j != i && sources.filenames[j] == sources.filenames[i]);
+		sources.channels[i] = shared ? i : 0;
+	}
+
+	return sources;
+}
+
+CachedMaterial DescribeAssimpMaterial(aiMaterial* material, const std::string& directory)
+{
 	aiString name;
 	aiColor3D diffuseColor;
 	aiColor3D emissiveColor;
-	aiColor3D specularColor;
-	ai_real shininess;
 	material->Get(AI_MATKEY_NAME, name);
 	material->Get(AI_MATKEY_COLOR_DIFFUSE, diffuseColor);
 	material->Get(AI_MATKEY_COLOR_EMISSIVE, emissiveColor);
-	material->Get(AI_MATKEY_COLOR_SPECULAR, specularColor);
-	material->Get(AI_MATKEY_SHININESS, shininess);
 
-	myMaterial.name = name.C_Str();
-	myMaterial.albedo = vec3(diffuseColor.r, diffuseColor.g, diffuseColor.b);
-	myMaterial.emissive = vec3(emissiveColor.r, emissiveColor.g, emissiveColor.b);
-	//myMaterial.smoothness = shininess / 256.0f;
+	CachedMaterial cachedMaterial = {};
+	cachedMaterial.name = name.C_Str();
+	cachedMaterial.albedo = vec3(diffuseColor.r, diffuseColor.g, diffuseColor.b);
+	cachedMaterial.emissive = vec3(emissiveColor.r, emissiveColor.g, emissiveColor.b);
 
 	aiString aiFilename;
-
-	// Base color (Albedo) map
 	if (material->GetTextureCount(aiTextureType_DIFFUSE) > 0)
 	{
 		material->GetTexture(aiTextureType_DIFFUSE, 0, &aiFilename);
-		String filename = MakeString(aiFilename.C_Str());
-		String filepath = MakePath(directory, filename);
-		myMaterial.albedoTextureIdx = LoadTexture2D(app, filepath.str);
-		if ((err = glGetError()) != GL_NO_ERROR)
-			ELOG("OpenGL error %d\n", err);
+		cachedMaterial.textureFilenames[MaterialTexture_Albedo] = aiFilename.C_Str();
 	}
-	else {
-		myMaterial.albedoTextureIdx = app->whiteTexIdx;
+	if (material->GetTextureCount(aiTextureType_NORMALS) > 0)
+	{
+		material->GetTexture(aiTextureType_NORMALS, 0, &aiFilename);
+		cachedMaterial.textureFilenames[MaterialTexture_Normals] = aiFilename.C_Str();
 	}
 
-	// Metallic map
-	if (material->GetTextureCount(aiTextureType_SPECULAR) > 0)
+	// One texture for the three masks, packed now if the model ships them apart
+	const OrmSources ormSources = GetAssimpOrmSources(material, directory);
+	cachedMaterial.textureFilenames[MaterialTexture_ORM] = ResolveOrmMap(ormSources, directory, cachedMaterial.name);
+
+	return cachedMaterial;
+}
+
+void ProcessAssimpNode(const aiScene* scene, aiNode* node, std::vector<aiMesh*>& nodeMeshes)
+{
+	// collect all the node's meshes (if any)
+	for (unsigned int i = 0; i < node->mNumMeshes; i++)
 	{
-		material->GetTexture(aiTextureType_SPECULAR, 0, &aiFilename);
-		String filename = MakeString(aiFilename.C_Str());
-		String filepath = MakePath(directory, filename);
-		myMaterial.metallicTextureIdx = LoadTexture2D(app, filepath.str);
-		if ((err = glGetError()) != GL_NO_ERROR)
-			ELOG("OpenGL error %d\n", err);
-	}
-	else {
-		myMaterial.metallicTextureIdx = app->blackTexIdx;
+		nodeMeshes.push_back(scene->mMeshes[node->mMeshes[i]]);
 	}
 
-	// Roughness map
-	if (material->GetTextureCount(aiTextureType_SHININESS) > 0)
+	// then do the same for each of its children
+	for (unsigned int i = 0; i < node->mNumChildren; i++)
 	{
-		material->GetTexture(aiTextureType_SHININESS, 0, &aiFilename);
-		String filename = MakeString(aiFilename.C_Str());
-		String filepath = MakePath(directory, filename);
-		myMaterial.roughnessTextureIdx = LoadTexture2D(app, filepath.str);
-		if ((err = glGetError()) != GL_NO_ERROR)
-			ELOG("OpenGL error %d\n", err);
-	}
-	else {
-		myMaterial.roughnessTextureIdx = app->blackTexIdx;
+		ProcessAssimpNode(scene, node->mChildren[i], nodeMeshes);
 	}
+}
+
+void ProcessAssimpNodeHierarchy(aiNode* node, u32 parent, std::vector<ModelNode>& nodes, std::vector<ModelDraw>& draws)
+{
+	// aiMatrix4x4 is row major, glm is column major
+	ModelNode modelNode = {};
+	modelNode.localTransform = glm::transpose(glm::make_mat4(&node->mTransformation.a1));
+	modelNode.parent = parent;
+
+	u32 nodeIdx = (u32)nodes.size();
+	nodes.push_back(modelNode);
 
-	// Ambient Occlusion (AO) map
-	if (material->GetTextureCount(aiTextureType_LIGHTMAP) > 0)
+	// every mesh reference becomes a draw of the shared submesh
+	for (unsigned int i = 0; i < node->mNumMeshes; i++)
 	{
-		material->GetTexture(aiTextureType_LIGHTMAP, 0, &aiFilename);
-		String filename = MakeString(aiFilename.C_Str());
-		String filepath = MakePath(directory, filename);
-		myMaterial.aoTextureIdx = LoadTexture2D(app, filepath.str);
-		if ((err = glGetError()) != GL_NO_ERROR)
-			ELOG("OpenGL error %d\n", err);
-	}
-	else {
-		myMaterial.aoTextureIdx = app->blackTexIdx;
+		draws.push_back(ModelDraw{ node->mMeshes[i], nodeIdx });
 	}
 
-	// Normal map
-	if (material->GetTextureCount(aiTextureType_NORMALS) > 0)
+	for (unsigned int i = 0; i < node->mNumChildren; i++)
 	{
-		material->GetTexture(aiTextureType_NORMALS, 0, &aiFilename);
-		String filename = MakeString(aiFilename.C_Str());
-		String filepath = MakePath(directory, filename);
-		myMaterial.normalsTextureIdx = LoadTexture2D(app, filepath.str);
-		if ((err = glGetError()) != GL_NO_ERROR)
-			ELOG("OpenGL error %d\n", err);
-	}
-	else {
-		myMaterial.normalsTextureIdx = app->defaultNormalTexIdx;
+		ProcessAssimpNodeHierarchy(node->mChildren[i], nodeIdx, nodes, draws);
 	}
+}
 
-	if ((err = glGetError()) != GL_NO_ERROR)
-		ELOG("OpenGL error %d\n", err);
+static u32 GetImportFlags(const ModelImportSettings& settings)
+{
+	u32 flags = settings.preserveHierarchy ? MODEL_HIERARCHY_IMPORT_FLAGS : MODEL_IMPORT_FLAGS;
+	if (settings.optimizeMeshes)
+		flags &= ~MODEL_OPTIMIZER_REPLACED_FLAGS;
+	return flags;
 }
 
-void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+// Runs on a worker thread: only touches the import itself, never the App or the frame arena
+static void ImportModelScene(ModelImport& import)
 {
-	// process all the node's meshes (if any)
-	for (unsigned int i = 0; i < node->mNumMeshes; i++)
+	import.importer = new Assimp::Importer();
+	import.scene = import.importer->ReadFile(import.filename, GetImportFlags(import.settings));
+	if (!import.scene)
+		return;
+
+	if (import.settings.preserveHierarchy)
 	{
-		aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-		ProcessAssimpMesh(scene, mesh, myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+		import.nodeMeshes.assign(import.scene->mMeshes, import.scene->mMeshes + import.scene->mNumMeshes);
+		ProcessAssimpNodeHierarchy(import.scene->mRootNode, UINT32_MAX, import.nodes, import.draws);
 	}
+	else
+	{
+		ProcessAssimpNode(import.scene, import.scene->mRootNode, import.nodeMeshes);
+	}
+	import.submeshes.resize(import.nodeMeshes.size());
+	import.optimizationStats.resize(import.settings.optimizeMeshes ? import.nodeMeshes.size() : 0);
+
+	// Packing the ORM maps decodes images, so it is done here rather than with the materials
+	const std::string filename = import.filename;
+	const size_t slash = filename.find_last_of("/\\");
+	const std::string directory = slash == std::string::npos ? std::string() : filename.substr(0, slash);
+	import.materials.resize(import.scene->mNumMaterials);
+	ParallelFor(import.scene->mNumMaterials, [&import, &directory](u32 i) {
+		import.materials[i] = DescribeAssimpMaterial(import.scene->mMaterials[i], directory);
+	});
+}
 
-	// then do the same for each of its children
-	for (unsigned int i = 0; i < node->mNumChildren; i++)
+static void ReleaseModelImport(ModelImport& import)
+{
+	delete import.importer;
+	import.importer = nullptr;
+	import.scene = nullptr;
+	import.nodeMeshes.clear();
+	import.submeshes.clear();
+	import.nodes.clear();
+	import.draws.clear();
+	import.optimizationStats.clear();
+	import.materials.clear();
+	std::vector<u8>().swap(import.geometryStaging);
+	import.stagedSubmeshes.clear();
+	glDeleteBuffers(1, &import.stagedGeometry);
+	import.stagedGeometry = 0;
+}
+
+// The streams of every submesh in one buffer for the upload thread, built on the worker
+static GpuUpload StageModelGeometry(ModelImport& import)
+{
+	import.geometryStaging.clear();
+	import.stagedSubmeshes.resize(import.submeshes.size());
+	for (u32 i = 0; i < import.submeshes.size(); ++i)
+		import.stagedSubmeshes[i] = StageSubmeshGeometry(import.submeshes[i], import.geometryStaging);
+
+	GpuUpload upload = {};
+	upload.type = GpuUploadType_Buffer;
+	upload.data = import.geometryStaging.data();
+	upload.size = import.geometryStaging.size();
+	return upload;
+}
+
+static MeshOptimizationStats* GetOptimizationStats(ModelImport& import, u32 submeshIdx)
+{
+	return submeshIdx < import.optimizationStats.size() ? &import.optimizationStats[submeshIdx] : nullptr;
+}
+
+// One line per model with the step timings summed over the submeshes, and the cache ratios weighted by their size
+static void LogOptimizationStats(const ModelImport& import)
+{
+	MeshOptimizationStats total = {};
+	for (u32 i = 0; i < import.optimizationStats.size(); ++i)
 	{
-		ProcessAssimpNode(scene, node->mChildren[i], myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+		const MeshOptimizationStats& stats = import.optimizationStats[i];
+		total.vertexCountBefore += stats.vertexCountBefore;
+		total.vertexCountAfter += stats.vertexCountAfter;
+		total.triangleCount += stats.triangleCount;
+		total.acmrBefore += stats.acmrBefore * stats.triangleCount;
+		total.acmrAfter += stats.acmrAfter * stats.triangleCount;
+		total.atvrBefore += stats.atvrBefore * stats.vertexCountBefore;
+		total.atvrAfter += stats.atvrAfter * stats.vertexCountAfter;
+		total.weldSeconds += stats.weldSeconds;
+		total.vertexCacheSeconds += stats.vertexCacheSeconds;
+		total.overdrawSeconds += stats.overdrawSeconds;
+		total.vertexFetchSeconds += stats.vertexFetchSeconds;
 	}
+	if (total.triangleCount == 0)
+		return;
+
+	ILOG("Optimized %s: %u triangles, %u -> %u vertices, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f",
+		import.filename, total.triangleCount, total.vertexCountBefore, total.vertexCountAfter,
+		total.acmrBefore / total.triangleCount, total.acmrAfter / total.triangleCount,
+		total.atvrBefore / glm::max(total.vertexCountBefore, 1u), total.atvrAfter / glm::max(total.vertexCountAfter, 1u));
+	ILOG("Optimization steps: weld %.2f ms, vertex cache %.2f ms, overdraw %.2f ms, vertex fetch %.2f ms",
+		total.weldSeconds * 1000.0, total.vertexCacheSeconds * 1000.0, total.overdrawSeconds * 1000.0, total.vertexFetchSeconds * 1000.0);
+}
+
+// Everything in the settings that changes the cooked data goes into the mesh cache key
+static u32 GetImportSettingsKey(const ModelImportSettings& settings)
+{
+	return (u32)settings.vertexFormat | ((settings.quantizePositions ? 1u : 0u) << 8) | ((settings.preserveHierarchy ? 1u : 0u) << 9) |
+		((settings.optimizeMeshes ? 1u : 0u) << 10) | ((settings.generateLods ? 1u : 0u) << 11) | ((settings.generateMeshlets ? 1u : 0u) << 12);
 }
 
-u32 LoadModel(App* app, const char* filename)
+// Runs on the main thread: materials load textures and buffers are created through GL.
+// With streamTextures the materials start with the default textures and load their maps in the background.
+static u32 CreateModelFromImport(App* app, ModelImport& import, bool streamTextures)
 {
 	GLenum err;
 
-	const aiScene* scene = aiImportFile(filename,
-		aiProcess_Triangulate |
-		aiProcess_GenSmoothNormals |
-		aiProcess_CalcTangentSpace |
-		aiProcess_JoinIdenticalVertices |
-		aiProcess_PreTransformVertices |
-		aiProcess_ImproveCacheLocality |
-		aiProcess_OptimizeMeshes |
-		aiProcess_SortByPType
-	);
+	const char* filename = import.filename;
+	const aiScene* scene = import.scene;
 
 	if (!scene)
 	{
-		ELOG("Error loading mesh %s: %s", filename, aiGetErrorString());
+		ELOG("Error loading mesh %s: %s", filename, import.importer->GetErrorString());
 		return UINT32_MAX;
 	}
 
@@ -243,63 +825,181 @@ u32 LoadModel(App* app, const char* filename)
 
 	// Create a list of materials
 	u32 baseMeshMaterialIndex = (u32)app->materials.size();
-	for (unsigned int i = 0; i < scene->mNumMaterials; ++i)
+	const std::vector<CachedMaterial>& cachedMaterials = import.materials;
+	for (u32 i = 0; i < cachedMaterials.size(); ++i)
 	{
+		if (streamTextures)
+		{
+			CreateMaterialAsync(app, cachedMaterials[i], directory);
+			continue;
+		}
+
 		app->materials.push_back(Material{});
 		Material& material = app->materials.back();
-		ProcessAssimpMaterial(app, scene->mMaterials[i], material, directory);
+		ProcessAssimpMaterial(app, cachedMaterials[i], material, directory);
 	}
 
 	if ((err = glGetError()) != GL_NO_ERROR)
 		ELOG("OpenGL error %d\n", err);
 
-	ProcessAssimpNode(scene, scene->mRootNode, &mesh, baseMeshMaterialIndex, model.materialIdx);
+	// store the proper (previously proceessed) material for each submesh
+	for (u32 i = 0; i < import.nodeMeshes.size(); ++i)
+	{
+		model.materialIdx.push_back(baseMeshMaterialIndex + import.nodeMeshes[i]->mMaterialIndex);
+	}
+	model.nodes.swap(import.nodes);
+	model.draws.swap(import.draws);
+	UpdateModelNodeTransforms(model);
+	mesh.submeshes.swap(import.submeshes);
+	mesh.keepGeometryResident = import.settings.keepGeometryResident;
+	UpdateMeshBounds(mesh);
+	UpdateModelBounds(model, mesh);
 
 	if ((err = glGetError()) != GL_NO_ERROR)
 		ELOG("OpenGL error %d\n", err);
 
-	aiReleaseImport(scene);
-
-	u32 vertexBufferSize = 0;
-	u32 indexBufferSize = 0;
-
+	// Every submesh gets its own blocks in the shared geometry pool, copied on the GPU if the upload thread staged them
 	for (u32 i = 0; i < mesh.submeshes.size(); ++i)
 	{
-		vertexBufferSize += mesh.submeshes[i].vertices.size() * sizeof(float);
-		indexBufferSize += mesh.submeshes[i].indices.size() * sizeof(u32);
+		Submesh& submesh = mesh.submeshes[i];
+		if (import.stagedGeometry != 0)
+			CopySubmeshGeometry(app->geometryPool, submesh, import.stagedGeometry, import.stagedSubmeshes[i]);
+		else
+			UploadSubmeshGeometry(app->geometryPool, submesh, submesh.vertices.data(), submesh.indices.data());
+		mesh.vertexBufferSize += (u32)submesh.vertices.size();
+		mesh.indexBufferSize += (u32)submesh.indices.size();
+		mesh.clusterBufferSize += submesh.clusterSize;
 	}
 
 	if ((err = glGetError()) != GL_NO_ERROR)
 		ELOG("OpenGL error %d\n", err);
 
-	glGenBuffers(1, &mesh.vertexBufferHandle);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-	glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, NULL, GL_STATIC_DRAW);
+	LogOptimizationStats(import);
+	SaveModelToCache(filename, GetImportFlags(import.settings), GetImportSettingsKey(import.settings), mesh, model, baseMeshMaterialIndex, cachedMaterials);
 
-	glGenBuffers(1, &mesh.indexBufferHandle);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferSize, NULL, GL_STATIC_DRAW);
+	// The GPU has its own copy now, rendering only needs the counts, offsets and meshlet bounds
+	if (!mesh.keepGeometryResident)
+	{
+		for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+		{
+			std::vector<u8>().swap(mesh.submeshes[i].vertices);
+			std::vector<u8>().swap(mesh.submeshes[i].indices);
+			std::vector<u32>().swap(mesh.submeshes[i].meshletVertices);
+			std::vector<u8>().swap(mesh.submeshes[i].meshletTriangles);
+		}
+	}
 
-	u32 indicesOffset = 0;
-	u32 verticesOffset = 0;
+	return modelIdx;
+}
 
-	for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+std::vector<u32> LoadModels(App* app, const std::vector<ModelImportRequest>& requests)
+{
+	u32 modelCount = (u32)requests.size();
+	std::vector<ModelImport> imports(modelCount);
+	for (u32 i = 0; i < modelCount; ++i)
 	{
-		const void* verticesData = mesh.submeshes[i].vertices.data();
-		const u32   verticesSize = mesh.submeshes[i].vertices.size() * sizeof(float);
-		glBufferSubData(GL_ARRAY_BUFFER, verticesOffset, verticesSize, verticesData);
-		mesh.submeshes[i].vertexOffset = verticesOffset;
-		verticesOffset += verticesSize;
+		imports[i].filename = requests[i].filename;
+		imports[i].settings = requests[i].settings;
+		imports[i].fromCache = IsModelCacheValid(requests[i].filename, GetImportFlags(requests[i].settings), GetImportSettingsKey(requests[i].settings));
+	}
+
+	// Parse every model that isn't cooked yet on the worker pool
+	ParallelFor(modelCount, [&imports](u32 i) {
+		if (!imports[i].fromCache)
+			ImportModelScene(imports[i]);
+	});
 
-		const void* indicesData = mesh.submeshes[i].indices.data();
-		const u32   indicesSize = mesh.submeshes[i].indices.size() * sizeof(u32);
-		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indicesOffset, indicesSize, indicesData);
-		mesh.submeshes[i].indexOffset = indicesOffset;
-		indicesOffset += indicesSize;
+	// Build the submeshes of all the models at once, one job per aiMesh
+	std::vector<std::pair<u32, u32>> submeshJobs;
+	for (u32 i = 0; i < modelCount; ++i)
+	{
+		for (u32 j = 0; j < imports[i].nodeMeshes.size(); ++j)
+		{
+			submeshJobs.push_back({ i, j });
+		}
 	}
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	ParallelFor((u32)submeshJobs.size(), [&imports, &submeshJobs](u32 i) {
+		ModelImport& import = imports[submeshJobs[i].first];
+		u32 submeshIdx = submeshJobs[i].second;
+		ProcessAssimpMesh(import.nodeMeshes[submeshIdx], import.submeshes[submeshIdx], import.settings, GetOptimizationStats(import, submeshIdx));
+	});
 
-	return modelIdx;
-}
\ No newline at end of file
+	// Merge into the App in the requested order, so indices don't depend on thread timing
+	std::vector<u32> modelIndices(modelCount, UINT32_MAX);
+	for (u32 i = 0; i < modelCount; ++i)
+	{
+		ModelImport& import = imports[i];
+
+		if (import.fromCache)
+		{
+			if (LoadModelFromCache(app, import.filename, GetImportFlags(import.settings), GetImportSettingsKey(import.settings), import.settings.keepGeometryResident, false, &modelIndices[i]))
+				continue;
+
+			// The cache went bad after it was validated: import it here
+			ImportModelScene(import);
+			for (u32 j = 0; j < import.nodeMeshes.size(); ++j)
+			{
+				ProcessAssimpMesh(import.nodeMeshes[j], import.submeshes[j], import.settings, GetOptimizationStats(import, j));
+			}
+		}
+
+		modelIndices[i] = CreateModelFromImport(app, import, false);
+		ReleaseModelImport(import);
+	}
+
+	return modelIndices;
+}
+
+u32 LoadModel(App* app, const char* filename, const ModelImportSettings& settings)
+{
+	return LoadModels(app, { ModelImportRequest{ filename, settings } })[0];
+}
+
+AssetTask<u32> LoadModelAsync(App* app, std::string filename, ModelImportSettings settings)
+{
+	ModelImport import = {};
+	import.filename = filename.c_str();
+	import.settings = settings;
+	const u32 settingsKey = GetImportSettingsKey(settings);
+
+	// Parse and build the submeshes in the background, unless the cache has them cooked already
+	co_await SwitchToWorkerThread();
+	import.fromCache = IsModelCacheValid(import.filename, GetImportFlags(settings), settingsKey);
+	if (!import.fromCache)
+	{
+		ImportModelScene(import);
+		ParallelFor((u32)import.nodeMeshes.size(), [&import](u32 i) {
+			ProcessAssimpMesh(import.nodeMeshes[i], import.submeshes[i], import.settings, GetOptimizationStats(import, i));
+		});
+	}
+
+	// The geometry goes to the upload thread, materials and pool blocks through GL on the main thread
+	if (!import.fromCache && import.scene && !import.submeshes.empty() && IsGpuUploaderRunning())
+		import.stagedGeometry = (co_await UploadOnGpuThread(StageModelGeometry(import))).handle;
+	else
+		co_await SwitchToMainThread();
+	std::vector<u8>().swap(import.geometryStaging);
+	u32 modelIdx = UINT32_MAX;
+	if (import.fromCache && LoadModelFromCache(app, import.filename, GetImportFlags(settings), settingsKey, settings.keepGeometryResident, true, &modelIdx))
+		co_return modelIdx;
+
+	if (import.fromCache)
+	{
+		// The cache went bad after it was validated: import it in the background after all
+		co_await SwitchToWorkerThread();
+		ImportModelScene(import);
+		ParallelFor((u32)import.nodeMeshes.size(), [&import](u32 i) {
+			ProcessAssimpMesh(import.nodeMeshes[i], import.submeshes[i], import.settings, GetOptimizationStats(import, i));
+		});
+		if (import.scene && !import.submeshes.empty() && IsGpuUploaderRunning())
+			import.stagedGeometry = (co_await UploadOnGpuThread(StageModelGeometry(import))).handle;
+		else
+			co_await SwitchToMainThread();
+		std::vector<u8>().swap(import.geometryStaging);
+	}
+
+	modelIdx = CreateModelFromImport(app, import, true);
+	ReleaseModelImport(import);
+	co_return modelIdx;
+}
@@ -1,5 +1,10 @@
 #pragma once
 
+#include "geometry.h"
+#include "asset_loader.h"
+
+#include <string>
+
 struct App;
 struct aiMesh;
 struct aiScene;
@@ -7,14 +12,72 @@ struct aiNode;
 struct aiMaterial;
 struct Material;
 struct Mesh;
+struct Submesh;
 struct String;
+struct CachedMaterial;
+struct MeshOptimizationStats;
 
 typedef unsigned int u32;
 
-void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices);
+struct ModelImportSettings
+{
+	VertexFormat vertexFormat = VertexFormat_Float;
+	bool         quantizePositions = false; // Compact format only: 16-bit positions relative to the submesh bounds
+	bool         keepGeometryResident = false; // Keep the CPU copy of the vertices and indices after the upload
+	bool         preserveHierarchy = false; // Keep each aiMesh once and draw it from every node that uses it, instead of pretransforming a copy per node
+	bool         optimizeMeshes = false; // Weld and reorder with OptimizeSubmesh instead of Assimp's JoinIdenticalVertices and ImproveCacheLocality
+	bool         generateLods = false; // Append simplified index lists to every submesh, see BuildSubmeshLods
+	bool         generateMeshlets = false; // Split LOD 0 of every submesh into culling clusters, see BuildSubmeshMeshlets
+};
+
+struct ModelImportRequest
+{
+	const char*         filename;
+	ModelImportSettings settings;
+};
+
+void ProcessAssimpMesh(aiMesh* mesh, Submesh& submesh, const ModelImportSettings& settings, MeshOptimizationStats* stats = nullptr);
+
+/**
+ * Fills the material described by DescribeAssimpMaterial and loads its maps on the calling thread.
+ */
+void ProcessAssimpMaterial(App* app, const CachedMaterial& cachedMaterial, Material& myMaterial, String directory);
+
+/**
+ * Colors and map filenames of the material. Its occlusion, roughness and metallic maps become
+ * one ORM texture, packed next to them (see ResolveOrmMap) unless it already exists. Decodes
+ * images, so it runs on the workers with the rest of the import.
+ */
+CachedMaterial DescribeAssimpMaterial(aiMaterial* material, const std::string& directory);
+
+void ProcessAssimpNode(const aiScene* scene, aiNode* node, std::vector<aiMesh*>& nodeMeshes);
+
+/**
+ * Flattens the node tree into nodes (parents first) and one draw per mesh reference.
+ * Draws index scene->mMeshes directly, so each mesh is only processed and uploaded once.
+ */
+void ProcessAssimpNodeHierarchy(aiNode* node, u32 parent, std::vector<ModelNode>& nodes, std::vector<ModelDraw>& draws);
+
+u32 LoadModel(App* app, const char* filename, const ModelImportSettings& settings = {});
 
-void ProcessAssimpMaterial(App* app, aiMaterial* material, Material& myMaterial, String directory);
+/**
+ * Imports the model in the background. The Assimp import and the submesh processing run on
+ * the job system, then the model is created on the main thread. Its materials start with the
+ * default textures and stream their maps afterwards. Resolves to UINT32_MAX on failure.
+ */
+AssetTask<u32> LoadModelAsync(App* app, std::string filename, ModelImportSettings settings = {});
 
-void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices);
+/**
+ * Imports several models at once: files are parsed and their meshes are processed on the
+ * worker pool, then materials and GL buffers are created on the calling (GL) thread.
+ * The returned model indices are in the same order as the requests.
+ */
+std::vector<u32> LoadModels(App* app, const std::vector<ModelImportRequest>& requests);
 
-u32 LoadModel(App* app, const char* filename);
\ No newline at end of file
+#ifdef ENGINE_BENCHMARKS
+/**
+ * Times ProcessAssimpMesh against the original push_back implementation on every mesh
+ * of the given file and checks both produce the same vertex and index streams.
+ */
+void BenchmarkProcessAssimpMesh(const char* filename, u32 iterations = 10);
+#endif
\ No newline at end of file
@@ -7,6 +7,16 @@
 
 #include "engine.h"
 #include "assimp_model_loading.h"
+#include "gpu_uploader.h"
+#include "ibl_cache.h"
+#include "mesh_simplifier.h"
+#include "meshlet.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string_view>
+#include <unordered_set>
 
 #ifdef _DEBUG
 #include <imgui.h>
@@ -46,6 +56,7 @@ GLuint CreateProgramFromSource(String programSource, const char* shaderName)
 	sprintf(shaderNameDefine, "#define %s\n", shaderName);
 	char vertexShaderDefine[] = "#define VERTEX\n";
 	char fragmentShaderDefine[] = "#define FRAGMENT\n";
+	char geometryShaderDefine[] = "#define GEOMETRY\n";
 
 	const GLchar* vertexShaderSource[] = {
 		versionString,
@@ -73,6 +84,21 @@ GLuint CreateProgramFromSource(String programSource, const char* shaderName)
 		(GLint)programSource.len
 	};
 
+	// The geometry stage is optional, only sources with a GEOMETRY section get one
+	const bool hasGeometryShader = std::string_view(programSource.str, programSource.len).find("defined(GEOMETRY)") != std::string_view::npos;
+	const GLchar* geometryShaderSource[] = {
+		versionString,
+		shaderNameDefine,
+		geometryShaderDefine,
+		programSource.str
+	};
+	const GLint geometryShaderLengths[] = {
+		(GLint)strlen(versionString),
+		(GLint)strlen(shaderNameDefine),
+		(GLint)strlen(geometryShaderDefine),
+		(GLint)programSource.len
+	};
+
 	GLuint vshader = glCreateShader(GL_VERTEX_SHADER);
 	if ((err = glGetError()) != GL_NO_ERROR)
 		ELOG("OpenGL error %d\n", err);
@@ -95,6 +121,20 @@ GLuint CreateProgramFromSource(String programSource, const char* shaderName)
 		ELOG("glCompileShader() failed with fragment shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
 	}
 
+	GLuint gshader = 0;
+	if (hasGeometryShader)
+	{
+		gshader = glCreateShader(GL_GEOMETRY_SHADER);
+		glShaderSource(gshader, ARRAY_COUNT(geometryShaderSource), geometryShaderSource, geometryShaderLengths);
+		glCompileShader(gshader);
+		glGetShaderiv(gshader, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			glGetShaderInfoLog(gshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+			ELOG("glCompileShader() failed with geometry shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+		}
+	}
+
 	GLuint programHandle = glCreateProgram();
 	glAttachShader(programHandle, vshader);
 	if ((err = glGetError()) != GL_NO_ERROR)
@@ -102,6 +142,12 @@ GLuint CreateProgramFromSource(String programSource, const char* shaderName)
 	glAttachShader(programHandle, fshader);
 	if ((err = glGetError()) != GL_NO_ERROR)
 		ELOG("OpenGL error %d\n", err);
+	if (gshader != 0)
+	{
+		glAttachShader(programHandle, gshader);
+		if ((err = glGetError()) != GL_NO_ERROR)
+			ELOG("OpenGL error %d\n", err);
+	}
 	glLinkProgram(programHandle);
 	if ((err = glGetError()) != GL_NO_ERROR)
 		ELOG("OpenGL error %d\n", err);
@@ -128,6 +174,13 @@ GLuint CreateProgramFromSource(String programSource, const char* shaderName)
 	glDeleteShader(fshader);
 	if ((err = glGetError()) != GL_NO_ERROR)
 		ELOG("OpenGL error %d\n", err);
+	if (gshader != 0)
+	{
+		glDetachShader(programHandle, gshader);
+		glDeleteShader(gshader);
+		if ((err = glGetError()) != GL_NO_ERROR)
+			ELOG("OpenGL error %d\n", err);
+	}
 
 	if ((err = glGetError()) != GL_NO_ERROR)
 		ELOG("OpenGL error %d\n", err);
@@ -169,10 +222,11 @@ u8 LoadProgramAttributes(Program& program)
 	return attributeCount;
 }
 
-Image LoadImage(const char* filename)
+Image LoadImage(const char* filename, bool flipVertically)
 {
 	Image img = {};
-	stbi_set_flip_vertically_on_load(true);
+	// Per thread: images are decoded on several workers at once
+	stbi_set_flip_vertically_on_load_thread(flipVertically);
 	img.pixels = stbi_load(filename, &img.size.x, &img.size.y, &img.nchannels, 0);
 	if (img.pixels)
 	{
@@ -241,36 +295,518 @@ GLuint CreateTexture2DFromImage(Image image)
 	return texHandle;
 }
 
-u32 LoadTexture2D(App* app, std::string filepath, unsigned int* width, unsigned int* height)
+GLuint CreateTexture2DFromCooked(const CookedTexture& texture)
 {
 	GLenum err;
 
-	Image image = LoadImage(filepath.c_str());
+	const GLenum internalFormat = GetCookedTextureInternalFormat(texture.format);
+
+	GLuint texHandle;
+	glGenTextures(1, &texHandle);
+	if ((err = glGetError()) != GL_NO_ERROR)
+		ELOG("OpenGL error %d\n", err);
+	glBindTexture(GL_TEXTURE_2D, texHandle);
 	if ((err = glGetError()) != GL_NO_ERROR)
 		ELOG("OpenGL error %d\n", err);
 
-	if (image.pixels)
+	// The mip chain is already encoded, every level is uploaded as is
+	for (u32 i = 0; i < texture.levels.size(); ++i)
 	{
-		Texture tex = {};
-		tex.handle = CreateTexture2DFromImage(image);
-		if ((err = glGetError()) != GL_NO_ERROR)
-			ELOG("OpenGL error %d\n", err);
-		tex.filepath = filepath;
-		tex.size = image.size;
+		const CookedTextureLevel& level = texture.levels[i];
+		glCompressedTexImage2D(GL_TEXTURE_2D, i, internalFormat, level.width, level.height, 0, level.size, texture.data.data() + level.offset);
+	}
+	if ((err = glGetError()) != GL_NO_ERROR)
+		ELOG("OpenGL error %d\n", err);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)texture.levels.size() - 1);
+	if ((err = glGetError()) != GL_NO_ERROR)
+		ELOG("OpenGL error %d\n", err);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	if ((err = glGetError()) != GL_NO_ERROR)
+		ELOG("OpenGL error %d\n", err);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	if ((err = glGetError()) != GL_NO_ERROR)
+		ELOG("OpenGL error %d\n", err);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	if ((err = glGetError()) != GL_NO_ERROR)
+		ELOG("OpenGL error %d\n", err);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	if ((err = glGetError()) != GL_NO_ERROR)
+		ELOG("OpenGL error %d\n", err);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	if ((err = glGetError()) != GL_NO_ERROR)
+		ELOG("OpenGL error %d\n", err);
+
+	return texHandle;
+}
 
-		if (width) *width = image.size.x;
-		if (height) *height = image.size.y;
+// What a texture file turns into before the GL work: its cooked mip chain, or the decoded
+// image for raw textures (and if cooking failed)
+struct TextureFileData
+{
+	Image         image;
+	CookedTexture cooked;
+	bool          isCooked;
+	bool          flippedVertically;
+};
 
-		u32 texIdx = app->textures.size();
-		app->textures.push_back(tex);
+static std::string GetTextureCacheKey(const std::string& filepath, TextureUsage usage, bool flipVertically);
 
-		FreeImage(image);
-		return texIdx;
+// Sources being cooked by a worker. Loads of the same file, usage and row order wait for it and
+// read the cooked file instead of cooking it again and writing the same file at the same time.
+static std::mutex TextureCookMutex;
+static std::condition_variable TextureCookFinished;
+static std::unordered_set<std::string> TextureCookPaths; // Texture cache keys
+
+static void BeginTextureCook(const std::string& key)
+{
+	std::unique_lock<std::mutex> lock(TextureCookMutex);
+	TextureCookFinished.wait(lock, [&key] { return TextureCookPaths.count(key) == 0; });
+	TextureCookPaths.insert(key);
+}
+
+static void EndTextureCook(const std::string& key)
+{
+	{
+		std::lock_guard<std::mutex> lock(TextureCookMutex);
+		TextureCookPaths.erase(key);
+	}
+	TextureCookFinished.notify_all();
+}
+
+// No GL and no frame arena, so it can run on a worker thread
+static TextureFileData ReadTextureFile(const std::string& filepath, TextureUsage usage, bool flipVertically)
+{
+	TextureFileData data = {};
+	data.flippedVertically = flipVertically;
+	if (usage == TextureUsage_Raw)
+	{
+		data.image = LoadImage(filepath.c_str(), flipVertically);
+		return data;
+	}
+	if (LoadCookedTexture(filepath.c_str(), usage, flipVertically, data.cooked))
+	{
+		data.isCooked = true;
+		return data;
+	}
+
+	// Checked again once this load owns the cook, another one may have just written the file
+	const std::string cookKey = GetTextureCacheKey(filepath, usage, flipVertically);
+	BeginTextureCook(cookKey);
+	if (LoadCookedTexture(filepath.c_str(), usage, flipVertically, data.cooked))
+	{
+		data.isCooked = true;
 	}
 	else
 	{
+		// First load since the source changed: cook it now, the next runs skip the decode
+		data.image = LoadImage(filepath.c_str(), flipVertically);
+		if (data.image.pixels && CookTexture((const u8*)data.image.pixels, data.image.size.x, data.image.size.y, data.image.nchannels, usage, TextureCookQuality_High, data.cooked))
+		{
+			data.cooked.flippedVertically = flipVertically;
+			SaveCookedTexture(filepath.c_str(), data.cooked);
+			FreeImage(data.image);
+			data.image = {};
+			data.isCooked = true;
+		}
+	}
+	EndTextureCook(cookKey);
+	return data;
+}
+
+static void FreeTextureFileData(TextureFileData& data)
+{
+	if (data.image.pixels)
+		FreeImage(data.image);
+	data = {};
+}
+
+// Path part of the texture cache keys: forward slashes, no "." or "dir/.." segments (and no case on Windows)
+static std::string NormalizeTexturePath(const std::string& filepath)
+{
+	std::vector<std::string> segments;
+	size_t begin = 0;
+	while (begin <= filepath.size())
+	{
+		size_t end = filepath.find_first_of("/\\", begin);
+		if (end == std::string::npos)
+			end = filepath.size();
+
+		std::string segment = filepath.substr(begin, end - begin);
+		if (segment == "..")
+		{
+			if (!segments.empty() && segments.back() != "..")
+				segments.pop_back();
+			else
+				segments.push_back(segment);
+		}
+		else if (!segment.empty() && segment != ".")
+		{
+			segments.push_back(segment);
+		}
+		begin = end + 1;
+	}
+
+	const bool isAbsolute = !filepath.empty() && (filepath[0] == '/' || filepath[0] == '\\');
+	std::string normalized = isAbsolute ? "/" : "";
+	for (u32 i = 0; i < segments.size(); ++i)
+	{
+		if (i > 0)
+			normalized += '/';
+		normalized += segments[i];
+	}
+
+#ifdef _WIN32
+	for (u32 i = 0; i < normalized.size(); ++i)
+		normalized[i] = (char)tolower((unsigned char)normalized[i]);
+#endif
+
+	return normalized;
+}
+
+// Key of a texture in App::textureCache. The same file loaded for another usage or row order
+// is another texture: another format, and only material textures get a layer or bindless handle.
+static std::string GetTextureCacheKey(const std::string& filepath, TextureUsage usage, bool flipVertically)
+{
+	return NormalizeTexturePath(filepath) + "|" + std::to_string((u32)usage) + (flipVertically ? "|flipped" : "");
+}
+
+// Takes one more reference to an already loaded texture, if there is one
+static u32 FindCachedTexture(App* app, const std::string& cacheKey)
+{
+	auto it = app->textureCache.find(cacheKey);
+	if (it == app->textureCache.end())
+		return UINT32_MAX;
+
+	Texture& tex = app->textures[it->second];
+	tex.refCount++;
+	app->textureCacheHits++;
+	app->textureCacheBytesSaved += tex.byteSize;
+	return it->second;
+}
+
+// Adds a created texture to the cache and frees the file data it was made from
+static u32 RegisterTexture2D(App* app, Texture& tex, TextureFileData& data, const std::string& filepath, TextureUsage usage)
+{
+	tex.filepath = filepath;
+	tex.cacheKey = GetTextureCacheKey(filepath, usage, data.flippedVertically);
+	tex.refCount = 1;
+
+	u32 texIdx = app->textures.size();
+	app->textures.push_back(tex);
+	app->textureCache[tex.cacheKey] = texIdx;
+
+	FreeTextureFileData(data);
+	return texIdx;
+}
+
+// Creates the texture of a file read by ReadTextureFile, adds it to the cache and frees the file data.
+// Material textures (any usage but raw) get a resident bindless handle, or go into a layer of the
+// texture arrays without bindless textures.
+static u32 AddTexture2D(App* app, TextureFileData& data, const std::string& filepath, TextureUsage usage)
+{
+	GLenum err;
+
+	if (!data.isCooked && !data.image.pixels)
 		return UINT32_MAX;
+
+	const bool inArray = usage != TextureUsage_Raw && !app->bindlessTextures;
+	const bool streamed = usage != TextureUsage_Raw && data.isCooked && ShouldStreamTexture(data.cooked);
+	Texture tex = {};
+	if (streamed)
+	{
+		// Only the small levels for now, the streamer reads the others when they are needed
+		const u32 residentLevel = GetStreamingInitialLevel(data.cooked);
+		tex.handle = CreateStreamedTexture(data.cooked, residentLevel, app->bindlessTextures);
+		tex.size = ivec2(data.cooked.width, data.cooked.height);
+		tex.byteSize = data.cooked.data.size() - data.cooked.levels[residentLevel].offset;
+		tex.streamIdx = AddStreamedTexture(app->textureStreamer, (u32)app->textures.size(), filepath, usage, data.cooked, residentLevel);
+	}
+	else if (data.isCooked)
+	{
+		if (inArray)
+			tex.layer = AddCookedTextureLayer(app->textureArrays, data.cooked);
+		else
+			tex.handle = CreateTexture2DFromCooked(data.cooked);
+		tex.size = ivec2(data.cooked.width, data.cooked.height);
+		tex.byteSize = data.cooked.data.size();
+	}
+	else
+	{
+		if (inArray)
+			tex.layer = AddImageTextureLayer(app->textureArrays, data.image.pixels, data.image.size.x, data.image.size.y, data.image.nchannels);
+		else
+			tex.handle = CreateTexture2DFromImage(data.image);
+		tex.size = data.image.size;
+		tex.byteSize = (u64)data.image.size.x * data.image.size.y * data.image.nchannels * 4 / 3;
+	}
+	if (usage != TextureUsage_Raw && app->bindlessTextures)
+		tex.bindlessHandle = MakeTextureResident(tex.handle, app->textureArrays.samplers[SamplerObject_TrilinearClamp]);
+	if ((err = glGetError()) != GL_NO_ERROR)
+		ELOG("OpenGL error %d\n", err);
+	return RegisterTexture2D(app, tex, data, filepath, usage);
+}
+
+// Material texture uploads done on the upload thread: the same textures AddTexture2D would create,
+// except array layers, which are copied from the uploaded texture on the GPU
+static GpuUpload MakeTextureUpload(const TextureFileData& data, bool bindless)
+{
+	GpuUpload upload = {};
+	upload.target = GL_TEXTURE_2D;
+	if (data.isCooked)
+	{
+		upload.type = GpuUploadType_CookedTexture;
+		upload.cooked = &data.cooked;
+		if (ShouldStreamTexture(data.cooked))
+		{
+			upload.firstLevel = GetStreamingInitialLevel(data.cooked);
+			upload.target = bindless ? GL_TEXTURE_2D : GL_TEXTURE_2D_ARRAY;
+		}
 	}
+	else
+	{
+		upload.type = GpuUploadType_ImageTexture;
+		upload.image = &data.image;
+	}
+	return upload;
+}
+
+// Adopts a material texture made from MakeTextureUpload, like AddTexture2D does with the ones it creates
+static u32 AddUploadedTexture2D(App* app, TextureFileData& data, const GpuUpload& upload, const std::string& filepath, TextureUsage usage)
+{
+	GLenum err;
+
+	Texture tex = {};
+	if (data.isCooked)
+	{
+		tex.size = ivec2(data.cooked.width, data.cooked.height);
+		tex.byteSize = data.cooked.data.size() - data.cooked.levels[upload.firstLevel].offset;
+	}
+	else
+	{
+		tex.size = data.image.size;
+		tex.byteSize = (u64)data.image.size.x * data.image.size.y * data.image.nchannels * 4 / 3;
+	}
+
+	if (data.isCooked && ShouldStreamTexture(data.cooked))
+	{
+		tex.handle = upload.handle;
+		tex.streamIdx = AddStreamedTexture(app->textureStreamer, (u32)app->textures.size(), filepath, usage, data.cooked, upload.firstLevel);
+	}
+	else if (app->bindlessTextures)
+	{
+		tex.handle = upload.handle;
+	}
+	else
+	{
+		GLenum internalFormat, dataFormat;
+		u32 levelCount;
+		if (data.isCooked)
+		{
+			internalFormat = GetCookedTextureInternalFormat(data.cooked.format);
+			levelCount = (u32)data.cooked.levels.size();
+		}
+		else
+		{
+			GetImageTextureFormats(data.image.nchannels, &internalFormat, &dataFormat);
+			levelCount = GetMipLevelCount(data.image.size.x, data.image.size.y);
+		}
+		tex.layer = AddTextureLayerFromTexture(app->textureArrays, upload.handle, internalFormat, tex.size.x, tex.size.y, levelCount);
+		glDeleteTextures(1, &upload.handle);
+	}
+	if (app->bindlessTextures)
+		tex.bindlessHandle = MakeTextureResident(tex.handle, app->textureArrays.samplers[SamplerObject_TrilinearClamp]);
+	if ((err = glGetError()) != GL_NO_ERROR)
+		ELOG("OpenGL error %d\n", err);
+	return RegisterTexture2D(app, tex, data, filepath, usage);
+}
+
+u32 LoadTexture2D(App* app, std::string filepath, TextureUsage usage, unsigned int* width, unsigned int* height)
+{
+	GLenum err;
+
+	const bool flipVertically = true; // GL reads the rows from the bottom
+	u32 texIdx = FindCachedTexture(app, GetTextureCacheKey(filepath, usage, flipVertically));
+	if (texIdx != UINT32_MAX)
+	{
+		if (width) *width = app->textures[texIdx].size.x;
+		if (height) *height = app->textures[texIdx].size.y;
+		return texIdx;
+	}
+
+	TextureFileData data = ReadTextureFile(filepath, usage, flipVertically);
+	if ((err = glGetError()) != GL_NO_ERROR)
+		ELOG("OpenGL error %d\n", err);
+
+	if (width) *width = data.isCooked ? data.cooked.width : data.image.size.x;
+	if (height) *height = data.isCooked ? data.cooked.height : data.image.size.y;
+
+	return AddTexture2D(app, data, filepath, usage);
+}
+
+AssetTask<u32> LoadTexture2DAsync(App* app, std::string filepath, TextureUsage usage)
+{
+	const bool flipVertically = true; // GL reads the rows from the bottom
+	const std::string cacheKey = GetTextureCacheKey(filepath, usage, flipVertically);
+	u32 texIdx = FindCachedTexture(app, cacheKey);
+	if (texIdx != UINT32_MAX)
+		co_return texIdx;
+
+	const bool bindless = app->bindlessTextures;
+	co_await SwitchToWorkerThread();
+	TextureFileData data = ReadTextureFile(filepath, usage, flipVertically);
+
+	// Material textures are created on the upload thread, the main thread only adopts them
+	GpuUpload upload = {};
+	if (usage != TextureUsage_Raw && (data.isCooked || data.image.pixels) && IsGpuUploaderRunning())
+		upload = co_await UploadOnGpuThread(MakeTextureUpload(data, bindless));
+	else
+		co_await SwitchToMainThread();
+
+	// Another load of the same file may have finished while this one was decoding
+	texIdx = FindCachedTexture(app, cacheKey);
+	if (texIdx != UINT32_MAX)
+	{
+		glDeleteTextures(1, &upload.handle);
+		FreeTextureFileData(data);
+		co_return texIdx;
+	}
+	if (upload.handle != 0)
+		co_return AddUploadedTexture2D(app, data, upload, filepath, usage);
+	co_return AddTexture2D(app, data, filepath, usage);
+}
+
+void ReleaseTexture(App* app, u32 textureIdx)
+{
+	if (textureIdx >= app->textures.size())
+		return;
+
+	Texture& tex = app->textures[textureIdx];
+	if (tex.refCount == 0)
+		return;
+
+	if (--tex.refCount == 0)
+	{
+		MakeTextureNonResident(tex.bindlessHandle);
+		RemoveStreamedTexture(app->textureStreamer, tex.streamIdx);
+		if (tex.layer.arrayIdx != UINT32_MAX)
+			ReleaseTextureLayer(app->textureArrays, tex.layer);
+		else
+			glDeleteTextures(1, &tex.handle);
+		app->textureCache.erase(tex.cacheKey);
+		tex.handle = 0;
+		tex.bindlessHandle = 0;
+		tex.layer = TextureLayer{};
+		tex.streamIdx = UINT32_MAX;
+		tex.byteSize = 0;
+	}
+}
+
+// Entities keep their current (placeholder) model until the real one is ready
+static AssetTask<u32> LoadEntityModelAsync(App* app, u32 entityIdx, std::string filename, ModelImportSettings settings)
+{
+	u32 modelIdx = co_await LoadModelAsync(app, filename, settings);
+	if (modelIdx != UINT32_MAX)
+		app->entities[entityIdx].modelIndex = modelIdx;
+	co_return modelIdx;
+}
+
+#define CUBEMAP_CAPTURE_BINDING 2 // Uniform block with the face matrices of the layered IBL bakes
+
+// The maps InitSkyboxAsync bakes, as stored in the IBL cache
+static const IblCacheMap EnvironmentCacheMaps[] =
+{
+	{ GL_TEXTURE_CUBE_MAP, GL_RGB8, GL_RGB, GL_UNSIGNED_BYTE, 3, 512, 10 }, // envCubemap, down to 1x1
+	{ GL_TEXTURE_CUBE_MAP, GL_RGB8, GL_RGB, GL_UNSIGNED_BYTE, 3, 128, 5 },  // prefilterMap, one level per roughness step
+};
+static const IblCacheMap BrdfLutCacheMap = { GL_TEXTURE_2D, GL_RG16F, GL_RG, GL_HALF_FLOAT, 4, 512, 1 };
+
+static void CreateCaptureFramebuffer(unsigned int& captureFBO, unsigned int& captureRBO);
+static void BakeEnvironmentMaps(App* app, u32 hdrTextureIdx, unsigned int captureFBO, unsigned int captureRBO, unsigned int& envCubemap, unsigned int& prefilterMap);
+static void BakeBrdfLut(App* app, unsigned int captureFBO, unsigned int captureRBO, unsigned int& brdfLUTTexture);
+
+// Loads the IBL maps from the cache when the panorama and the bake shaders haven't changed,
+// without even decoding the panorama. Only what is missing is baked, then cached for the next run.
+// The BRDF LUT doesn't depend on the panorama and is baked even if it can't be read. Resolves to
+// whether the environment maps exist.
+static AssetTask<bool> InitSkyboxAsync(App* app, std::string filename)
+{
+	const u32 environmentMapCount = ARRAY_COUNT(EnvironmentCacheMaps);
+	const std::vector<std::string> environmentFiles = {
+		filename,
+		app->programs[app->equirectangularToCubemapProgramIdx].filepath,
+		app->programs[app->prefilterProgramIdx].filepath,
+	};
+	const std::vector<std::string> brdfLutFiles = { app->programs[app->brdfProgramIdx].filepath };
+	const std::string environmentCachePath = GetIblCachePath(filename.c_str());
+
+	co_await SwitchToWorkerThread();
+	auto start = std::chrono::steady_clock::now();
+	const u64 environmentKey = GetIblBakeKey(environmentFiles, EnvironmentCacheMaps, environmentMapCount);
+	const u64 brdfLutKey = GetIblBakeKey(brdfLutFiles, &BrdfLutCacheMap, 1);
+	std::vector<u8> environmentPixels, brdfLutPixels;
+	const bool environmentCached = environmentKey != 0 && ReadIblCache(environmentCachePath.c_str(), environmentKey, EnvironmentCacheMaps, environmentMapCount, environmentPixels);
+	const bool brdfLutCached = brdfLutKey != 0 && ReadIblCache(IBL_BRDF_LUT_CACHE_PATH, brdfLutKey, &BrdfLutCacheMap, 1, brdfLutPixels);
+
+	co_await SwitchToMainThread();
+	if (environmentCached)
+	{
+		GLuint textures[ARRAY_COUNT(EnvironmentCacheMaps)];
+		CreateIblCacheTextures(EnvironmentCacheMaps, environmentMapCount, environmentPixels, textures);
+		app->envCubemap = textures[0];
+		app->prefilterMap = textures[1];
+	}
+	if (brdfLutCached)
+		CreateIblCacheTextures(&BrdfLutCacheMap, 1, brdfLutPixels, &app->brdfLUTTexture);
+	if (environmentCached || brdfLutCached)
+	{
+		const f64 seconds = std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+		ILOG("IBL cache of %s: environment %s, BRDF LUT %s (%.2f ms)", filename.c_str(),
+			environmentCached ? "loaded" : "baking", brdfLutCached ? "loaded" : "baking", seconds * 1000.0);
+	}
+
+	// The panorama is only needed for the bake, it is released as soon as the cubemaps exist
+	u32 hdrTextureIdx = UINT32_MAX;
+	if (!environmentCached)
+	{
+		hdrTextureIdx = co_await LoadTexture2DAsync(app, filename);
+		if (hdrTextureIdx == UINT32_MAX)
+			ELOG("Could not read the panorama %s, the environment maps are not baked", filename.c_str());
+	}
+
+	if (hdrTextureIdx != UINT32_MAX || !brdfLutCached)
+	{
+		unsigned int captureFBO;
+		unsigned int captureRBO;
+		CreateCaptureFramebuffer(captureFBO, captureRBO);
+		if (hdrTextureIdx != UINT32_MAX)
+		{
+			BakeEnvironmentMaps(app, hdrTextureIdx, captureFBO, captureRBO, app->envCubemap, app->prefilterMap);
+			ReleaseTexture(app, hdrTextureIdx);
+			const GLuint textures[] = { app->envCubemap, app->prefilterMap };
+			SaveIblCache(environmentCachePath.c_str(), environmentKey, EnvironmentCacheMaps, environmentMapCount, textures);
+		}
+		if (!brdfLutCached)
+		{
+			BakeBrdfLut(app, captureFBO, captureRBO, app->brdfLUTTexture);
+			SaveIblCache(IBL_BRDF_LUT_CACHE_PATH, brdfLutKey, &BrdfLutCacheMap, 1, &app->brdfLUTTexture);
+		}
+		glDeleteRenderbuffers(1, &captureRBO);
+		glDeleteFramebuffers(1, &captureFBO);
+	}
+	if (!environmentCached && hdrTextureIdx == UINT32_MAX)
+		co_return false;
+
+	// Diffuse lighting: a small level of the environment projected on a worker
+	u32 faceSize = 0;
+	const std::vector<u8> environmentLevel = ReadCubemapLevel(app->envCubemap, SH_IRRADIANCE_LEVEL, faceSize);
+	if (faceSize > 0)
+	{
+		co_await SwitchToWorkerThread();
+		const SHIrradiance irradianceSH = ProjectCubemapIrradiance(environmentLevel.data(), faceSize, 3);
+		co_await SwitchToMainThread();
+		app->irradianceSH = irradianceSH;
+	}
+	co_return true;
 }
 
 mat4 TransformScale(const vec3& scaleFactors)
@@ -327,26 +863,37 @@ void Init(App* app)
 		ELOG("ERROR: Could not create constant buffer: %s\n", err);
 	}
 
-	app->whiteTexIdx = LoadTexture2D(app, "color_white.png");
+	// The programs decide between bindless material textures and texture arrays
+	InitPrograms(app);
+
+	// The defaults fill the material slots without a map, so they are material textures too
+	InitTextureArrayPool(app->textureArrays);
+	if (app->bindlessTextures)
+		InitMaterialTable(app->materialTable);
+	app->whiteTexIdx = LoadTexture2D(app, "color_white.png", TextureUsage_Albedo);
 	app->greyTexIdx = LoadTexture2D(app, "color_grey.png");
-	app->blackTexIdx = LoadTexture2D(app, "color_black.png");
-	app->defaultNormalTexIdx = LoadTexture2D(app, "color_normal.png");
+	app->blackTexIdx = LoadTexture2D(app, "color_black.png", TextureUsage_ORM);
+	app->defaultNormalTexIdx = LoadTexture2D(app, "color_normal.png", TextureUsage_Normal);
+
+	InitGeometryPool(app->geometryPool);
 
 	// Rendering
 	app->currentRenderTargetMode = RenderTargetsMode::FINAL_RENDER;
 
-	InitPrograms(app);
+#ifdef ENGINE_BENCHMARKS
+	BenchmarkProcessAssimpMesh("Assets/orc/Posing.fbx");
+#endif
 
-	// Load Entities & Light
+	// Load Entities & Light. Models and the skybox load in the background while the first
+	// frames are drawn: entities show the placeholder and the IBL maps stay black until then.
+	app->placeholderModelIdx = CreatePlaceholderModel(app);
+	app->isLoadingAssets = true;
 	InitEntities(app);
 	if ((err = glGetError()) != GL_NO_ERROR)
 		ELOG("OpenGL error %d\n", err);
 	InitLight(app);
 
-	unsigned int captureFBO;
-	unsigned int captureRBO;
-
-	InitSkybox(app, MakeString("Assets/skybox/digital_painting_grand_canyon.png").str, captureFBO, captureRBO, app->envCubemap, app->irradianceMap, app->prefilterMap, app->brdfLUTTexture);
+	InitSkyboxAsync(app, "Assets/skybox/digital_painting_grand_canyon.png");
 
 	// app->skyboxVAO = InitSkyboxVAO(app);
 
@@ -358,12 +905,20 @@ void Init(App* app)
 
 void InitEntities(App* app)
 {
+	// The big FBX assets use the compact vertex format to save bandwidth and VRAM
+	ModelImportSettings compactSettings = {};
+	compactSettings.vertexFormat = VertexFormat_Compact;
+	compactSettings.quantizePositions = true;
+	compactSettings.optimizeMeshes = true;
+	compactSettings.generateLods = true;
+	compactSettings.generateMeshlets = true;
+
 	Entity orc;
 	orc.name = MakeString("orc"); // Name
 	orc.worldMatrix = glm::mat4(1.0f); // worldMatrix
 	orc.worldViewProjection = glm::mat4(1.0f); // worldViewProjection
 	orc.scale = 0.1f; // scale
-	orc.modelIndex = LoadModel(app, "Assets/orc/Posing.fbx"); // modelIndex
+	orc.modelIndex = app->placeholderModelIdx; // modelIndex
 
 	// Positions
 	orc.setPosition(vec3(5.0f, 0.0f, 0.0f));
@@ -373,20 +928,15 @@ void InitEntities(App* app)
 	gun.worldMatrix = glm::mat4(1.0f); // worldMatrix
 	gun.worldViewProjection = glm::mat4(1.0f); // worldViewProjection
 	gun.scale = 0.1f; // scale
-	gun.modelIndex = LoadModel(app, "Assets/cerberus/Cerberus_LP_V2.fbx"); // modelIndex
-
-	Entity plane;
-	plane.name = MakeString("Plane"); // Name
-	plane.worldMatrix = glm::mat4(1.0f); // worldMatrix
-	plane.worldViewProjection = glm::mat4(1.0f); // worldViewProjection
-	plane.scale = 15.f; // scale
-	plane.modelIndex = LoadModel(app, "Assets/Primitives/Plane/plane.obj"); // modelIndex
-
-	plane.setPosition(vec3(0.0f, 0.0f, 0.0f));
+	gun.modelIndex = app->placeholderModelIdx; // modelIndex
 
 	// Push Entities
 	app->entities.push_back(orc);
 	app->entities.push_back(gun);
+
+	// Import the models in the background, they replace the placeholders when ready
+	LoadEntityModelAsync(app, 0, "Assets/orc/Posing.fbx", compactSettings);
+	LoadEntityModelAsync(app, 1, "Assets/cerberus/Cerberus_LP_V2.fbx", compactSettings);
 }
 
 void InitLight(App* app)
@@ -398,13 +948,9 @@ void InitLight(App* app)
 	app->lights.push_back(CreateLight(app, LightType::LightType_Point, vec3(-70.0f, 100.0f, -70.0f), vec3(70.0f, -100.0f, 70.0f), vec3(1.0f, 1.0f, 1.0f)));
 }
 
-unsigned int InitSkybox(App* app, std::string filename, unsigned int& captureFBO, unsigned int& captureRBO, unsigned int& envCubemap, unsigned int& irradianceMap, unsigned int& prefilterMap, unsigned int& brdfLUTTexture)
+// Framebuffer the IBL maps are rendered to, with a depth buffer the bakes resize to every map
+static void CreateCaptureFramebuffer(unsigned int& captureFBO, unsigned int& captureRBO)
 {
-	GLenum err;
-
-	if ((err = glGetError()) != GL_NO_ERROR)
-		ELOG("Error enabling depth test: %d\n", err);
-
 	// pbr: setup framebuffer
 	// ----------------------
 	glGenFramebuffers(1, &captureFBO);
@@ -414,12 +960,22 @@ unsigned int InitSkybox(App* app, std::string filename, unsigned int& captureFBO
 	glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
 	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 512, 512);
 	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, captureRBO);
+}
+
+// Bakes the environment cubemap of the panorama, and from it the prefiltered map. Every pass
+// renders all six faces in one draw: the whole cubemap level is attached as a layered target
+// and the geometry shader of the bake programs sends each instance of the cube to its face.
+static void BakeEnvironmentMaps(App* app, u32 hdrTextureIdx, unsigned int captureFBO, unsigned int captureRBO, unsigned int& envCubemap, unsigned int& prefilterMap)
+{
+	GLenum err;
 
-	unsigned int skyboxWidth, skyboxHeight;
-	unsigned int hdrTexture = LoadTexture2D(app, filename, &skyboxWidth, &skyboxHeight);
+	// The cube is seen from inside, no depth needed. A layered framebuffer can't mix in the
+	// depth renderbuffer anyway, it is attached again at the end for the BRDF LUT.
+	glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, 0);
 
-	// pbr: setup cubemap to render to and attach to framebuffer
-	// ---------------------------------------------------------
+	// pbr: setup cubemap to render to
+	// -------------------------------
 	glGenTextures(1, &envCubemap);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
 	for (unsigned int i = 0; i < 6; ++i)
@@ -433,10 +989,10 @@ unsigned int InitSkybox(App* app, std::string filename, unsigned int& captureFBO
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
 	if ((err = glGetError()) != GL_NO_ERROR)
-		ELOG("Error enabling depth test: %d\n", err);
+		ELOG("OpenGL error %d creating the environment cubemap\n", err);
 
-	// pbr: set up projection and view matrices for capturing data onto the 6 cubemap face directions
-	// ----------------------------------------------------------------------------------------------
+	// pbr: projection and view matrices of the 6 cubemap face directions, in the capture UBO
+	// --------------------------------------------------------------------------------------
 	glm::mat4 captureProjection = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 10.0f);
 	glm::mat4 captureViews[] =
 	{
@@ -447,125 +1003,42 @@ unsigned int InitSkybox(App* app, std::string filename, unsigned int& captureFBO
 		glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f,  0.0f,  1.0f), glm::vec3(0.0f, -1.0f,  0.0f)),
 		glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f,  0.0f, -1.0f), glm::vec3(0.0f, -1.0f,  0.0f))
 	};
+	glm::mat4 captureViewProjections[6];
+	for (unsigned int i = 0; i < 6; ++i)
+		captureViewProjections[i] = captureProjection * captureViews[i];
 
-	if ((err = glGetError()) != GL_NO_ERROR)
-		ELOG("Error enabling depth test: %d\n", err);
+	GLuint captureUBO;
+	glGenBuffers(1, &captureUBO);
+	glBindBuffer(GL_UNIFORM_BUFFER, captureUBO);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(captureViewProjections), captureViewProjections, GL_STATIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, CUBEMAP_CAPTURE_BINDING, captureUBO);
 
 	// pbr: convert HDR equirectangular environment map to cubemap equivalent
 	// ----------------------------------------------------------------------
 	Program& equirectangularToCubemapProgram = app->programs[app->equirectangularToCubemapProgramIdx];
 	glUseProgram(equirectangularToCubemapProgram.handle);
 	glUniform1i(glGetUniformLocation(equirectangularToCubemapProgram.handle, "equirectangularMap"), 0);
-	glUniformMatrix4fv(glGetUniformLocation(equirectangularToCubemapProgram.handle, "projection"), 1, GL_FALSE, &captureProjection[0][0]);
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, app->textures[hdrTexture].handle);
+	glBindTexture(GL_TEXTURE_2D, app->textures[hdrTextureIdx].handle);
 
 	glViewport(0, 0, 512, 512); // don't forget to configure the viewport to the capture dimensions.
-	glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-	for (unsigned int i = 0; i < 6; ++i)
-	{
-		glUniformMatrix4fv(glGetUniformLocation(equirectangularToCubemapProgram.handle, "view"), 1, GL_FALSE, &captureViews[i][0][0]);
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, envCubemap, 0);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-		RenderCube(app);
-	}
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, envCubemap, 0);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+		ELOG("Layered capture framebuffer incomplete: 0x%x\n", status);
+	glClear(GL_COLOR_BUFFER_BIT);
+	RenderCube(app);
 
 	if ((err = glGetError()) != GL_NO_ERROR)
-		ELOG("Error enabling depth test: %d\n", err);
+		ELOG("OpenGL error %d baking the environment cubemap\n", err);
 
 	// then let OpenGL generate mipmaps from first mip face (combatting visible dots artifact)
 	glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
 	glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
 
-	if ((err = glGetError()) != GL_NO_ERROR)
-		ELOG("Error enabling depth test: %d\n", err);
-
-	// pbr: create an irradiance cubemap, and re-scale capture FBO to irradiance scale.
-	// --------------------------------------------------------------------------------
-	glGenTextures(1, &irradianceMap);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap);
-	for (unsigned int i = 0; i < 6; ++i)
-	{
-		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB8, 32, 32, 0, GL_RGB, GL_FLOAT, nullptr);
-	}
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-	glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-	glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 32, 32);
-
-	if ((err = glGetError()) != GL_NO_ERROR)
-		ELOG("Error enabling depth test: %d\n", err);
-
-	// pbr: solve diffuse integral by convolution to create an irradiance (cube)map.
-	// -----------------------------------------------------------------------------
-	Program& irradianceConvolutionProgram = app->programs[app->irradianceConvolutionProgramIdx];
-	glUseProgram(irradianceConvolutionProgram.handle);
-
-	if ((err = glGetError()) != GL_NO_ERROR)
-		ELOG("Error enabling depth test: %d\n", err);
-
-	glUniform1i(glGetUniformLocation(irradianceConvolutionProgram.handle, "environmentMap"), 0);
-
-	if ((err = glGetError()) != GL_NO_ERROR)
-		ELOG("Error enabling depth test: %d\n", err);
-
-	glUniformMatrix4fv(glGetUniformLocation(irradianceConvolutionProgram.handle, "projection"), 1, GL_FALSE, &captureProjection[0][0]);
-
-	if ((err = glGetError()) != GL_NO_ERROR)
-		ELOG("Error enabling depth test: %d\n", err);
-
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
-
-	if ((err = glGetError()) != GL_NO_ERROR)
-		ELOG("Error enabling depth test: %d\n", err);
-
-	glViewport(0, 0, 32, 32); // don't forget to configure the viewport to the capture dimensions.
-	glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-
-	if ((err = glGetError()) != GL_NO_ERROR)
-		ELOG("Error enabling depth test: %d\n", err);
-
-	for (unsigned int i = 0; i < 6; ++i)
-	{
-		unsigned int viewUniform = glGetUniformLocation(irradianceConvolutionProgram.handle, "view");
-		if ((err = glGetError()) != GL_NO_ERROR)
-			ELOG("Error enabling depth test: %d\n", err);
-
-		glUniformMatrix4fv(viewUniform, 1, GL_FALSE, &captureViews[i][0][0]);
-
-		if ((err = glGetError()) != GL_NO_ERROR)
-			ELOG("Error enabling depth test: %d\n", err);
-
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, irradianceMap, 0);
-
-		if ((err = glGetError()) != GL_NO_ERROR)
-			ELOG("Error enabling depth test: %d\n", err);
-
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-		if ((err = glGetError()) != GL_NO_ERROR)
-			ELOG("Error enabling depth test: %d\n", err);
-
-		RenderCube(app);
-
-		if ((err = glGetError()) != GL_NO_ERROR)
-			ELOG("Error enabling depth test: %d\n", err);
-	}
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-	if ((err = glGetError()) != GL_NO_ERROR)
-		ELOG("Error enabling depth test: %d\n", err);
-
-	// pbr: create a pre-filter cubemap, and re-scale capture FBO to pre-filter scale.
-	// --------------------------------------------------------------------------------
+	// pbr: create a pre-filter cubemap
+	// --------------------------------
 	glGenTextures(1, &prefilterMap);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, prefilterMap);
 	for (unsigned int i = 0; i < 6; ++i)
@@ -578,50 +1051,49 @@ unsigned int InitSkybox(App* app, std::string filename, unsigned int& captureFBO
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR); // be sure to set minification filter to mip_linear 
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-	if ((err = glGetError()) != GL_NO_ERROR)
-		ELOG("Error enabling depth test: %d\n", err);
-
 	// generate mipmaps for the cubemap so OpenGL automatically allocates the required memory.
 	glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
 
 	if ((err = glGetError()) != GL_NO_ERROR)
-		ELOG("Error enabling depth test: %d\n", err);
+		ELOG("OpenGL error %d creating the prefiltered cubemap\n", err);
 
 	// pbr: run a quasi monte-carlo simulation on the environment lighting to create a prefilter (cube)map.
 	// ----------------------------------------------------------------------------------------------------
 	Program& prefilterProgram = app->programs[app->prefilterProgramIdx];
 	glUseProgram(prefilterProgram.handle);
 	glUniform1i(glGetUniformLocation(prefilterProgram.handle, "environmentMap"), 0);
-	glUniformMatrix4fv(glGetUniformLocation(prefilterProgram.handle, "projection"), 1, GL_FALSE, &captureProjection[0][0]);
+	const GLint roughnessLocation = glGetUniformLocation(prefilterProgram.handle, "roughness");
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
 
-	glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
 	unsigned int maxMipLevels = 5;
 	for (unsigned int mip = 0; mip < maxMipLevels; ++mip)
 	{
-		// reisze framebuffer according to mip-level size.
-		unsigned int mipWidth = static_cast<unsigned int>(128 * std::pow(0.5, mip));
-		unsigned int mipHeight = static_cast<unsigned int>(128 * std::pow(0.5, mip));
-		glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, mipWidth, mipHeight);
-		glViewport(0, 0, mipWidth, mipHeight);
+		// one draw per mip, all six faces of it at once
+		unsigned int mipSize = 128 >> mip;
+		glViewport(0, 0, mipSize, mipSize);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, prefilterMap, mip);
 
 		float roughness = (float)mip / (float)(maxMipLevels - 1);
-		glUniform1f(glGetUniformLocation(prefilterProgram.handle, "roughness"), roughness);
-		for (unsigned int i = 0; i < 6; ++i)
-		{
-			glUniformMatrix4fv(glGetUniformLocation(prefilterProgram.handle, "view"), 1, GL_FALSE, &captureViews[i][0][0]);
-			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, prefilterMap, mip);
-
-			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-			RenderCube(app);
-		}
+		glUniform1f(roughnessLocation, roughness);
+		glClear(GL_COLOR_BUFFER_BIT);
+		RenderCube(app);
 	}
+
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 0, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, captureRBO);
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, CUBEMAP_CAPTURE_BINDING, 0);
+	glDeleteBuffers(1, &captureUBO);
 
 	if ((err = glGetError()) != GL_NO_ERROR)
-		ELOG("Error enabling depth test: %d\n", err);
+		ELOG("OpenGL error %d baking the prefiltered cubemap\n", err);
+}
+
+// The BRDF LUT only depends on the shader, every environment uses the same one
+static void BakeBrdfLut(App* app, unsigned int captureFBO, unsigned int captureRBO, unsigned int& brdfLUTTexture)
+{
+	GLenum err;
 
 	// pbr: generate a 2D LUT from the BRDF equations used.
 	// ----------------------------------------------------
@@ -658,8 +1130,6 @@ unsigned int InitSkybox(App* app, std::string filename, unsigned int& captureFBO
 
 	if ((err = glGetError()) != GL_NO_ERROR)
 		ELOG("Error enabling depth test: %d\n", err);
-
-	return 0;
 }
 
 void InitPrograms(App* app) {
@@ -667,6 +1137,21 @@ void InitPrograms(App* app) {
 	Program& directPBRIBLProgram = app->programs[app->directPBRIBLProgramIdx];
 	LoadProgramAttributes(directPBRIBLProgram);
 
+	// Same shader, reading the material maps through the material table
+	app->directPBRIBLBindlessProgramIdx = UINT32_MAX;
+	app->bindlessTextures = false;
+	if (IsBindlessTextureSupported())
+	{
+		app->directPBRIBLBindlessProgramIdx = LoadProgram(app, "shaders/pbr_direct_ibl.glsl", "PBR_IBL_DIRECT_BINDLESS");
+		Program& directPBRIBLBindlessProgram = app->programs[app->directPBRIBLBindlessProgramIdx];
+		LoadProgramAttributes(directPBRIBLBindlessProgram);
+
+		GLint linked = GL_FALSE;
+		glGetProgramiv(directPBRIBLBindlessProgram.handle, GL_LINK_STATUS, &linked);
+		app->bindlessTextures = linked == GL_TRUE;
+	}
+	ILOG("Material textures: %s", app->bindlessTextures ? "bindless" : "texture arrays");
+
 	app->deferredGeometryProgramIdx = LoadProgram(app, "shaders/deferred_geometry.glsl", "DEFERRED_GEOMETRY");
 	Program& deferredGeomtryProgram = app->programs[app->deferredGeometryProgramIdx];
 	LoadProgramAttributes(deferredGeomtryProgram);
@@ -679,10 +1164,6 @@ void InitPrograms(App* app) {
 	Program& equirectangularToCubemapProgram = app->programs[app->equirectangularToCubemapProgramIdx];
 	LoadProgramAttributes(equirectangularToCubemapProgram);
 
-	app->irradianceConvolutionProgramIdx = LoadProgram(app, "shaders/irradiance_convolution.glsl", "IRRADIANCE_CONVOLUTION");
-	Program& irradianceConvolutionProgram = app->programs[app->irradianceConvolutionProgramIdx];
-	LoadProgramAttributes(irradianceConvolutionProgram);
-
 	app->prefilterProgramIdx = LoadProgram(app, "shaders/prefilter.glsl", "PREFILTER");
 	Program& prefilterProgram = app->programs[app->prefilterProgramIdx];
 	LoadProgramAttributes(prefilterProgram);
@@ -725,6 +1206,8 @@ void Gui(App* app)
 	//Info window
 	ImGui::Begin("Info");
 	ImGui::Text("FPS: %f", 1.0f / app->deltaTime);
+	if (app->isLoadingAssets)
+		ImGui::Text("Loading assets: %u tasks pending", GetPendingAssetTaskCount());
 	ImGui::Text("OpenGL version: %s", glGetString(GL_VERSION));
 	ImGui::Text("OpenGL Renderer: %s", glGetString(GL_RENDERER));
 	ImGui::Text("OpenGL Vendor: %s", glGetString(GL_VENDOR));
@@ -741,6 +1224,45 @@ void Gui(App* app)
 
 		ImGui::TreePop();
 	}
+	if (ImGui::TreeNode("Texture cache:"))
+	{
+		ImGui::Text("Textures: %u", (u32)app->textureCache.size());
+		ImGui::Text("Hits: %u", app->textureCacheHits);
+		ImGui::Text("Bytes saved: %.2f MB", app->textureCacheBytesSaved / (1024.0 * 1024.0));
+		ImGui::Text("Material textures: %s", app->bindlessTextures ? "bindless" : "texture arrays");
+		ImGui::Text("Texture arrays: %u (%.2f MB)", (u32)app->textureArrays.arrays.size(), GetTextureArrayPoolBytes(app->textureArrays) / (1024.0 * 1024.0));
+		ImGui::Text("Material texture binds: %u", app->materialTextureBinds);
+
+		TextureStreamer& streamer = app->textureStreamer;
+		i32 budgetMB = (i32)(streamer.budgetBytes / (1024 * 1024));
+		if (ImGui::SliderInt("Streaming budget (MB)", &budgetMB, 16, 2048))
+			streamer.budgetBytes = (u64)budgetMB * 1024 * 1024;
+		ImGui::Text("Streamed: %u textures, %.2f MB, %u loads", (u32)streamer.textures.size(), streamer.residentBytes / (1024.0 * 1024.0), streamer.loadCount);
+		ImGui::Text("Levels streamed: %u, evicted: %u", streamer.streamedLevels, streamer.evictedLevels);
+
+		const GpuUploaderStats uploads = GetGpuUploaderStats();
+		ImGui::Text("Upload thread: %s", IsGpuUploaderRunning() ? "running" : "off");
+		ImGui::Text("Uploaded: %u textures, %u buffers, %.2f MB (%.2f MB unstaged)", uploads.textureCount, uploads.bufferCount, uploads.uploadedBytes / (1024.0 * 1024.0), uploads.clientBytes / (1024.0 * 1024.0));
+		ImGui::Text("Uploads pending: %u, staging waits: %u", uploads.pendingCount, uploads.segmentWaits);
+
+		ImGui::TreePop();
+	}
+	if (ImGui::TreeNode("Geometry memory:"))
+	{
+		GeometryMemoryReport memory = GetGeometryMemoryReport(app);
+		ImGui::Text("GPU buffers: %.2f MB", memory.gpuBytes / (1024.0 * 1024.0));
+		ImGui::Text("CPU resident: %.2f MB", memory.cpuBytes / (1024.0 * 1024.0));
+		ImGui::Text("CPU released: %.2f MB", memory.cpuBytesSaved / (1024.0 * 1024.0));
+		ImGui::Text("Pool vertices: %.2f / %.2f MB", app->geometryPool.vertices.usedBytes / (1024.0 * 1024.0), app->geometryPool.vertices.capacity / (1024.0 * 1024.0));
+		ImGui::Text("Pool indices: %.2f / %.2f MB", app->geometryPool.indices.usedBytes / (1024.0 * 1024.0), app->geometryPool.indices.capacity / (1024.0 * 1024.0));
+		ImGui::Text("Pool clusters: %.2f / %.2f MB", app->geometryPool.clusters.usedBytes / (1024.0 * 1024.0), app->geometryPool.clusters.capacity / (1024.0 * 1024.0));
+		ImGui::Checkbox("CPU meshlet culling stats", &app->meshletCullingStats);
+		if (app->meshletCullingStats)
+			ImGui::Text("Visible meshlets: %u / %u", app->visibleMeshletCount, app->meshletCount);
+		ImGui::Text("Pool VAOs: %u", (u32)app->geometryPool.vaos.size());
+
+		ImGui::TreePop();
+	}
 
 	ImGui::End();
 
@@ -823,6 +1345,9 @@ void Gui(App* app)
 
 			ImGui::DragFloat3("Position", position, 0.1f, -20000000000000000.0f, 200000000000000000000.0f);
 			entity.setPosition(vec3(position[0], position[1], position[2]));
+			ImGui::Text("LOD: %u", entity.lod);
+			ImGui::Text("Bounds: (%.2f, %.2f, %.2f) - (%.2f, %.2f, %.2f)", entity.worldBoundsMin.x, entity.worldBoundsMin.y, entity.worldBoundsMin.z,
+				entity.worldBoundsMax.x, entity.worldBoundsMax.y, entity.worldBoundsMax.z);
 
 			ImGui::PopID();
 		}
@@ -883,11 +1408,93 @@ void Gui(App* app)
 	ImGui::End();
 }
 
+GeometryMemoryReport GetGeometryMemoryReport(App* app)
+{
+	GeometryMemoryReport report = {};
+	for (u32 i = 0; i < app->meshes.size(); ++i)
+	{
+		const Mesh& mesh = app->meshes[i];
+		report.gpuBytes += (u64)mesh.vertexBufferSize + mesh.indexBufferSize + mesh.clusterBufferSize;
+
+		u64 cpuBytes = 0;
+		for (u32 j = 0; j < mesh.submeshes.size(); ++j)
+		{
+			cpuBytes += mesh.submeshes[j].vertices.capacity() + mesh.submeshes[j].indices.capacity();
+		}
+		report.cpuBytes += cpuBytes;
+
+		// Without the release the CPU would hold a copy of everything that was uploaded
+		if (!mesh.keepGeometryResident)
+			report.cpuBytesSaved += (u64)mesh.vertexBufferSize + mesh.indexBufferSize;
+	}
+	return report;
+}
+
+#define LOD_HYSTERESIS 0.1f // How far past a threshold the screen size has to go before the LOD changes
+
+// Screen size (fraction of the viewport height the bounds cover) under which each LOD gives way to the next one
+static const f32 LodScreenSizes[MESH_LOD_MAX_COUNT] = { 0.5f, 0.25f, 0.125f };
+
+// Fraction of the viewport height the world bounds of the entity cover
+static f32 GetEntityScreenSize(const Entity& entity, const mat4& view, f32 fovY)
+{
+	const vec3 center = vec3(view * glm::vec4(entity.worldBoundsCenter, 1.0f));
+	const f32 radius = entity.worldBoundsRadius;
+	const f32 distance = glm::length(center);
+	return distance > radius ? radius / (distance * tanf(0.5f * fovY)) : FLT_MAX;
+}
+
+static void SelectEntityLod(Entity& entity, const mat4& view, f32 fovY)
+{
+	const f32 screenSize = GetEntityScreenSize(entity, view, fovY);
+
+	// A level only changes once the size is clearly past its threshold, so it doesn't flicker around it
+	u32 lod = entity.lod;
+	while (lod < MESH_LOD_MAX_COUNT && screenSize < LodScreenSizes[lod] * (1.0f - LOD_HYSTERESIS))
+		++lod;
+	while (lod > 0 && screenSize > LodScreenSizes[lod - 1] * (1.0f + LOD_HYSTERESIS))
+		--lod;
+	entity.lod = lod;
+}
+
+// Runs the CPU reference cluster culling on what the entity draws, for the stats in the Info window.
+// Only while they are shown: the draws never use its result.
+static void CullEntityMeshlets(App* app, const Entity& entity, const Model& model, const mat4& world, const mat4& viewProjection)
+{
+	if (!app->meshletCullingStats || entity.lod != 0)
+		return;
+
+	const Mesh& mesh = app->meshes[model.meshIdx];
+	const bool hasNodes = !model.draws.empty();
+	const u32 drawCount = hasNodes ? (u32)model.draws.size() : (u32)mesh.submeshes.size();
+
+	for (u32 i = 0; i < drawCount; ++i)
+	{
+		const Submesh& submesh = mesh.submeshes[hasNodes ? model.draws[i].submeshIdx : i];
+		const mat4 drawWorld = hasNodes ? world * model.nodes[model.draws[i].nodeIdx].modelTransform : world;
+		app->meshletCount += (u32)submesh.meshlets.size();
+		app->visibleMeshletScratch.clear();
+		app->visibleMeshletCount += CullSubmeshMeshlets(submesh, drawWorld, viewProjection, app->camera.position, app->visibleMeshletScratch);
+	}
+}
+
 void Update(App* app)
 {
 	// You can handle app->input keyboard/mouse here
 	UpdateInput(app);
 
+	// Finish the asset loads waiting for the main thread, within the frame budget
+	UpdateAsyncLoads();
+	if (app->isLoadingAssets && GetPendingAssetTaskCount() == 0)
+	{
+		app->isLoadingAssets = false;
+
+		GeometryMemoryReport memory = GetGeometryMemoryReport(app);
+		ILOG("All assets loaded");
+		ILOG("Geometry memory: %.2f MB on the GPU, %.2f MB resident on the CPU, %.2f MB released after upload",
+			memory.gpuBytes / (1024.0 * 1024.0), memory.cpuBytes / (1024.0 * 1024.0), memory.cpuBytesSaved / (1024.0 * 1024.0));
+	}
+
 	for (u64 i = 0; i < app->programs.size(); i++)
 	{
 		Program& program = app->programs[i];
@@ -917,6 +1524,10 @@ void Update(App* app)
 	PushVec3(app->cbuffer, app->camera.position);
 	PushUInt(app->cbuffer, app->lights.size());
 
+	AlignHead(app->cbuffer, sizeof(vec4));
+	for (u32 i = 0; i < SH_COEFFICIENT_COUNT; ++i)
+		PushVec4(app->cbuffer, app->irradianceSH.coefficients[i]);
+
 	for (u32 i = 0; i < app->lights.size(); ++i)
 	{
 		AlignHead(app->cbuffer, sizeof(vec4));
@@ -932,6 +1543,8 @@ void Update(App* app)
 	app->globalParamsSize = app->cbuffer.head - app->globalParamsOffset;
 
 	// Entities
+	app->meshletCount = 0;
+	app->visibleMeshletCount = 0;
 	for (u64 i = 0; i < app->entities.size(); ++i)
 	{
 		AlignHead(app->cbuffer, app->uniformBufferAlignment);
@@ -940,15 +1553,49 @@ void Update(App* app)
 		mat4 world = entity.worldMatrix;
 
 		world = TransformPositionScale(entity.getPosition(), entity.getScale());
+		entity.worldMatrix = world;
 		mat4 worldViewProjection = projection * view * world;
 
 		entity.localParamsOffset = app->cbuffer.head;
 		PushMat4(app->cbuffer, world);
 		PushMat4(app->cbuffer, worldViewProjection);
 		entity.localParamsSize = app->cbuffer.head - entity.localParamsOffset;
+
+		const Model& model = app->models[entity.modelIndex];
+		UpdateEntityWorldBounds(entity, model);
+		SelectEntityLod(entity, view, glm::radians(app->camera.zoom));
+		CullEntityMeshlets(app, entity, model, world, projection * view);
+
+		// The material textures need about one texel per pixel the entity covers
+		const f32 screenSize = GetEntityScreenSize(entity, view, glm::radians(app->camera.zoom));
+		RequestModelTextureLevels(app, model, glm::min(screenSize, 1.0f) * app->displaySize.y);
+
+		// Models with a node tree get one block per draw, with the node transform on top of the entity
+		entity.drawParamsOffset = UINT32_MAX;
+		entity.drawParamsStride = Align(entity.localParamsSize, app->uniformBufferAlignment);
+		if (model.draws.empty())
+			continue;
+
+		AlignHead(app->cbuffer, app->uniformBufferAlignment);
+		if (app->cbuffer.head + (u32)model.draws.size() * entity.drawParamsStride > app->cbuffer.size)
+		{
+			ELOG("Not enough room in the uniform buffer for the %u draws of entity %u", (u32)model.draws.size(), (u32)i);
+			continue;
+		}
+
+		entity.drawParamsOffset = app->cbuffer.head;
+		for (u32 j = 0; j < model.draws.size(); ++j)
+		{
+			AlignHead(app->cbuffer, app->uniformBufferAlignment);
+			mat4 drawWorld = world * model.nodes[model.draws[j].nodeIdx].modelTransform;
+			PushMat4(app->cbuffer, drawWorld);
+			PushMat4(app->cbuffer, projection * view * drawWorld);
+		}
 	}
 
 	UnmapBuffer(app->cbuffer);
+
+	UpdateTextureStreamer(app);
 }
 
 void UpdateInput(App* app)
@@ -987,6 +1634,24 @@ void UpdateInput(App* app)
 
 }
 
+// Bindless handles of the maps of every material, in the order of MaterialTextureSlot
+static std::vector<MaterialTableEntry> BuildMaterialTableEntries(App* app)
+{
+	std::vector<MaterialTableEntry> entries(app->materials.size());
+	for (u32 i = 0; i < app->materials.size(); ++i)
+	{
+		const Material& material = app->materials[i];
+		const u32 textureIndices[MaterialTexture_Count] = { material.albedoTextureIdx, material.ormTextureIdx, material.normalsTextureIdx };
+		for (u32 slot = 0; slot < MaterialTexture_Count; ++slot)
+			entries[i].maps[slot] = textureIndices[slot] < app->textures.size() ? app->textures[textureIndices[slot]].bindlessHandle : 0;
+	}
+	return entries;
+}
+
+// Texture unit and sampler uniform of every material slot, the IBL maps take units 0 to 2
+static const u32 materialTextureUnits[MaterialTexture_Count] = { 3, 5, 4 };
+static const char* materialTextureUniforms[MaterialTexture_Count] = { "albedoMap", "ormMap", "normalMap" };
+
 void Render(App* app)
 {
 	GLenum err;
@@ -1003,7 +1668,7 @@ void Render(App* app)
 	Program modelProgram = app->programs[app->deferredGeometryProgramIdx];
 	if (app->currentRenderMode == RenderMode::FORWARD)
 	{
-		modelProgram = app->programs[app->directPBRIBLProgramIdx];
+		modelProgram = app->programs[app->bindlessTextures ? app->directPBRIBLBindlessProgramIdx : app->directPBRIBLProgramIdx];
 		glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 1, -1, "Direct PBR Shaded Model");
 	}
 	else
@@ -1036,30 +1701,51 @@ void Render(App* app)
 	if ((err = glGetError()) != GL_NO_ERROR)
 		ELOG("Error getting uniform: %d\n", err);
 
-	// IBL
-	GLint irradMapLocation = glGetUniformLocation(modelProgram.handle, "irradianceMap");
+	// IBL, the diffuse part comes from the spherical harmonics in the global params
 	GLint prefilterMapLocation = glGetUniformLocation(modelProgram.handle, "prefilterMap");
 	GLint brdfLUTLocation = glGetUniformLocation(modelProgram.handle, "brdfLUT");
 
 	// Bind the textures to texture units
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, app->irradianceMap);
 	glActiveTexture(GL_TEXTURE1);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, app->prefilterMap);
 	glActiveTexture(GL_TEXTURE2);
 	glBindTexture(GL_TEXTURE_2D, app->brdfLUTTexture);
 
 	// Set the uniform values
-	glUniform1i(irradMapLocation, 0);     // irradianceMap uses texture unit 0
 	glUniform1i(prefilterMapLocation, 1); // prefilterMap uses texture unit 1
 	glUniform1i(brdfLUTLocation, 2);      // brdfLUT uses texture unit 2
 
+	// Material maps: bindless handles come from the material table, RenderModel only sets the index
+	if (app->bindlessTextures)
+		UpdateMaterialTable(app->materialTable, BuildMaterialTableEntries(app));
+
+	// Otherwise the units and samplers are set once, RenderModel only binds the arrays that change
+	for (u32 slot = 0; slot < MaterialTexture_Count; ++slot)
+	{
+		glUniform1i(glGetUniformLocation(modelProgram.handle, materialTextureUniforms[slot]), materialTextureUnits[slot]);
+		glBindSampler(materialTextureUnits[slot], app->textureArrays.samplers[SamplerObject_TrilinearClamp]);
+		app->boundMaterialArrays[slot] = 0;
+	}
+	if ((err = glGetError()) != GL_NO_ERROR)
+		ELOG("Error setting material samplers: %d\n", err);
+	app->materialTextureBinds = 0;
+
 	for (u64 i = 0; i < app->entities.size(); ++i)
 	{
 		Entity& entity = app->entities[i];
 		RenderModel(app, entity, modelProgram);
 	}
 
+	for (u32 slot = 0; slot < MaterialTexture_Count; ++slot)
+	{
+		glActiveTexture(GL_TEXTURE0 + materialTextureUnits[slot]);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		glBindSampler(materialTextureUnits[slot], 0);
+	}
+	glActiveTexture(GL_TEXTURE0);
+	if ((err = glGetError()) != GL_NO_ERROR)
+		ELOG("Error unbinding material textures: %d\n", err);
+
 	glPopDebugGroup();
 	if ((err = glGetError()) != GL_NO_ERROR)
 		ELOG("Error popping debug group: %d\n", err);
@@ -1099,6 +1785,49 @@ void Render(App* app)
 		ELOG("Error popping debug group: %d\n", err);
 }
 
+// Binds the array of every slot whose array changed since the previous material, and passes the layers
+static void BindMaterialTextures(App* app, const Material& material, const Program& program)
+{
+	GLenum err;
+
+	const u32 textureIndices[MaterialTexture_Count] = { material.albedoTextureIdx, material.ormTextureIdx, material.normalsTextureIdx };
+	GLint layers[MaterialTexture_Count] = {};
+	for (u32 slot = 0; slot < MaterialTexture_Count; ++slot)
+	{
+		if (textureIndices[slot] >= app->textures.size())
+			continue;
+
+		// Streamed textures are arrays of their own, with one layer
+		const Texture& tex = app->textures[textureIndices[slot]];
+		GLuint arrayHandle = 0;
+		GLint layer = 0;
+		if (tex.layer.arrayIdx < app->textureArrays.arrays.size())
+		{
+			arrayHandle = app->textureArrays.arrays[tex.layer.arrayIdx].handle;
+			layer = (GLint)tex.layer.layer;
+		}
+		else if (tex.streamIdx != UINT32_MAX)
+		{
+			arrayHandle = tex.handle;
+		}
+		if (arrayHandle == 0)
+			continue;
+
+		if (arrayHandle != app->boundMaterialArrays[slot])
+		{
+			glActiveTexture(GL_TEXTURE0 + materialTextureUnits[slot]);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, arrayHandle);
+			app->boundMaterialArrays[slot] = arrayHandle;
+			app->materialTextureBinds++;
+		}
+		layers[slot] = layer;
+	}
+
+	glUniform1iv(glGetUniformLocation(program.handle, "uMaterialLayers"), MaterialTexture_Count, layers);
+	if ((err = glGetError()) != GL_NO_ERROR)
+		ELOG("Error setting material textures: %d\n", err);
+}
+
 void RenderModel(App* app, Entity entity, Program program)
 {
 	GLenum err;
@@ -1112,72 +1841,59 @@ void RenderModel(App* app, Entity entity, Program program)
 		ELOG("Error binding buffer range: %d\n", err);
 	}
 
-	for (u32 j = 0; j < mesh.submeshes.size(); ++j)
-	{
-		GLuint vao = FindVAO(mesh, j, program);
-		glBindVertexArray(vao);
-		if ((err = glGetError()) != GL_NO_ERROR) { ELOG("Error binding vertex array: %d\n", err); }
-
-		u32 submeshMaterialIdx = model.materialIdx[j];
-		Material& submeshMaterial = app->materials[submeshMaterialIdx];
+	// Flat models draw every submesh once, models with a node tree draw the submesh of every node
+	const bool hasNodes = !model.draws.empty();
+	const u32 drawCount = hasNodes ? (u32)model.draws.size() : (u32)mesh.submeshes.size();
 
-		if (submeshMaterial.albedoTextureIdx < app->textures.size())
+	GLuint boundVao = 0;
+	u32 boundMaterialIdx = UINT32_MAX;
+	for (u32 drawIdx = 0; drawIdx < drawCount; ++drawIdx)
+	{
+		const u32 j = hasNodes ? model.draws[drawIdx].submeshIdx : drawIdx;
+		if (hasNodes && entity.drawParamsOffset != UINT32_MAX)
 		{
-			glActiveTexture(GL_TEXTURE3);
-			if ((err = glGetError()) != GL_NO_ERROR)
-				ELOG("Error setting textures: %d\n", err);
-			glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.albedoTextureIdx].handle);
-			if ((err = glGetError()) != GL_NO_ERROR)
-				ELOG("Error setting textures: %d\n", err);
-			GLuint textureLocation = glGetUniformLocation(program.handle, "albedoMap");
-			if ((err = glGetError()) != GL_NO_ERROR)
-				ELOG("Error setting textures: %d\n", err);
-			glUniform1i(textureLocation, 3);
-			if ((err = glGetError()) != GL_NO_ERROR)
-				ELOG("Error setting textures: %d\n", err);
-		}
-
-		if (submeshMaterial.normalsTextureIdx < app->textures.size()) {
-			glActiveTexture(GL_TEXTURE4);
-			glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.normalsTextureIdx].handle);
-			GLuint textureLocation = glGetUniformLocation(program.handle, "normalMap");
-			glUniform1i(textureLocation, 4);
+			glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->cbuffer.handle, entity.drawParamsOffset + drawIdx * entity.drawParamsStride, entity.localParamsSize);
 			if ((err = glGetError()) != GL_NO_ERROR)
-				ELOG("Error setting textures: %d\n", err);
+				ELOG("Error binding buffer range: %d\n", err);
 		}
 
-		if (submeshMaterial.metallicTextureIdx < app->textures.size()) {
-			glActiveTexture(GL_TEXTURE5);
-			glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.metallicTextureIdx].handle);
-			GLuint textureLocation = glGetUniformLocation(program.handle, "metallicMap");
-			glUniform1i(textureLocation, 5);
-			if ((err = glGetError()) != GL_NO_ERROR)
-				ELOG("Error setting textures: %d\n", err);
-		}
-
-		if (submeshMaterial.roughnessTextureIdx < app->textures.size()) {
-			glActiveTexture(GL_TEXTURE6);
-			glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.roughnessTextureIdx].handle);
-			GLuint textureLocation = glGetUniformLocation(program.handle, "roughnessMap");
-			glUniform1i(textureLocation, 6);
-			if ((err = glGetError()) != GL_NO_ERROR)
-				ELOG("Error setting textures: %d\n", err);
+		// Submeshes with the same vertex layout share the VAO, so it only changes with the layout
+		GLuint vao = FindVAO(app->geometryPool, mesh.submeshes[j], program);
+		if (vao != boundVao)
+		{
+			glBindVertexArray(vao);
+			boundVao = vao;
 		}
+		if ((err = glGetError()) != GL_NO_ERROR) { ELOG("Error binding vertex array: %d\n", err); }
 
-		if (submeshMaterial.aoTextureIdx < app->textures.size()) {
-			glActiveTexture(GL_TEXTURE7);
-			glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.aoTextureIdx].handle);
-			GLuint textureLocation = glGetUniformLocation(program.handle, "aoMap");
-			glUniform1i(textureLocation, 7);
-			if ((err = glGetError()) != GL_NO_ERROR)
-				ELOG("Error setting textures: %d\n", err);
+		// Consecutive submeshes of the same material keep its layers (or its table entry)
+		const u32 submeshMaterialIdx = model.materialIdx[j];
+		if (submeshMaterialIdx != boundMaterialIdx)
+		{
+			if (app->bindlessTextures)
+				glUniform1ui(glGetUniformLocation(program.handle, "uMaterialIndex"), submeshMaterialIdx);
+			else
+				BindMaterialTextures(app, app->materials[submeshMaterialIdx], program);
+			boundMaterialIdx = submeshMaterialIdx;
 		}
 
 		if ((err = glGetError()) != GL_NO_ERROR)
 			ELOG("Error drawing elements: %d\n", err);
 
+		// Tell the shader how to decode this submesh vertex stream
 		Submesh& submesh = mesh.submeshes[j];
-		glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
+		glUniform1i(glGetUniformLocation(program.handle, "uVertexFormat"), submesh.vertexFormat);
+		glUniform3fv(glGetUniformLocation(program.handle, "uPositionScale"), 1, &submesh.positionScale[0]);
+		glUniform3fv(glGetUniformLocation(program.handle, "uPositionOffset"), 1, &submesh.positionOffset[0]);
+		if ((err = glGetError()) != GL_NO_ERROR)
+			ELOG("Error setting vertex format uniforms: %d\n", err);
+
+		// Submeshes with a shorter chain draw their coarsest level
+		const u32 lod = glm::min(entity.lod, (u32)submesh.lods.size());
+		const u32 firstIndex = lod > 0 ? submesh.lods[lod - 1].firstIndex : 0;
+		const u32 indexCount = lod > 0 ? submesh.lods[lod - 1].indexCount : submesh.indexCount;
+		const u64 indexOffset = submesh.indexOffset + (u64)firstIndex * GetIndexSize(submesh.indexType);
+		glDrawElementsBaseVertex(GL_TRIANGLES, indexCount, submesh.indexType, (void*)indexOffset, submesh.baseVertex);
 		if ((err = glGetError()) != GL_NO_ERROR) {
 			ELOG("Error drawing elements: %d\n", err);
 		}
@@ -1193,14 +1909,6 @@ void RenderModel(App* app, Entity entity, Program program)
 	if ((err = glGetError()) != GL_NO_ERROR) {
 		ELOG("Error unbinding vertex array: %d\n", err);
 	}
-
-	for (int i = 0; i < 5; ++i) {
-		glActiveTexture(GL_TEXTURE3 + i);
-		glBindTexture(GL_TEXTURE_2D, 0);
-		if ((err = glGetError()) != GL_NO_ERROR) {
-			ELOG("Error unbinding texture at index %d: %d\n", i, err);
-		}
-	}
 }
 
 void RenderLight(App* app, Light light, Program program)
@@ -1213,14 +1921,14 @@ void RenderLight(App* app, Light light, Program program)
 
 	for (u32 j = 0; j < mesh.submeshes.size(); ++j)
 	{
-		GLuint vao = FindVAO(mesh, j, program);
+		GLuint vao = FindVAO(app->geometryPool, mesh.submeshes[j], program);
 		glBindVertexArray(vao);
 
 		GLuint lightColorLocation = glGetUniformLocation(program.handle, "uLightColor");
 		glUniform3f(lightColorLocation, light.color.r, light.color.g, light.color.b);
 
 		Submesh& submesh = mesh.submeshes[j];
-		glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
+		glDrawElementsBaseVertex(GL_TRIANGLES, submesh.indexCount, submesh.indexType, (void*)(u64)submesh.indexOffset, submesh.baseVertex);
 	}
 
 	glUnmapBuffer(GL_UNIFORM_BUFFER);
@@ -1267,27 +1975,44 @@ void OnGlError(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei l
 	}
 }
 
-GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
+static bool IsSameVertexLayout(const VertexBufferLayout& a, const VertexBufferLayout& b)
 {
-	Submesh& submesh = mesh.submeshes[submeshIndex];
+	if (a.stride != b.stride || a.attributes.size() != b.attributes.size())
+		return false;
+
+	for (u32 i = 0; i < a.attributes.size(); ++i)
+	{
+		const VertexBufferAttribute& attributeA = a.attributes[i];
+		const VertexBufferAttribute& attributeB = b.attributes[i];
+		if (attributeA.location != attributeB.location ||
+			attributeA.componentCount != attributeB.componentCount ||
+			attributeA.offset != attributeB.offset ||
+			attributeA.type != attributeB.type ||
+			attributeA.normalized != attributeB.normalized)
+			return false;
+	}
+	return true;
+}
 
-	//Try finding a vao for this submesh/program
-	for (u32 i = 0; i < (u32)submesh.vaos.size(); ++i)
+GLuint FindVAO(GeometryPool& pool, const Submesh& submesh, const Program& program)
+{
+	//Try finding a vao for this vertex layout/program
+	for (u32 i = 0; i < (u32)pool.vaos.size(); ++i)
 	{
-		if (submesh.vaos[i].programHandle == program.handle)
+		if (pool.vaos[i].programHandle == program.handle && IsSameVertexLayout(pool.vaos[i].layout, submesh.vertexBufferLayout))
 		{
-			return submesh.vaos[i].handle;
+			return pool.vaos[i].handle;
 		}
 	}
 
 	GLuint vaoHandle = 0;
 
-	//Create a new vao for this submesh/program
+	//Create a new vao for this vertex layout/program
 	glGenVertexArrays(1, &vaoHandle);
 	glBindVertexArray(vaoHandle);
 
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
+	glBindBuffer(GL_ARRAY_BUFFER, pool.vertices.handle);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.indices.handle);
 
 	for (u32 i = 0; i < program.vertexInputLayout.attributes.size(); ++i)
 	{
@@ -1297,11 +2022,14 @@ GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
 		{
 			if (program.vertexInputLayout.attributes[i].location == submesh.vertexBufferLayout.attributes[j].location)
 			{
+				// The vertex offset of each submesh comes from the base vertex of its draw
 				const u32 index = submesh.vertexBufferLayout.attributes[j].location;
 				const u32 ncomp = submesh.vertexBufferLayout.attributes[j].componentCount;
-				const u32 offset = submesh.vertexBufferLayout.attributes[j].offset + submesh.vertexOffset;  //attribute offset + vertex offset
+				const u32 offset = submesh.vertexBufferLayout.attributes[j].offset;
 				const u32 stride = submesh.vertexBufferLayout.stride;
-				glVertexAttribPointer(index, ncomp, GL_FLOAT, GL_FALSE, stride, (void*)(u64)offset);
+				const GLenum type = submesh.vertexBufferLayout.attributes[j].type;
+				const GLboolean normalized = submesh.vertexBufferLayout.attributes[j].normalized ? GL_TRUE : GL_FALSE;
+				glVertexAttribPointer(index, ncomp, type, normalized, stride, (void*)(u64)offset);
 				glEnableVertexAttribArray(index);
 
 				attributeWasLinked = true;
@@ -1312,8 +2040,8 @@ GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
 
 	glBindVertexArray(0);
 
-	Vao vao = { vaoHandle, program.handle };
-	submesh.vaos.push_back(vao);
+	Vao vao = { vaoHandle, program.handle, submesh.vertexBufferLayout };
+	pool.vaos.push_back(vao);
 
 	return vaoHandle;
 }
@@ -6,8 +6,18 @@
 
 #include "platform.h"
 #include "geometry.h"
+#include "geometry_pool.h"
+#include "asset_loader.h"
 #include "camera.h"
 #include "buffer.h"
+#include "texture_cooker.h"
+#include "texture_array.h"
+#include "material_table.h"
+#include "texture_streamer.h"
+#include "mesh_cache.h"
+#include "spherical_harmonics.h"
+
+#include <unordered_map>
 
 #ifdef _DEBUG
 #include <glad/glad.h>
@@ -55,9 +65,15 @@ struct Image
 
 struct Texture
 {
-	GLuint      handle;
+	GLuint      handle;    // 0 for the textures in a texture array layer
+	TextureLayer layer;    // Material textures, see texture_array.h
+	GLuint64    bindlessHandle; // Resident handle of the material textures with bindless textures, 0 otherwise
+	u32         streamIdx = UINT32_MAX; // Into App::textureStreamer for the textures whose mips are streamed
 	std::string filepath;
+	std::string cacheKey;  // Into App::textureCache: the path, usage and row order it was loaded with
 	ivec2		size;
+	u32         refCount;  // Loads that returned this texture and have not released it
+	u64         byteSize;  // GPU memory, mip chain included
 };
 
 struct Program
@@ -92,6 +108,13 @@ enum Mode
 	Mode_Count
 };
 
+struct GeometryMemoryReport
+{
+	u64 gpuBytes;      // Vertex, index and cluster buffers
+	u64 cpuBytes;      // CPU copies kept resident
+	u64 cpuBytesSaved; // CPU copies released after the upload
+};
+
 struct App
 {
 	// Loop
@@ -113,12 +136,18 @@ struct App
 
 	u32 directionalLightModel;
 	u32 sphereModel;
+	u32 placeholderModelIdx; // Drawn by the entities whose model is still loading
+	bool isLoadingAssets;
+	bool meshletCullingStats = false; // Runs CullSubmeshMeshlets on the CPU for the counts below, nothing draws its result
+	u32 meshletCount;        // Meshlets of the drawn LOD 0 submeshes this frame
+	u32 visibleMeshletCount; // Of those, the ones CullSubmeshMeshlets keeps
+	std::vector<u32> visibleMeshletScratch; // Reused by every CullSubmeshMeshlets call
 
 	u32 directPBRIBLProgramIdx;
+	u32 directPBRIBLBindlessProgramIdx; // UINT32_MAX without bindless textures
 	u32 deferredGeometryProgramIdx;
 	u32 skyboxProgramIdx;
 	u32 equirectangularToCubemapProgramIdx;
-	u32 irradianceConvolutionProgramIdx;
 	u32 prefilterProgramIdx;
 	u32 brdfProgramIdx;
 
@@ -127,6 +156,15 @@ struct App
 	u32 blackTexIdx;
 	u32 defaultNormalTexIdx;
 
+	// Material textures and the samplers they are read with. With bindless textures the
+	// material table holds their handles, texture arrays are the fallback.
+	bool bindlessTextures;
+	MaterialTable materialTable;
+	TextureArrayPool textureArrays;
+	TextureStreamer textureStreamer;
+	GLuint boundMaterialArrays[MaterialTexture_Count]; // Array bound to the unit of every slot this frame
+	u32 materialTextureBinds;                          // Array binds RenderModel issued this frame
+
 	// Mode
 	Mode mode;
 
@@ -150,6 +188,9 @@ struct App
 
 	// Lists
 	std::vector<Texture>  textures;
+	std::unordered_map<std::string, u32> textureCache; // Normalized file path, usage and row order -> texture index
+	u32 textureCacheHits;
+	u64 textureCacheBytesSaved;
 	std::vector<Material> materials;
 	std::vector<Mesh>	  meshes;
 	std::vector<Model>	  models;
@@ -158,13 +199,16 @@ struct App
 
 	std::vector<Entity> entities;
 
+	// Vertex and index data of every mesh
+	GeometryPool geometryPool;
+
 	unsigned int cubeVAO = 0;
 	unsigned int cubeVBO = 0;
 
 	unsigned int quadVAO = 0;
 	unsigned int quadVBO;
 
-	unsigned int irradianceMap;
+	SHIrradiance irradianceSH; // Diffuse lighting of the environment, in the global params
 	unsigned int prefilterMap;
 	unsigned int brdfLUTTexture;
 	unsigned int envCubemap;
@@ -174,12 +218,13 @@ struct App
 void Init(App* app);
 void InitEntities(App* app);
 void InitLight(App* app);
-unsigned int InitSkybox(App* app, std::string filename, unsigned int& captureFBO, unsigned int& captureRBO, unsigned int& envCubemap, unsigned int& irradianceMap, unsigned int& prefilterMap, unsigned int& brdfLUTTexture);
 void InitPrograms(App* app);
 void InitGuiStyle();
 
 void Gui(App* app);
 
+GeometryMemoryReport GetGeometryMemoryReport(App* app);
+
 void Update(App* app);
 void UpdateInput(App* app);
 
@@ -189,13 +234,36 @@ void RenderLight(App* app, Light light, Program program);
 
 void OnGlError(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam);
 
-GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program);
+GLuint FindVAO(GeometryPool& pool, const Submesh& submesh, const Program& program);
 
 void OnResize(App* app);
 void GenerateColorTexture(GLuint& colorAttachmentHandle, vec2 displaySize, GLint internalFormat);
 
 GLuint CreateTexture2DFromImage(Image image);
-u32 LoadTexture2D(App* app, std::string filepath, unsigned int* width = nullptr, unsigned int* height = nullptr);
+
+/**
+ * Uploads every level of a cooked texture with glCompressedTexImage2D.
+ */
+GLuint CreateTexture2DFromCooked(const CookedTexture& texture);
+
+/**
+ * Loads the texture, or takes another reference to it if it is already loaded for the same usage. Any usage but
+ * TextureUsage_Raw loads the cooked version of the file, cooking it first if it is missing or
+ * older than the source.
+ */
+u32 LoadTexture2D(App* app, std::string filepath, TextureUsage usage = TextureUsage_Raw, unsigned int* width = nullptr, unsigned int* height = nullptr);
+
+/**
+ * Reads (or decodes and cooks) the image on a worker thread and creates the texture on the
+ * main thread. Resolves to the texture index, or UINT32_MAX if the image could not be read.
+ */
+AssetTask<u32> LoadTexture2DAsync(App* app, std::string filepath, TextureUsage usage = TextureUsage_Raw);
+
+/**
+ * Drops one reference to the texture. The GL texture is deleted with the last one, and the
+ * slot in app->textures is left empty so the other texture indices stay valid.
+ */
+void ReleaseTexture(App* app, u32 textureIdx);
 
 mat4 TransformScale(const vec3& scaleFactors);
 mat4 TransformPositionScale(const vec3& pos, const vec3& scaleFactors);
@@ -36,9 +36,11 @@ const u16 indices[] = {
 
 struct VertexBufferAttribute
 {
-	u8 location;
-	u8 componentCount;
-	u8 offset;
+	u8     location;
+	u8     componentCount;
+	u8     offset;
+	GLenum type = GL_FLOAT;    // Component type in the buffer (GL_FLOAT, GL_HALF_FLOAT, GL_SHORT...)
+	bool   normalized = false; // Integer components are mapped to [0, 1] or [-1, 1]
 };
 
 struct VertexShaderAtrribute
@@ -60,28 +62,140 @@ struct Vao
 {
 	GLuint handle;
 	GLuint programHandle;
+	VertexBufferLayout layout;
 };
 
 
 /* GEOMETRY */
+enum VertexFormat
+{
+	VertexFormat_Float,   // 32-bit float attributes
+	VertexFormat_Compact, // Octahedral normals, packed tangent frame, half-float UVs (see ProcessAssimpMesh)
+};
+
+struct SubmeshLod
+{
+	u32 firstIndex; // Into the submesh indices, right after the finer levels
+	u32 indexCount;
+	f32 error;      // Largest distance from the original surface, in model units (estimated from the quadrics)
+};
+
+// std430 layout, see PackSubmeshClusters
+struct Meshlet
+{
+	vec3 center;         // Bounding sphere in model units
+	f32  radius;
+	vec3 coneAxis;       // Average facing of the triangles
+	f32  coneCutoff;     // The meshlet faces away from viewers with dot(normalize(coneApex - viewer), coneAxis) >= coneCutoff
+	vec3 coneApex;
+	f32  padding;
+	u32  vertexOffset;   // Into Submesh::meshletVertices
+	u32  triangleOffset; // Into Submesh::meshletTriangles, in bytes
+	u32  vertexCount;
+	u32  triangleCount;
+};
+
 struct Submesh
 {
 	VertexBufferLayout vertexBufferLayout;
-	std::vector<float> vertices;
-	std::vector<u32> indices;
-	u32 vertexOffset;
-	u32 indexOffset;
-
-	std::vector<Vao> vaos;
+	u32 vertexFormat;
+	vec3 positionScale;  // Dequantization of the positions: position = stored * scale + offset
+	vec3 positionOffset;
+	std::vector<u8> vertices; // Interleaved stream, laid out as vertexBufferLayout says. Empty once uploaded unless the mesh keeps its geometry resident
+	std::vector<u8> indices;  // indexCount indices of indexType. Empty once uploaded unless the mesh keeps its geometry resident
+	u32 vertexCount;
+	u32 indexCount;
+	GLenum indexType;         // GL_UNSIGNED_SHORT if every vertex can be addressed with 16 bits, GL_UNSIGNED_INT otherwise
+	u32 vertexOffset;         // In bytes into the geometry pool, aligned to the stride
+	u32 baseVertex;           // vertexOffset / stride, added to every index when drawing
+	u32 indexOffset;          // In bytes into the geometry pool, aligned to the index size
+	std::vector<SubmeshLod> lods; // LOD 1 and coarser. indexCount above is LOD 0, the full detail list
+	vec3 boundsMin;           // Bounding box in model units
+	vec3 boundsMax;
+	vec3 boundsCenter;        // Bounding sphere in model units
+	f32 boundsRadius;
+	std::vector<Meshlet> meshlets; // Clusters of LOD 0, kept on the CPU for culling
+	std::vector<u32> meshletVertices; // Empty once uploaded unless the mesh keeps its geometry resident
+	std::vector<u8> meshletTriangles; // Likewise
+	u32 clusterOffset;        // In bytes into the geometry pool cluster buffer
+	u32 clusterSize;
 };
 
+inline u32 GetIndexSize(GLenum indexType)
+{
+	return indexType == GL_UNSIGNED_SHORT ? sizeof(u16) : sizeof(u32);
+}
+
+// Indices of every LOD, as stored in the geometry pool
+inline u32 GetSubmeshIndexCount(const Submesh& submesh)
+{
+	u32 indexCount = submesh.indexCount;
+	for (u32 i = 0; i < submesh.lods.size(); ++i)
+		indexCount += submesh.lods[i].indexCount;
+	return indexCount;
+}
+
 struct Mesh
 {
 	std::vector<Submesh> submeshes;
-	GLuint vertexBufferHandle;
-	GLuint indexBufferHandle;
+	u32 vertexBufferSize;      // Bytes taken from the geometry pool
+	u32 indexBufferSize;
+	u32 clusterBufferSize;
+	bool keepGeometryResident; // Keep the CPU copy of the submesh streams (picking, collision...)
+	vec3 boundsMin;            // Union of the submesh bounds, see UpdateMeshBounds
+	vec3 boundsMax;
+	vec3 boundsCenter;
+	f32 boundsRadius;
 };
 
+// Grows the sphere (center, radius) to hold the other one. The first sphere merged into an empty one replaces it
+inline void MergeBoundingSphere(vec3& center, f32& radius, bool empty, vec3 otherCenter, f32 otherRadius)
+{
+	const vec3 offset = otherCenter - center;
+	const f32 distance = glm::length(offset);
+	if (empty || distance + radius <= otherRadius)
+	{
+		center = otherCenter;
+		radius = otherRadius;
+	}
+	else if (distance + otherRadius > radius)
+	{
+		const f32 newRadius = 0.5f * (distance + otherRadius + radius);
+		center += offset * ((newRadius - radius) / distance);
+		radius = newRadius;
+	}
+}
+
+// Box holding the transformed box: the center moves with the transform, the extent with its absolute value
+inline void TransformBoundingBox(const mat4& transform, vec3 boundsMin, vec3 boundsMax, vec3& resultMin, vec3& resultMax)
+{
+	const vec3 center = vec3(transform * glm::vec4(0.5f * (boundsMin + boundsMax), 1.0f));
+	const vec3 extent = 0.5f * (boundsMax - boundsMin);
+	const vec3 resultExtent = glm::abs(vec3(transform[0])) * extent.x + glm::abs(vec3(transform[1])) * extent.y + glm::abs(vec3(transform[2])) * extent.z;
+	resultMin = center - resultExtent;
+	resultMax = center + resultExtent;
+}
+
+inline f32 GetMaxScale(const mat4& transform)
+{
+	return glm::max(glm::length(vec3(transform[0])), glm::max(glm::length(vec3(transform[1])), glm::length(vec3(transform[2]))));
+}
+
+inline void UpdateMeshBounds(Mesh& mesh)
+{
+	mesh.boundsMin = vec3(0.0f);
+	mesh.boundsMax = vec3(0.0f);
+	mesh.boundsCenter = vec3(0.0f);
+	mesh.boundsRadius = 0.0f;
+	for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+	{
+		const Submesh& submesh = mesh.submeshes[i];
+		mesh.boundsMin = i == 0 ? submesh.boundsMin : glm::min(mesh.boundsMin, submesh.boundsMin);
+		mesh.boundsMax = i == 0 ? submesh.boundsMax : glm::max(mesh.boundsMax, submesh.boundsMax);
+		MergeBoundingSphere(mesh.boundsCenter, mesh.boundsRadius, i == 0, submesh.boundsCenter, submesh.boundsRadius);
+	}
+}
+
 
 struct Material
 {
@@ -91,17 +205,74 @@ struct Material
 	f32 smoothness = 1.0f;
 	u32 albedoTextureIdx;
 	u32 normalsTextureIdx;
-	u32 metallicTextureIdx;
-	u32 roughnessTextureIdx;
-	u32 aoTextureIdx;
+	u32 ormTextureIdx; // Occlusion, roughness and metallic in red, green and blue
 };
 
 
+struct ModelNode
+{
+	mat4 localTransform;  // Relative to the parent node
+	mat4 modelTransform;  // Relative to the model root, see UpdateModelNodeTransforms
+	u32  parent;          // UINT32_MAX for the root. Parents always come before their children
+};
+
+struct ModelDraw
+{
+	u32 submeshIdx;
+	u32 nodeIdx;
+};
+
 struct Model {
 	u32 meshIdx;
 	std::vector<u32> materialIdx;
+	std::vector<ModelNode> nodes; // Empty when the vertices were pretransformed into one flat mesh
+	std::vector<ModelDraw> draws; // One per mesh reference in the node tree, submeshes are shared between nodes
+	vec3 boundsMin;               // Bounding box of every draw, in model space. See UpdateModelBounds
+	vec3 boundsMax;
+	vec3 boundsCenter;            // Bounding sphere of every draw, in model space
+	f32 boundsRadius;
 };
 
+inline void UpdateModelNodeTransforms(Model& model)
+{
+	for (u32 i = 0; i < model.nodes.size(); ++i)
+	{
+		ModelNode& node = model.nodes[i];
+		node.modelTransform = node.parent == UINT32_MAX ? node.localTransform : model.nodes[node.parent].modelTransform * node.localTransform;
+	}
+}
+
+// Union of the submesh bounds, moved by their node when the model has a node tree. Flat models share the mesh bounds
+inline void UpdateModelBounds(Model& model, const Mesh& mesh)
+{
+	if (model.draws.empty())
+	{
+		model.boundsMin = mesh.boundsMin;
+		model.boundsMax = mesh.boundsMax;
+		model.boundsCenter = mesh.boundsCenter;
+		model.boundsRadius = mesh.boundsRadius;
+		return;
+	}
+
+	model.boundsMin = vec3(0.0f);
+	model.boundsMax = vec3(0.0f);
+	model.boundsCenter = vec3(0.0f);
+	model.boundsRadius = 0.0f;
+	for (u32 i = 0; i < model.draws.size(); ++i)
+	{
+		const Submesh& submesh = mesh.submeshes[model.draws[i].submeshIdx];
+		const mat4& transform = model.nodes[model.draws[i].nodeIdx].modelTransform;
+
+		vec3 drawMin, drawMax;
+		TransformBoundingBox(transform, submesh.boundsMin, submesh.boundsMax, drawMin, drawMax);
+		model.boundsMin = i == 0 ? drawMin : glm::min(model.boundsMin, drawMin);
+		model.boundsMax = i == 0 ? drawMax : glm::max(model.boundsMax, drawMax);
+
+		const vec3 center = vec3(transform * glm::vec4(submesh.boundsCenter, 1.0f));
+		MergeBoundingSphere(model.boundsCenter, model.boundsRadius, i == 0, center, submesh.boundsRadius * GetMaxScale(transform));
+	}
+}
+
 struct Entity
 {
 	String name;
@@ -113,6 +284,17 @@ struct Entity
 	u32 modelIndex;
 	u32 localParamsOffset;
 	u32 localParamsSize;
+	u32 drawParamsOffset; // Local params of the first draw of a model with nodes, UINT32_MAX if there are none
+	u32 drawParamsStride;
+	u32 lod = 0;          // Level of detail picked from the screen size of the model bounds, see SelectEntityLod
+
+	// Model bounds moved by worldMatrix. Only recomputed when the matrix or the model change, see UpdateEntityWorldBounds
+	vec3 worldBoundsMin;
+	vec3 worldBoundsMax;
+	vec3 worldBoundsCenter;
+	f32  worldBoundsRadius;
+	mat4 worldBoundsMatrix;               // worldMatrix the bounds were computed with
+	u32  worldBoundsModel = UINT32_MAX;   // modelIndex they were computed with
 
 	void setPosition(const glm::vec3& newPosition) {
 		mat4 translationMatrix = glm::translate(glm::mat4(1.0f), newPosition);
@@ -129,6 +311,20 @@ struct Entity
 
 };
 
+// Returns true when the bounds had to be recomputed
+inline bool UpdateEntityWorldBounds(Entity& entity, const Model& model)
+{
+	if (entity.worldBoundsModel == entity.modelIndex && entity.worldBoundsMatrix == entity.worldMatrix)
+		return false;
+
+	TransformBoundingBox(entity.worldMatrix, model.boundsMin, model.boundsMax, entity.worldBoundsMin, entity.worldBoundsMax);
+	entity.worldBoundsCenter = vec3(entity.worldMatrix * glm::vec4(model.boundsCenter, 1.0f));
+	entity.worldBoundsRadius = model.boundsRadius * GetMaxScale(entity.worldMatrix);
+	entity.worldBoundsMatrix = entity.worldMatrix;
+	entity.worldBoundsModel = entity.modelIndex;
+	return true;
+}
+
 struct Quad
 {
 	GLuint vao;
@@ -0,0 +1,211 @@
+#include "geometry_pool.h"
+#include "buffer.h"
+#include "meshlet.h"
+
+// Like Align, but for any multiple (vertex strides are not powers of 2)
+static u32 RoundUp(u32 value, u32 multiple)
+{
+	return (value + multiple - 1) / multiple * multiple;
+}
+
+static GLuint CreateArenaBuffer(u32 capacity)
+{
+	// Uploads go through the copy targets so they never touch the element array binding of a bound VAO
+	GLuint handle = 0;
+	glGenBuffers(1, &handle);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, handle);
+	glBufferData(GL_COPY_WRITE_BUFFER, capacity, NULL, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	return handle;
+}
+
+static void InitGeometryArena(GeometryArena& arena, u32 capacity)
+{
+	arena.handle = CreateArenaBuffer(capacity);
+	arena.capacity = capacity;
+	arena.usedBytes = 0;
+	arena.freeBlocks.assign(1, GeometryBlock{ 0, capacity });
+}
+
+static void ReleaseGeometryPoolVAOs(GeometryPool& pool)
+{
+	for (u32 i = 0; i < pool.vaos.size(); ++i)
+	{
+		glDeleteVertexArrays(1, &pool.vaos[i].handle);
+	}
+	pool.vaos.clear();
+}
+
+// First fit. The padding before the aligned start and the tail stay in the free list.
+static bool AllocateBlock(GeometryArena& arena, u32 size, u32 alignment, u32* offset)
+{
+	for (u32 i = 0; i < arena.freeBlocks.size(); ++i)
+	{
+		const GeometryBlock block = arena.freeBlocks[i];
+		const u32 start = RoundUp(block.offset, alignment);
+		const u32 end = block.offset + block.size;
+		if (start > end || end - start < size)
+			continue;
+
+		arena.freeBlocks.erase(arena.freeBlocks.begin() + i);
+		if (start + size < end)
+			arena.freeBlocks.insert(arena.freeBlocks.begin() + i, GeometryBlock{ start + size, end - start - size });
+		if (start > block.offset)
+			arena.freeBlocks.insert(arena.freeBlocks.begin() + i, GeometryBlock{ block.offset, start - block.offset });
+
+		arena.usedBytes += size;
+		*offset = start;
+		return true;
+	}
+	return false;
+}
+
+static void InsertFreeBlock(GeometryArena& arena, u32 offset, u32 size)
+{
+	u32 i = 0;
+	while (i < arena.freeBlocks.size() && arena.freeBlocks[i].offset < offset)
+		++i;
+	arena.freeBlocks.insert(arena.freeBlocks.begin() + i, GeometryBlock{ offset, size });
+
+	// Merge with the next block, then with the previous one
+	if (i + 1 < arena.freeBlocks.size() && offset + size == arena.freeBlocks[i + 1].offset)
+	{
+		arena.freeBlocks[i].size += arena.freeBlocks[i + 1].size;
+		arena.freeBlocks.erase(arena.freeBlocks.begin() + i + 1);
+	}
+	if (i > 0 && arena.freeBlocks[i - 1].offset + arena.freeBlocks[i - 1].size == offset)
+	{
+		arena.freeBlocks[i - 1].size += arena.freeBlocks[i].size;
+		arena.freeBlocks.erase(arena.freeBlocks.begin() + i);
+	}
+}
+
+// Reallocates the arena with more room at the end and copies the current contents over
+static void GrowArena(GeometryArena& arena, u32 minFreeBytes)
+{
+	const u32 oldCapacity = arena.capacity;
+	const u32 newCapacity = glm::max(oldCapacity * 2, oldCapacity + minFreeBytes);
+
+	GLuint newHandle = CreateArenaBuffer(newCapacity);
+	glBindBuffer(GL_COPY_READ_BUFFER, arena.handle);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, newHandle);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldCapacity);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glDeleteBuffers(1, &arena.handle);
+
+	arena.handle = newHandle;
+	arena.capacity = newCapacity;
+	InsertFreeBlock(arena, oldCapacity, newCapacity - oldCapacity);
+
+	ILOG("Geometry pool arena grown from %u to %u bytes", oldCapacity, newCapacity);
+}
+
+static u32 AllocateArenaBlock(GeometryPool& pool, GeometryArena& arena, u32 size, u32 alignment)
+{
+	u32 offset = 0;
+	if (size == 0 || AllocateBlock(arena, size, alignment, &offset))
+		return offset;
+
+	GrowArena(arena, size + alignment);
+	ReleaseGeometryPoolVAOs(pool);
+
+	bool allocated = AllocateBlock(arena, size, alignment, &offset);
+	ASSERT(allocated, "The geometry arena must have room after growing");
+	return offset;
+}
+
+void InitGeometryPool(GeometryPool& pool, u32 vertexCapacity, u32 indexCapacity, u32 clusterCapacity)
+{
+	InitGeometryArena(pool.vertices, vertexCapacity);
+	InitGeometryArena(pool.indices, indexCapacity);
+	InitGeometryArena(pool.clusters, clusterCapacity);
+	pool.vaos.clear();
+}
+
+void DestroyGeometryPool(GeometryPool& pool)
+{
+	ReleaseGeometryPoolVAOs(pool);
+	glDeleteBuffers(1, &pool.vertices.handle);
+	glDeleteBuffers(1, &pool.indices.handle);
+	glDeleteBuffers(1, &pool.clusters.handle);
+	pool.vertices = GeometryArena{};
+	pool.indices = GeometryArena{};
+	pool.clusters = GeometryArena{};
+}
+
+void UploadSubmeshGeometry(GeometryPool& pool, Submesh& submesh, const void* vertices, const void* indices)
+{
+	const u32 stride = submesh.vertexBufferLayout.stride;
+	const u32 indexSize = GetIndexSize(submesh.indexType);
+	const u32 verticesSize = submesh.vertexCount * stride;
+	const u32 indicesSize = GetSubmeshIndexCount(submesh) * indexSize;
+
+	submesh.vertexOffset = AllocateArenaBlock(pool, pool.vertices, verticesSize, stride);
+	submesh.indexOffset = AllocateArenaBlock(pool, pool.indices, indicesSize, indexSize);
+	submesh.baseVertex = submesh.vertexOffset / stride;
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, pool.vertices.handle);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, submesh.vertexOffset, verticesSize, vertices);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, pool.indices.handle);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, submesh.indexOffset, indicesSize, indices);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	submesh.clusterOffset = 0;
+	submesh.clusterSize = 0;
+	if (!submesh.meshlets.empty())
+	{
+		const std::vector<u8> clusters = PackSubmeshClusters(submesh);
+		submesh.clusterSize = (u32)clusters.size();
+		submesh.clusterOffset = AllocateArenaBlock(pool, pool.clusters, submesh.clusterSize, GEOMETRY_POOL_CLUSTER_ALIGNMENT);
+
+		glBindBuffer(GL_COPY_WRITE_BUFFER, pool.clusters.handle);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, submesh.clusterOffset, submesh.clusterSize, clusters.data());
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+}
+
+StagedSubmeshGeometry StageSubmeshGeometry(const Submesh& submesh, std::vector<u8>& staging)
+{
+	StagedSubmeshGeometry staged = {};
+	staged.vertexOffset = (u32)staging.size();
+	staging.insert(staging.end(), submesh.vertices.begin(), submesh.vertices.end());
+	staged.indexOffset = (u32)staging.size();
+	staging.insert(staging.end(), submesh.indices.begin(), submesh.indices.end());
+
+	if (!submesh.meshlets.empty())
+	{
+		const std::vector<u8> clusters = PackSubmeshClusters(submesh);
+		staged.clusterOffset = (u32)staging.size();
+		staged.clusterSize = (u32)clusters.size();
+		staging.insert(staging.end(), clusters.begin(), clusters.end());
+	}
+	return staged;
+}
+
+void CopySubmeshGeometry(GeometryPool& pool, Submesh& submesh, GLuint staging, const StagedSubmeshGeometry& staged)
+{
+	const u32 stride = submesh.vertexBufferLayout.stride;
+	const u32 indexSize = GetIndexSize(submesh.indexType);
+	const u32 verticesSize = submesh.vertexCount * stride;
+	const u32 indicesSize = GetSubmeshIndexCount(submesh) * indexSize;
+
+	submesh.vertexOffset = AllocateArenaBlock(pool, pool.vertices, verticesSize, stride);
+	submesh.indexOffset = AllocateArenaBlock(pool, pool.indices, indicesSize, indexSize);
+	submesh.baseVertex = submesh.vertexOffset / stride;
+	submesh.clusterSize = staged.clusterSize;
+	submesh.clusterOffset = staged.clusterSize > 0 ? AllocateArenaBlock(pool, pool.clusters, staged.clusterSize, GEOMETRY_POOL_CLUSTER_ALIGNMENT) : 0;
+
+	glBindBuffer(GL_COPY_READ_BUFFER, staging);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, pool.vertices.handle);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, staged.vertexOffset, submesh.vertexOffset, verticesSize);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, pool.indices.handle);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, staged.indexOffset, submesh.indexOffset, indicesSize);
+	if (staged.clusterSize > 0)
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, pool.clusters.handle);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, staged.clusterOffset, submesh.clusterOffset, staged.clusterSize);
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
@@ -0,0 +1,70 @@
+//
+// geometry_pool.h: One big vertex buffer and one big index buffer shared by every mesh.
+// Submeshes take blocks from a free-list sub-allocator and are drawn with a base vertex,
+// so all the meshes with the same vertex layout can share a single VAO. A third buffer holds
+// the meshlet clusters of the submeshes that have them (see meshlet.h).
+//
+
+#pragma once
+
+#include "geometry.h"
+
+#define GEOMETRY_POOL_VERTEX_CAPACITY (64 * 1024 * 1024)
+#define GEOMETRY_POOL_INDEX_CAPACITY  (16 * 1024 * 1024)
+#define GEOMETRY_POOL_CLUSTER_CAPACITY (8 * 1024 * 1024)
+#define GEOMETRY_POOL_CLUSTER_ALIGNMENT 256 // Largest GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT allowed by the spec
+
+struct GeometryBlock
+{
+	u32 offset;
+	u32 size;
+};
+
+struct GeometryArena
+{
+	GLuint handle;
+	u32    capacity;
+	u32    usedBytes;
+	std::vector<GeometryBlock> freeBlocks; // Sorted by offset, neighbours are always merged
+};
+
+// Where the streams of a submesh are in a staging buffer, see StageSubmeshGeometry
+struct StagedSubmeshGeometry
+{
+	u32 vertexOffset;
+	u32 indexOffset;
+	u32 clusterOffset;
+	u32 clusterSize;
+};
+
+struct GeometryPool
+{
+	GeometryArena    vertices;
+	GeometryArena    indices;
+	GeometryArena    clusters;
+	std::vector<Vao> vaos; // One per vertex layout and program, see FindVAO
+};
+
+void InitGeometryPool(GeometryPool& pool, u32 vertexCapacity = GEOMETRY_POOL_VERTEX_CAPACITY, u32 indexCapacity = GEOMETRY_POOL_INDEX_CAPACITY, u32 clusterCapacity = GEOMETRY_POOL_CLUSTER_CAPACITY);
+
+void DestroyGeometryPool(GeometryPool& pool);
+
+/**
+ * Takes room for the submesh streams and uploads them. The vertex block is aligned to the
+ * vertex stride, so submesh.baseVertex addresses it, and the index block to the index size.
+ * Submeshes with meshlets also get their packed clusters uploaded.
+ * The arenas grow if they are full, which throws away the VAOs (they point to the old buffers).
+ */
+void UploadSubmeshGeometry(GeometryPool& pool, Submesh& submesh, const void* vertices, const void* indices);
+
+/**
+ * Appends the streams of the submesh (and its packed clusters) to a staging buffer, for
+ * CopySubmeshGeometry once it is on the GPU. No GL, safe to call from any thread.
+ */
+StagedSubmeshGeometry StageSubmeshGeometry(const Submesh& submesh, std::vector<u8>& staging);
+
+/**
+ * UploadSubmeshGeometry from a staging buffer already on the GPU: the streams are copied
+ * buffer to buffer.
+ */
+void CopySubmeshGeometry(GeometryPool& pool, Submesh& submesh, GLuint staging, const StagedSubmeshGeometry& staged);
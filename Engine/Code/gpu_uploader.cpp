@@ -0,0 +1,442 @@
+#include "gpu_uploader.h"
+#include "asset_loader.h"
+#include "engine.h"
+
+#ifdef _DEBUG
+#include <GLFW/glfw3.h>
+#endif // _DEBUG
+
+#ifndef _DEBUG
+#include "../ThirdParty/glfw/include/GLFW/glfw3.h"
+#endif // !_DEBUG
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// GL_ARB_buffer_storage (core in 4.4), the glad loader was generated for 4.3
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT   0x0080
+#endif
+
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+static PFNGLBUFFERSTORAGEPROC glBufferStorage;
+
+#define GPU_UPLOAD_STAGING_ALIGNMENT 16          // Enough for any pixel or compressed block row
+#define GPU_UPLOAD_POLL_NANOSECONDS  1000000ull  // Wait on the oldest fence while there is nothing to upload
+
+// The segments of one buffer, used in order. Leaving a segment fences it, and coming back to
+// it waits for that fence, so the GPU is never reading what the CPU overwrites.
+struct StagingRing
+{
+	GLuint buffer;
+	u8*    mapped;     // Persistent mapping of the whole buffer, null without buffer storage
+	u32    segment;
+	u32    head;       // Bytes used in the current segment
+	GLsync fences[GPU_UPLOAD_SEGMENT_COUNT];
+};
+
+struct PendingGpuUpload
+{
+	GpuUpload                       upload;
+	std::function<void(GpuUpload&)> onUploaded;
+	GLsync                          fence;
+};
+
+struct GpuUploaderState
+{
+	GLFWwindow*                  window;
+	std::thread                  thread;
+	std::mutex                   mutex;
+	std::condition_variable      condition;
+	std::deque<PendingGpuUpload> requests;
+	GpuUploaderStats             stats;
+	bool                         running;
+	bool                         quit;
+};
+
+static GpuUploaderState GlobalGpuUploader;
+
+static bool HasGLExtension(const char* name)
+{
+	GLint extensionCount = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+	for (GLint i = 0; i < extensionCount; ++i)
+	{
+		if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+			return true;
+	}
+	return false;
+}
+
+static void CreateStagingRing(StagingRing& ring)
+{
+	GLenum err;
+
+	const GLsizeiptr size = (GLsizeiptr)GPU_UPLOAD_SEGMENT_SIZE * GPU_UPLOAD_SEGMENT_COUNT;
+	ring = StagingRing{};
+	glGenBuffers(1, &ring.buffer);
+	glBindBuffer(GL_COPY_READ_BUFFER, ring.buffer);
+	if (glBufferStorage)
+	{
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_READ_BUFFER, size, NULL, flags);
+		ring.mapped = (u8*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, size, flags);
+	}
+	else
+	{
+		glBufferData(GL_COPY_READ_BUFFER, size, NULL, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	if ((err = glGetError()) != GL_NO_ERROR)
+		ELOG("OpenGL error %d creating the upload staging ring\n", err);
+}
+
+static void DestroyStagingRing(StagingRing& ring)
+{
+	for (u32 i = 0; i < GPU_UPLOAD_SEGMENT_COUNT; ++i)
+	{
+		if (ring.fences[i])
+		{
+			glClientWaitSync(ring.fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+			glDeleteSync(ring.fences[i]);
+		}
+	}
+	if (ring.mapped)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, ring.buffer);
+		glUnmapBuffer(GL_COPY_READ_BUFFER);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+	glDeleteBuffers(1, &ring.buffer);
+	ring = StagingRing{};
+}
+
+static void MoveToNextSegment(StagingRing& ring)
+{
+	ring.fences[ring.segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	ring.segment = (ring.segment + 1) % GPU_UPLOAD_SEGMENT_COUNT;
+	ring.head = 0;
+
+	GLsync fence = ring.fences[ring.segment];
+	if (!fence)
+		return;
+	if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+	{
+		std::lock_guard<std::mutex> lock(GlobalGpuUploader.mutex);
+		GlobalGpuUploader.stats.segmentWaits++;
+	}
+	glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+	glDeleteSync(fence);
+	ring.fences[ring.segment] = 0;
+}
+
+// Copies the data into the ring and gives its offset in the staging buffer.
+// False if it doesn't fit in a segment, then it must be read from client memory.
+static bool StageData(StagingRing& ring, const void* data, u32 size, u32* offset)
+{
+	if (size > GPU_UPLOAD_SEGMENT_SIZE)
+		return false;
+	if (ring.head + size > GPU_UPLOAD_SEGMENT_SIZE)
+		MoveToNextSegment(ring);
+
+	*offset = ring.segment * GPU_UPLOAD_SEGMENT_SIZE + ring.head;
+	ring.head += (size + GPU_UPLOAD_STAGING_ALIGNMENT - 1) & ~(GPU_UPLOAD_STAGING_ALIGNMENT - 1);
+
+	if (ring.mapped)
+	{
+		memcpy(ring.mapped + *offset, data, size);
+	}
+	else
+	{
+		// The fences already keep the GPU off this range, no need for the driver to sync
+		glBindBuffer(GL_COPY_READ_BUFFER, ring.buffer);
+		void* mapped = glMapBufferRange(GL_COPY_READ_BUFFER, *offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		if (mapped)
+			memcpy(mapped, data, size);
+		glUnmapBuffer(GL_COPY_READ_BUFFER);
+	}
+	return true;
+}
+
+// Pixel data for glTex(Sub)Image: an offset in the bound unpack buffer, or the client pointer
+static const void* StagePixels(StagingRing& ring, const void* data, u32 size, GpuUploaderStats& stats)
+{
+	u32 offset = 0;
+	stats.uploadedBytes += size;
+	if (StageData(ring, data, size, &offset))
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring.buffer);
+		return (const void*)(uintptr_t)offset;
+	}
+
+	stats.clientBytes += size;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	return data;
+}
+
+static GLuint UploadCookedTexture(StagingRing& ring, const GpuUpload& upload, GpuUploaderStats& stats)
+{
+	const CookedTexture& texture = *upload.cooked;
+	const GLenum internalFormat = GetCookedTextureInternalFormat(texture.format);
+	const CookedTextureLevel& first = texture.levels[upload.firstLevel];
+	const u32 levelCount = (u32)texture.levels.size() - upload.firstLevel;
+
+	GLuint handle = 0;
+	glGenTextures(1, &handle);
+	glBindTexture(upload.target, handle);
+	if (upload.target == GL_TEXTURE_2D_ARRAY)
+		glTexStorage3D(upload.target, levelCount, internalFormat, first.width, first.height, 1);
+	else
+		glTexStorage2D(upload.target, levelCount, internalFormat, first.width, first.height);
+
+	for (u32 i = 0; i < levelCount; ++i)
+	{
+		const CookedTextureLevel& level = texture.levels[upload.firstLevel + i];
+		const void* pixels = StagePixels(ring, texture.data.data() + level.offset, level.size, stats);
+		if (upload.target == GL_TEXTURE_2D_ARRAY)
+			glCompressedTexSubImage3D(upload.target, i, 0, 0, 0, level.width, level.height, 1, internalFormat, level.size, pixels);
+		else
+			glCompressedTexSubImage2D(upload.target, i, 0, 0, level.width, level.height, internalFormat, level.size, pixels);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glBindTexture(upload.target, 0);
+	return handle;
+}
+
+static GLuint UploadImageTexture(StagingRing& ring, const GpuUpload& upload, GpuUploaderStats& stats)
+{
+	const Image& image = *upload.image;
+	GLenum internalFormat, dataFormat;
+	GetImageTextureFormats(image.nchannels, &internalFormat, &dataFormat);
+
+	GLuint handle = 0;
+	glGenTextures(1, &handle);
+	glBindTexture(GL_TEXTURE_2D, handle);
+	glTexStorage2D(GL_TEXTURE_2D, GetMipLevelCount(image.size.x, image.size.y), internalFormat, image.size.x, image.size.y);
+
+	const u32 size = (u32)image.size.x * image.size.y * image.nchannels;
+	const void* pixels = StagePixels(ring, image.pixels, size, stats);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image.size.x, image.size.y, dataFormat, GL_UNSIGNED_BYTE, pixels);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return handle;
+}
+
+// Copied a segment at a time, so any size goes through the ring
+static GLuint UploadBuffer(StagingRing& ring, const GpuUpload& upload, GpuUploaderStats& stats)
+{
+	GLuint handle = 0;
+	glGenBuffers(1, &handle);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, handle);
+	glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)upload.size, NULL, GL_STATIC_DRAW);
+
+	for (u64 done = 0; done < upload.size;)
+	{
+		const u32 chunkSize = (u32)glm::min(upload.size - done, (u64)GPU_UPLOAD_SEGMENT_SIZE);
+		u32 offset = 0;
+		StageData(ring, (const u8*)upload.data + done, chunkSize, &offset);
+		glBindBuffer(GL_COPY_READ_BUFFER, ring.buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, (GLintptr)done, chunkSize);
+		done += chunkSize;
+	}
+	stats.uploadedBytes += upload.size;
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	return handle;
+}
+
+static void ProcessGpuUpload(StagingRing& ring, PendingGpuUpload& pending)
+{
+	GLenum err;
+
+	GpuUpload& upload = pending.upload;
+	GpuUploaderStats stats = {};
+	switch (upload.type)
+	{
+	case GpuUploadType_CookedTexture: upload.handle = UploadCookedTexture(ring, upload, stats); stats.textureCount++; break;
+	case GpuUploadType_ImageTexture:  upload.handle = UploadImageTexture(ring, upload, stats); stats.textureCount++; break;
+	case GpuUploadType_Buffer:        upload.handle = UploadBuffer(ring, upload, stats); stats.bufferCount++; break;
+	}
+
+	if ((err = glGetError()) != GL_NO_ERROR)
+	{
+		ELOG("OpenGL error %d on the upload thread\n", err);
+		if (upload.type == GpuUploadType_Buffer)
+			glDeleteBuffers(1, &upload.handle);
+		else
+			glDeleteTextures(1, &upload.handle);
+		upload.handle = 0;
+	}
+
+	// The other contexts only see the object once these commands reach the GPU
+	pending.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush();
+
+	std::lock_guard<std::mutex> lock(GlobalGpuUploader.mutex);
+	GlobalGpuUploader.stats.uploadedBytes += stats.uploadedBytes;
+	GlobalGpuUploader.stats.clientBytes += stats.clientBytes;
+	GlobalGpuUploader.stats.textureCount += stats.textureCount;
+	GlobalGpuUploader.stats.bufferCount += stats.bufferCount;
+}
+
+// Runs the callbacks of the uploads whose fence signaled, in submission order
+static void PublishFinishedUploads(std::deque<PendingGpuUpload>& inFlight, GLuint64 timeout)
+{
+	while (!inFlight.empty())
+	{
+		PendingGpuUpload& pending = inFlight.front();
+		const GLenum status = glClientWaitSync(pending.fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			return;
+
+		glDeleteSync(pending.fence);
+		pending.onUploaded(pending.upload);
+		inFlight.pop_front();
+		timeout = 0;
+
+		std::lock_guard<std::mutex> lock(GlobalGpuUploader.mutex);
+		GlobalGpuUploader.stats.pendingCount--;
+	}
+}
+
+static void GpuUploaderThread()
+{
+	GpuUploaderState& uploader = GlobalGpuUploader;
+	glfwMakeContextCurrent(uploader.window);
+
+	// Rows are tightly packed, RGB and red rows are not always 4 byte aligned
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	StagingRing ring;
+	CreateStagingRing(ring);
+
+	std::deque<PendingGpuUpload> inFlight;
+	for (;;)
+	{
+		PendingGpuUpload pending;
+		bool hasRequest = false;
+		{
+			std::unique_lock<std::mutex> lock(uploader.mutex);
+			if (inFlight.empty())
+				uploader.condition.wait(lock, [&uploader] { return uploader.quit || !uploader.requests.empty(); });
+			if (uploader.quit)
+				break;
+			if (!uploader.requests.empty())
+			{
+				pending = std::move(uploader.requests.front());
+				uploader.requests.pop_front();
+				hasRequest = true;
+			}
+		}
+
+		if (hasRequest)
+		{
+			ProcessGpuUpload(ring, pending);
+			inFlight.push_back(std::move(pending));
+			PublishFinishedUploads(inFlight, 0);
+		}
+		else
+		{
+			PublishFinishedUploads(inFlight, GPU_UPLOAD_POLL_NANOSECONDS);
+		}
+	}
+
+	while (!inFlight.empty())
+		PublishFinishedUploads(inFlight, UINT64_MAX);
+	DestroyStagingRing(ring);
+	glfwMakeContextCurrent(NULL);
+}
+
+void InitGpuUploader(GLFWwindow* uploadWindow, GLADloadproc load)
+{
+	GpuUploaderState& uploader = GlobalGpuUploader;
+	if (uploader.running || !uploadWindow)
+		return;
+
+	glBufferStorage = NULL;
+	if (GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 4) || HasGLExtension("GL_ARB_buffer_storage"))
+		glBufferStorage = (PFNGLBUFFERSTORAGEPROC)load("glBufferStorage");
+	if (!glBufferStorage)
+		ILOG("GL_ARB_buffer_storage not available, the upload staging ring is mapped on every upload");
+
+	uploader.window = uploadWindow;
+	uploader.stats = GpuUploaderStats{};
+	uploader.quit = false;
+	uploader.running = true;
+	uploader.thread = std::thread(GpuUploaderThread);
+}
+
+void ShutdownGpuUploader()
+{
+	GpuUploaderState& uploader = GlobalGpuUploader;
+	if (!uploader.running)
+		return;
+
+	std::deque<PendingGpuUpload> dropped;
+	{
+		std::lock_guard<std::mutex> lock(uploader.mutex);
+		uploader.quit = true;
+		uploader.running = false;
+		dropped.swap(uploader.requests);
+		uploader.stats.pendingCount -= (u32)dropped.size();
+	}
+	uploader.condition.notify_one();
+	uploader.thread.join();
+
+	for (u32 i = 0; i < dropped.size(); ++i)
+		dropped[i].onUploaded(dropped[i].upload);
+	uploader.window = NULL;
+}
+
+bool IsGpuUploaderRunning()
+{
+	std::lock_guard<std::mutex> lock(GlobalGpuUploader.mutex);
+	return GlobalGpuUploader.running;
+}
+
+GpuUploaderStats GetGpuUploaderStats()
+{
+	std::lock_guard<std::mutex> lock(GlobalGpuUploader.mutex);
+	return GlobalGpuUploader.stats;
+}
+
+void SubmitGpuUpload(const GpuUpload& upload, std::function<void(GpuUpload&)> onUploaded)
+{
+	GpuUploaderState& uploader = GlobalGpuUploader;
+
+	PendingGpuUpload pending = {};
+	pending.upload = upload;
+	pending.upload.handle = 0;
+	pending.onUploaded = std::move(onUploaded);
+	bool queued = false;
+	{
+		std::lock_guard<std::mutex> lock(uploader.mutex);
+		if (uploader.running)
+		{
+			uploader.requests.push_back(std::move(pending));
+			uploader.stats.pendingCount++;
+			queued = true;
+		}
+	}
+
+	// Not running: nothing was created, the caller does it the synchronous way
+	if (queued)
+		uploader.condition.notify_one();
+	else
+		pending.onUploaded(pending.upload);
+}
+
+void GpuUploadAwaitable::await_suspend(std::coroutine_handle<> handle)
+{
+	SubmitGpuUpload(upload, [this, handle](GpuUpload& uploaded) {
+		upload = uploaded;
+		ResumeOnMainThread(handle);
+	});
+}
@@ -0,0 +1,96 @@
+//
+// gpu_uploader.h: A thread with its own GL context, shared with the main one, that creates the
+// textures and buffers of the assets being loaded, so big uploads never stall a frame. The data
+// goes through a ring of persistently mapped staging segments (pixel unpack and copy read source
+// alike), and every finished resource is published with a fence: its callback only runs once
+// the GPU is done with it, so the main thread can use the object right away.
+//
+// The main thread only adopts the objects, or copies them on the GPU (texture array layers,
+// geometry pool blocks). Objects are shared between the contexts, VAOs are not: none are made here.
+//
+
+#pragma once
+
+#include <glad/glad.h>
+#include "platform.h"
+#include "texture_cooker.h"
+
+#include <coroutine>
+#include <functional>
+
+struct GLFWwindow;
+struct Image;
+
+#define GPU_UPLOAD_SEGMENT_SIZE  (16 * 1024 * 1024) // Bytes of one staging segment, larger data is copied from client memory
+#define GPU_UPLOAD_SEGMENT_COUNT 4                  // Segments in the ring, each one fenced once the uploads leave it
+
+enum GpuUploadType
+{
+	GpuUploadType_CookedTexture,
+	GpuUploadType_ImageTexture,
+	GpuUploadType_Buffer,
+};
+
+// What to create and from which data. The data is not copied: it must stay alive until the
+// callback runs.
+struct GpuUpload
+{
+	GpuUploadType        type;
+	GLenum               target;     // Textures: GL_TEXTURE_2D, or GL_TEXTURE_2D_ARRAY for an array of one layer
+	const CookedTexture* cooked;     // CookedTexture: its levels from firstLevel on, in immutable storage
+	u32                  firstLevel;
+	const Image*         image;      // ImageTexture: level 0 of a full mip chain, the others generated
+	const void*          data;       // Buffer: the contents of a GL_STATIC_DRAW buffer
+	u64                  size;
+
+	GLuint               handle;     // The object created, 0 if it failed
+};
+
+struct GpuUploaderStats
+{
+	u64 uploadedBytes;   // Staged and copied from client memory
+	u64 clientBytes;     // Too big for a segment, copied from client memory
+	u32 textureCount;
+	u32 bufferCount;
+	u32 pendingCount;    // Submitted, callback not run yet
+	u32 segmentWaits;    // Times a segment was still in use by the GPU when the ring came back to it
+};
+
+/**
+ * Starts the uploader thread on the context of uploadWindow, a hidden window sharing its
+ * objects with the main one. Called on the main thread with its context current, after glad.
+ * Persistent mapping needs GL_ARB_buffer_storage, without it every stage maps the segment.
+ */
+void InitGpuUploader(GLFWwindow* uploadWindow, GLADloadproc load);
+
+/**
+ * Stops the thread: the uploads in flight are waited for, the ones not started yet get their
+ * callback with no object.
+ */
+void ShutdownGpuUploader();
+
+bool IsGpuUploaderRunning();
+
+GpuUploaderStats GetGpuUploaderStats();
+
+/**
+ * Queues an upload, from any thread. onUploaded runs on the uploader thread once the object
+ * can be used by the other contexts. It always runs: with handle 0 if the upload failed or
+ * the uploader is not running (then right away, on the calling thread).
+ */
+void SubmitGpuUpload(const GpuUpload& upload, std::function<void(GpuUpload&)> onUploaded);
+
+struct GpuUploadAwaitable
+{
+	GpuUpload upload;
+
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> handle);
+	GpuUpload await_resume() const noexcept { return upload; }
+};
+
+/**
+ * Uploads on the uploader thread and resumes the calling coroutine on the main thread once
+ * the object is ready, or with handle 0 to do it there.
+ */
+inline GpuUploadAwaitable UploadOnGpuThread(const GpuUpload& upload) { return { upload }; }
@@ -0,0 +1,214 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "ibl_cache.h"
+#include "job_system.h"
+
+#include <memory>
+
+#define IBL_HASH_SEED  14695981039346656037ull
+#define IBL_HASH_PRIME 1099511628211ull
+
+struct IblCacheHeader
+{
+	u32 magic;
+	u32 version;
+	u64 key;
+	u32 mapCount;
+	u32 padding;
+	u64 dataSize;         // Pixels of every map, after the map table
+};
+
+// FNV-1a, 64 bits
+static u64 HashBytes(const void* data, u64 size, u64 hash)
+{
+	const u8* bytes = (const u8*)data;
+	for (u64 i = 0; i < size; ++i)
+		hash = (hash ^ bytes[i]) * IBL_HASH_PRIME;
+	return hash;
+}
+
+static u32 GetFaceCount(const IblCacheMap& map)
+{
+	return map.target == GL_TEXTURE_CUBE_MAP ? 6 : 1;
+}
+
+static u32 GetLevelSize(const IblCacheMap& map, u32 level)
+{
+	return glm::max(map.size >> level, 1u);
+}
+
+// Bytes of one face of one level
+static u64 GetLevelBytes(const IblCacheMap& map, u32 level)
+{
+	const u64 size = GetLevelSize(map, level);
+	return size * size * map.pixelSize;
+}
+
+static u64 GetMapBytes(const IblCacheMap& map)
+{
+	u64 bytes = 0;
+	for (u32 level = 0; level < map.levelCount; ++level)
+		bytes += GetLevelBytes(map, level) * GetFaceCount(map);
+	return bytes;
+}
+
+static GLenum GetFaceTarget(const IblCacheMap& map, u32 face)
+{
+	return map.target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : GL_TEXTURE_2D;
+}
+
+u64 GetIblBakeKey(const std::vector<std::string>& filepaths, const IblCacheMap* maps, u32 mapCount)
+{
+	u64 hash = HashBytes(maps, (u64)mapCount * sizeof(IblCacheMap), IBL_HASH_SEED);
+	for (u32 i = 0; i < filepaths.size(); ++i)
+	{
+		MappedFile file = MapFile(filepaths[i].c_str());
+		if (!file.data)
+			return 0;
+
+		hash = HashBytes(file.data, file.size, hash);
+		UnmapFile(file);
+	}
+	return hash != 0 ? hash : 1;
+}
+
+std::string GetIblCachePath(const char* sourcePath)
+{
+	return std::string(sourcePath) + IBL_CACHE_EXTENSION;
+}
+
+bool ReadIblCache(const char* cachePath, u64 key, const IblCacheMap* maps, u32 mapCount, std::vector<u8>& pixels)
+{
+	MappedFile file = MapFile(cachePath);
+	if (!file.data)
+		return false;
+
+	u64 dataSize = 0;
+	for (u32 i = 0; i < mapCount; ++i)
+		dataSize += GetMapBytes(maps[i]);
+
+	const u8* base = (const u8*)file.data;
+	const u64 mapsSize = (u64)mapCount * sizeof(IblCacheMap);
+	IblCacheHeader header;
+	bool valid = file.size >= sizeof(header);
+	if (valid)
+	{
+		memcpy(&header, base, sizeof(header));
+		valid = header.magic == IBL_CACHE_MAGIC &&
+			header.version == IBL_CACHE_VERSION &&
+			header.key == key &&
+			header.mapCount == mapCount &&
+			header.dataSize == dataSize &&
+			sizeof(header) + mapsSize + dataSize == file.size &&
+			memcmp(base + sizeof(header), maps, mapsSize) == 0;
+	}
+	if (valid)
+		pixels.assign(base + sizeof(header) + mapsSize, base + file.size);
+
+	UnmapFile(file);
+	return valid;
+}
+
+void CreateIblCacheTextures(const IblCacheMap* maps, u32 mapCount, const std::vector<u8>& pixels, GLuint* textures)
+{
+	GLenum err;
+
+	// Rows are tightly packed, RGB rows are not always 4 byte aligned
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	u64 offset = 0;
+	for (u32 i = 0; i < mapCount; ++i)
+	{
+		const IblCacheMap& map = maps[i];
+		glGenTextures(1, &textures[i]);
+		glBindTexture(map.target, textures[i]);
+		for (u32 level = 0; level < map.levelCount; ++level)
+		{
+			const u32 size = GetLevelSize(map, level);
+			for (u32 face = 0; face < GetFaceCount(map); ++face)
+			{
+				glTexImage2D(GetFaceTarget(map, face), level, map.internalFormat, size, size, 0, map.format, map.type, pixels.data() + offset);
+				offset += GetLevelBytes(map, level);
+			}
+		}
+
+		glTexParameteri(map.target, GL_TEXTURE_MAX_LEVEL, map.levelCount - 1);
+		glTexParameteri(map.target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(map.target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		if (map.target == GL_TEXTURE_CUBE_MAP)
+			glTexParameteri(map.target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexParameteri(map.target, GL_TEXTURE_MIN_FILTER, map.levelCount > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+		glTexParameteri(map.target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glBindTexture(map.target, 0);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	if ((err = glGetError()) != GL_NO_ERROR)
+		ELOG("OpenGL error %d creating the cached IBL maps\n", err);
+}
+
+void SaveIblCache(const char* cachePath, u64 key, const IblCacheMap* maps, u32 mapCount, const GLuint* textures)
+{
+	GLenum err;
+
+	if (key == 0)
+		return;
+
+	u64 dataSize = 0;
+	for (u32 i = 0; i < mapCount; ++i)
+		dataSize += GetMapBytes(maps[i]);
+
+	// Read back on the main thread, the file is written on a worker
+	std::shared_ptr<std::vector<u8>> file = std::make_shared<std::vector<u8>>(sizeof(IblCacheHeader) + mapCount * sizeof(IblCacheMap) + dataSize);
+	IblCacheHeader header = {};
+	header.magic = IBL_CACHE_MAGIC;
+	header.version = IBL_CACHE_VERSION;
+	header.key = key;
+	header.mapCount = mapCount;
+	header.dataSize = dataSize;
+	memcpy(file->data(), &header, sizeof(header));
+	memcpy(file->data() + sizeof(header), maps, mapCount * sizeof(IblCacheMap));
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	u64 offset = sizeof(header) + mapCount * sizeof(IblCacheMap);
+	for (u32 i = 0; i < mapCount; ++i)
+	{
+		const IblCacheMap& map = maps[i];
+		glBindTexture(map.target, textures[i]);
+		for (u32 level = 0; level < map.levelCount; ++level)
+		{
+			for (u32 face = 0; face < GetFaceCount(map); ++face)
+			{
+				glGetTexImage(GetFaceTarget(map, face), level, map.format, map.type, file->data() + offset);
+				offset += GetLevelBytes(map, level);
+			}
+		}
+		glBindTexture(map.target, 0);
+	}
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	if ((err = glGetError()) != GL_NO_ERROR)
+	{
+		ELOG("OpenGL error %d reading back the IBL maps for %s\n", err, cachePath);
+		return;
+	}
+
+	const std::string path = cachePath;
+	SubmitJob([file, path] {
+		// Written aside and renamed into place: a partial file would have a valid header
+		const std::string tempPath = GetTempFilePath(path.c_str());
+		FILE* out = fopen(tempPath.c_str(), "wb");
+		if (!out)
+		{
+			ELOG("fopen() failed writing IBL cache %s", path.c_str());
+			return;
+		}
+		bool written = fwrite(file->data(), 1, file->size(), out) == file->size();
+		written = fclose(out) == 0 && written;
+		if (!written)
+		{
+			ELOG("fwrite() failed writing IBL cache %s", path.c_str());
+			remove(tempPath.c_str());
+			return;
+		}
+		if (RenameFileOver(tempPath.c_str(), path.c_str()))
+			ILOG("Saved IBL cache %s (%.2f MB)", path.c_str(), file->size() / (1024.0 * 1024.0));
+	});
+}
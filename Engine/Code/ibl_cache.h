@@ -0,0 +1,57 @@
+//
+// ibl_cache.h: On-disk cache of the image based lighting bakes. After a bake the maps are read
+// back, every level of every face, and written next to the panorama they come from. The BRDF
+// LUT doesn't depend on the environment, so every environment shares a single LUT file. Each
+// cache is keyed by a hash of everything that produced it (the contents of the source image
+// and of the bake shaders, and the size and format of every map), so any change to them bakes
+// again instead of loading stale maps.
+//
+
+#pragma once
+
+#include "geometry.h"
+
+#define IBL_CACHE_MAGIC         0x4C424249 // "IBBL"
+#define IBL_CACHE_VERSION       1
+#define IBL_CACHE_EXTENSION     ".iblcache"
+#define IBL_BRDF_LUT_CACHE_PATH "brdf_lut" IBL_CACHE_EXTENSION // In the working directory, shared by every environment
+
+// One baked texture: a cubemap or a 2D texture and all its levels, square
+struct IblCacheMap
+{
+	u32 target;         // GL_TEXTURE_CUBE_MAP or GL_TEXTURE_2D
+	u32 internalFormat;
+	u32 format;         // Of the stored pixels, read back and uploaded in this format and type
+	u32 type;
+	u32 pixelSize;      // Bytes per stored pixel
+	u32 size;           // Width and height of level 0
+	u32 levelCount;
+};
+
+/**
+ * Key of a bake: a hash of the contents of the files it reads (source image, shaders) and of
+ * the maps it makes. 0 if a file can't be read, such bakes are never cached.
+ */
+u64 GetIblBakeKey(const std::vector<std::string>& filepaths, const IblCacheMap* maps, u32 mapCount);
+
+/**
+ * Cache file of the maps baked from a source image, next to it.
+ */
+std::string GetIblCachePath(const char* sourcePath);
+
+/**
+ * Reads the pixels of every map, one after the other, if the cache exists and was written
+ * with the same key and maps. No GL, safe to call from any thread.
+ */
+bool ReadIblCache(const char* cachePath, u64 key, const IblCacheMap* maps, u32 mapCount, std::vector<u8>& pixels);
+
+/**
+ * Creates the textures of the maps from the pixels ReadIblCache returned, with the filtering
+ * the bakes set up (trilinear with mips, linear without).
+ */
+void CreateIblCacheTextures(const IblCacheMap* maps, u32 mapCount, const std::vector<u8>& pixels, GLuint* textures);
+
+/**
+ * Reads the baked textures back and writes them to the cache on the job system.
+ */
+void SaveIblCache(const char* cachePath, u64 key, const IblCacheMap* maps, u32 mapCount, const GLuint* textures);
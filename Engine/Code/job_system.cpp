@@ -0,0 +1,145 @@
+#include "job_system.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+struct JobSystem
+{
+	std::vector<std::thread>          workers;
+	std::deque<std::function<void()>> queue;
+	std::mutex                        mutex;
+	std::condition_variable           wakeCondition;
+	bool                              isRunning;
+};
+
+struct ParallelForBatch
+{
+	std::atomic<u32>                 nextIndex;
+	std::atomic<u32>                 doneCount;
+	u32                              count;
+	const std::function<void(u32)>*  job;
+	std::mutex                       mutex;
+	std::condition_variable          doneCondition;
+};
+
+static JobSystem GlobalJobSystem;
+
+static void WorkerLoop()
+{
+	for (;;)
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(GlobalJobSystem.mutex);
+			GlobalJobSystem.wakeCondition.wait(lock, [] { return !GlobalJobSystem.isRunning || !GlobalJobSystem.queue.empty(); });
+			if (GlobalJobSystem.queue.empty())
+				return;
+			job = std::move(GlobalJobSystem.queue.front());
+			GlobalJobSystem.queue.pop_front();
+		}
+		job();
+	}
+}
+
+void InitJobSystem(u32 workerCount)
+{
+	ASSERT(GlobalJobSystem.workers.empty(), "The job system is already running");
+
+	if (workerCount == 0)
+	{
+		u32 hardwareThreads = std::thread::hardware_concurrency();
+		workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+	}
+
+	GlobalJobSystem.isRunning = true;
+	for (u32 i = 0; i < workerCount; ++i)
+	{
+		GlobalJobSystem.workers.emplace_back(WorkerLoop);
+	}
+}
+
+void ShutdownJobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(GlobalJobSystem.mutex);
+		GlobalJobSystem.isRunning = false;
+	}
+	GlobalJobSystem.wakeCondition.notify_all();
+
+	for (u32 i = 0; i < GlobalJobSystem.workers.size(); ++i)
+	{
+		GlobalJobSystem.workers[i].join();
+	}
+	GlobalJobSystem.workers.clear();
+}
+
+u32 GetJobWorkerCount()
+{
+	return (u32)GlobalJobSystem.workers.size();
+}
+
+void SubmitJob(std::function<void()> job)
+{
+	// Without workers (e.g. before InitJobSystem) the job just runs on the calling thread
+	if (GlobalJobSystem.workers.empty())
+	{
+		job();
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(GlobalJobSystem.mutex);
+		GlobalJobSystem.queue.push_back(std::move(job));
+	}
+	GlobalJobSystem.wakeCondition.notify_one();
+}
+
+static void RunParallelForBatch(ParallelForBatch& batch)
+{
+	for (u32 i = batch.nextIndex++; i < batch.count; i = batch.nextIndex++)
+	{
+		(*batch.job)(i);
+		if (++batch.doneCount == batch.count)
+		{
+			std::lock_guard<std::mutex> lock(batch.mutex);
+			batch.doneCondition.notify_all();
+		}
+	}
+}
+
+void ParallelFor(u32 count, const std::function<void(u32)>& job)
+{
+	if (count == 0)
+		return;
+
+	if (count == 1 || GlobalJobSystem.workers.empty())
+	{
+		for (u32 i = 0; i < count; ++i)
+			job(i);
+		return;
+	}
+
+	// Helpers that start after every index was taken find nothing to do, so the batch is
+	// shared with them instead of living on this stack frame.
+	std::shared_ptr<ParallelForBatch> batch = std::make_shared<ParallelForBatch>();
+	batch->nextIndex = 0;
+	batch->doneCount = 0;
+	batch->count = count;
+	batch->job = &job;
+
+	u32 helperCount = glm::min(count - 1, GetJobWorkerCount());
+	for (u32 i = 0; i < helperCount; ++i)
+	{
+		SubmitJob([batch] { RunParallelForBatch(*batch); });
+	}
+
+	// The calling thread works too, which also keeps nested ParallelFor calls from deadlocking
+	RunParallelForBatch(*batch);
+
+	std::unique_lock<std::mutex> lock(batch->mutex);
+	batch->doneCondition.wait(lock, [&batch] { return batch->doneCount == batch->count; });
+}
@@ -0,0 +1,31 @@
+//
+// job_system.h: A small pool of worker threads shared by the whole engine, used to spread
+// CPU-heavy work (asset import, decoding, cooking) across all the cores.
+//
+
+#pragma once
+
+#include "platform.h"
+
+#include <functional>
+
+/**
+ * Starts the worker threads. With workerCount = 0 it creates one worker per hardware thread
+ * minus one, because the calling thread also takes part in ParallelFor.
+ */
+void InitJobSystem(u32 workerCount = 0);
+
+void ShutdownJobSystem();
+
+u32 GetJobWorkerCount();
+
+/**
+ * Queues a job to be run on any worker thread and returns immediately.
+ */
+void SubmitJob(std::function<void()> job);
+
+/**
+ * Runs job(i) for every i in [0, count) across the workers and the calling thread, and
+ * blocks until all of them are done. It can be called from inside another job.
+ */
+void ParallelFor(u32 count, const std::function<void(u32)>& job);
@@ -0,0 +1,100 @@
+#include "material_table.h"
+
+typedef GLuint64 (APIENTRYP PFNGLGETTEXTURESAMPLERHANDLEARBPROC)(GLuint texture, GLuint sampler);
+typedef void     (APIENTRYP PFNGLMAKETEXTUREHANDLERESIDENTARBPROC)(GLuint64 handle);
+typedef void     (APIENTRYP PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC)(GLuint64 handle);
+
+static PFNGLGETTEXTURESAMPLERHANDLEARBPROC      glGetTextureSamplerHandleARB;
+static PFNGLMAKETEXTUREHANDLERESIDENTARBPROC    glMakeTextureHandleResidentARB;
+static PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC glMakeTextureHandleNonResidentARB;
+static bool bindlessTextureSupported;
+
+bool LoadBindlessTextureFunctions(GLADloadproc load)
+{
+	bindlessTextureSupported = false;
+
+	GLint extensionCount = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+	bool hasExtension = false;
+	for (GLint i = 0; i < extensionCount && !hasExtension; ++i)
+		hasExtension = strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), "GL_ARB_bindless_texture") == 0;
+	if (!hasExtension)
+		return false;
+
+	glGetTextureSamplerHandleARB = (PFNGLGETTEXTURESAMPLERHANDLEARBPROC)load("glGetTextureSamplerHandleARB");
+	glMakeTextureHandleResidentARB = (PFNGLMAKETEXTUREHANDLERESIDENTARBPROC)load("glMakeTextureHandleResidentARB");
+	glMakeTextureHandleNonResidentARB = (PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC)load("glMakeTextureHandleNonResidentARB");
+	bindlessTextureSupported = glGetTextureSamplerHandleARB && glMakeTextureHandleResidentARB && glMakeTextureHandleNonResidentARB;
+	return bindlessTextureSupported;
+}
+
+bool IsBindlessTextureSupported()
+{
+	return bindlessTextureSupported;
+}
+
+GLuint64 MakeTextureResident(GLuint texture, GLuint sampler)
+{
+	GLenum err;
+
+	if (!bindlessTextureSupported || texture == 0)
+		return 0;
+
+	const GLuint64 handle = glGetTextureSamplerHandleARB(texture, sampler);
+	if (handle != 0)
+		glMakeTextureHandleResidentARB(handle);
+	if ((err = glGetError()) != GL_NO_ERROR)
+		ELOG("OpenGL error %d making texture %u resident\n", err, texture);
+	return handle;
+}
+
+void MakeTextureNonResident(GLuint64 handle)
+{
+	if (bindlessTextureSupported && handle != 0)
+		glMakeTextureHandleNonResidentARB(handle);
+}
+
+static void AllocateMaterialTableBuffer(MaterialTable& table, u32 capacity)
+{
+	if (table.buffer == 0)
+		glGenBuffers(1, &table.buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, table.buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)capacity * sizeof(MaterialTableEntry), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	table.capacity = capacity;
+}
+
+void InitMaterialTable(MaterialTable& table)
+{
+	table.buffer = 0;
+	table.entries.clear();
+	AllocateMaterialTableBuffer(table, MATERIAL_TABLE_INITIAL_CAPACITY);
+}
+
+void DestroyMaterialTable(MaterialTable& table)
+{
+	glDeleteBuffers(1, &table.buffer);
+	table = MaterialTable{};
+}
+
+void UpdateMaterialTable(MaterialTable& table, const std::vector<MaterialTableEntry>& entries)
+{
+	GLenum err;
+
+	const bool changed = entries.size() != table.entries.size() ||
+		memcmp(entries.data(), table.entries.data(), entries.size() * sizeof(MaterialTableEntry)) != 0;
+	if (changed && !entries.empty())
+	{
+		if (entries.size() > table.capacity)
+			AllocateMaterialTableBuffer(table, glm::max(table.capacity * 2, (u32)entries.size()));
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, table.buffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, entries.size() * sizeof(MaterialTableEntry), entries.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		table.entries = entries;
+	}
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_TABLE_BINDING, table.buffer);
+	if ((err = glGetError()) != GL_NO_ERROR)
+		ELOG("OpenGL error %d updating the material table\n", err);
+}
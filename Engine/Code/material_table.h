@@ -0,0 +1,54 @@
+//
+// material_table.h: Bindless material maps (ARB_bindless_texture). Every material texture gets
+// a resident 64-bit handle and a shader storage buffer holds the handles of every material, so
+// drawing a submesh only sets its material index. The glad loader was generated without the
+// extension, its entry points are loaded here. Drivers without it keep the texture arrays of
+// texture_array.h.
+//
+
+#pragma once
+
+#include "geometry.h"
+#include "mesh_cache.h"
+
+#define MATERIAL_TABLE_BINDING          0  // Shader storage buffer binding of the MaterialTable block
+#define MATERIAL_TABLE_INITIAL_CAPACITY 64 // Materials
+
+// std430 layout of the MaterialMaps struct of the shaders, in the order of MaterialTextureSlot
+struct MaterialTableEntry
+{
+	GLuint64 maps[MaterialTexture_Count];
+};
+
+struct MaterialTable
+{
+	GLuint buffer;
+	u32    capacity;                        // Entries the buffer has room for
+	std::vector<MaterialTableEntry> entries; // What the buffer holds
+};
+
+/**
+ * Loads the ARB_bindless_texture entry points, after gladLoadGLLoader. Returns false if the
+ * driver does not expose the extension.
+ */
+bool LoadBindlessTextureFunctions(GLADloadproc load);
+
+bool IsBindlessTextureSupported();
+
+/**
+ * Handle of the texture sampled with the sampler object, made resident. The texture and the
+ * sampler can't be modified afterwards.
+ */
+GLuint64 MakeTextureResident(GLuint texture, GLuint sampler);
+
+void MakeTextureNonResident(GLuint64 handle);
+
+void InitMaterialTable(MaterialTable& table);
+
+void DestroyMaterialTable(MaterialTable& table);
+
+/**
+ * Uploads the entries if they differ from the ones in the buffer, growing it if needed, and
+ * binds it to MATERIAL_TABLE_BINDING.
+ */
+void UpdateMaterialTable(MaterialTable& table, const std::vector<MaterialTableEntry>& entries);
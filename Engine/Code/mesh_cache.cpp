@@ -0,0 +1,533 @@
+#include "engine.h"
+#include "mesh_cache.h"
+#include "asset_loader.h"
+
+struct MeshCacheHeader
+{
+	u32 magic;
+	u32 version;
+	u64 sourceTimestamp;
+	u32 importFlags;
+	u32 settingsKey;
+	u32 sourcePathLength;
+	u32 materialCount;
+	u32 submeshCount;
+	u32 nodeCount;
+	u32 drawCount;
+	u32 padding;
+	u64 vertexDataOffset;
+	u64 vertexDataSize;
+	u64 indexDataOffset;
+	u64 indexDataSize;
+};
+
+struct MeshCacheSubmesh
+{
+	u32       materialIndex;
+	u32       vertexDataSize; // In bytes
+	u32       indexCount;     // Every LOD
+	u32       indexType;
+	u32       attributeCount;
+	u32       stride;
+	u32       vertexFormat;
+	glm::vec3 positionScale;
+	glm::vec3 positionOffset;
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+	glm::vec3 boundsCenter;
+	f32       boundsRadius;
+	u32       lodCount;
+	u32       meshletCount;
+	u32       meshletVertexCount;
+	u32       meshletTriangleBytes;
+};
+
+struct MeshCacheReader
+{
+	const u8* cursor;
+	const u8* end;
+};
+
+static void WriteBytes(std::vector<u8>& blob, const void* data, u32 size)
+{
+	const u8* bytes = (const u8*)data;
+	blob.insert(blob.end(), bytes, bytes + size);
+}
+
+static void WriteString(std::vector<u8>& blob, const std::string& str)
+{
+	u32 len = (u32)str.size();
+	WriteBytes(blob, &len, sizeof(len));
+	WriteBytes(blob, str.data(), len);
+}
+
+static bool ReadBytes(MeshCacheReader& reader, void* data, u32 size)
+{
+	if ((u64)(reader.end - reader.cursor) < size)
+		return false;
+	memcpy(data, reader.cursor, size);
+	reader.cursor += size;
+	return true;
+}
+
+static bool ReadString(MeshCacheReader& reader, std::string& str)
+{
+	u32 len;
+	if (!ReadBytes(reader, &len, sizeof(len)) || (u64)(reader.end - reader.cursor) < len)
+		return false;
+	str.assign((const char*)reader.cursor, len);
+	reader.cursor += len;
+	return true;
+}
+
+static std::string GetCachePath(const char* filename)
+{
+	return std::string(filename) + MESH_CACHE_EXTENSION;
+}
+
+// The geometry blocks can be larger than 4 GB, unlike the geometry pool ranges
+static u64 AlignOffset(u64 value, u64 alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// LOD 0 first, then every LOD right after the finer ones, all inside the submesh indices
+static bool AreLodsValid(const Submesh& submesh, u32 totalIndexCount)
+{
+	u64 firstIndex = submesh.indexCount;
+	for (u32 i = 0; i < submesh.lods.size(); ++i)
+	{
+		const SubmeshLod& lod = submesh.lods[i];
+		if (lod.firstIndex != firstIndex || firstIndex + lod.indexCount > totalIndexCount)
+			return false;
+		firstIndex += lod.indexCount;
+	}
+	return true;
+}
+
+// Every meshlet list inside the submesh lists, and every index inside the vertices it points to
+static bool AreMeshletsValid(const Submesh& submesh)
+{
+	for (u32 i = 0; i < submesh.meshletVertices.size(); ++i)
+	{
+		if (submesh.meshletVertices[i] >= submesh.vertexCount)
+			return false;
+	}
+	for (u32 m = 0; m < submesh.meshlets.size(); ++m)
+	{
+		const Meshlet& meshlet = submesh.meshlets[m];
+		if ((u64)meshlet.vertexOffset + meshlet.vertexCount > submesh.meshletVertices.size() ||
+			(u64)meshlet.triangleOffset + (u64)meshlet.triangleCount * 3 > submesh.meshletTriangles.size())
+			return false;
+
+		const u8* triangles = submesh.meshletTriangles.data() + meshlet.triangleOffset;
+		for (u32 t = 0; t < meshlet.triangleCount * 3; ++t)
+		{
+			if (triangles[t] >= meshlet.vertexCount)
+				return false;
+		}
+	}
+	return true;
+}
+
+// Validates the key (version, import flags and settings, source path and timestamp) and leaves
+// the reader right after the source path
+static bool IsHeaderValid(const MeshCacheHeader& header, MeshCacheReader& reader, const char* filename, u32 importFlags, u32 settingsKey, u64 fileSize)
+{
+	bool valid = header.magic == MESH_CACHE_MAGIC &&
+		header.version == MESH_CACHE_VERSION &&
+		header.importFlags == importFlags &&
+		header.settingsKey == settingsKey &&
+		header.sourceTimestamp == GetFileLastWriteTimestamp(filename) &&
+		header.sourcePathLength == (u32)strlen(filename) &&
+		header.vertexDataSize <= fileSize && header.vertexDataOffset <= fileSize - header.vertexDataSize &&
+		header.indexDataSize <= fileSize && header.indexDataOffset <= fileSize - header.indexDataSize &&
+		(u64)(reader.end - reader.cursor) >= header.sourcePathLength;
+
+	if (valid)
+	{
+		valid = memcmp(reader.cursor, filename, header.sourcePathLength) == 0;
+		reader.cursor += header.sourcePathLength;
+	}
+
+	return valid;
+}
+
+u32 GetDefaultMaterialTexture(App* app, u32 slot)
+{
+	switch (slot)
+	{
+	case MaterialTexture_Albedo:  return app->whiteTexIdx;
+	case MaterialTexture_Normals: return app->defaultNormalTexIdx;
+	default:                      return app->blackTexIdx;
+	}
+}
+
+TextureUsage GetMaterialTextureUsage(u32 slot)
+{
+	switch (slot)
+	{
+	case MaterialTexture_Albedo:  return TextureUsage_Albedo;
+	case MaterialTexture_Normals: return TextureUsage_Normal;
+	default:                      return TextureUsage_ORM;
+	}
+}
+
+u32& GetMaterialTexture(Material& material, u32 slot)
+{
+	switch (slot)
+	{
+	case MaterialTexture_Albedo: return material.albedoTextureIdx;
+	case MaterialTexture_ORM:    return material.ormTextureIdx;
+	default:                     return material.normalsTextureIdx;
+	}
+}
+
+void LoadCachedMaterial(App* app, const CachedMaterial& cachedMaterial, Material& material, String directory)
+{
+	material.name = cachedMaterial.name;
+	material.albedo = cachedMaterial.albedo;
+	material.emissive = cachedMaterial.emissive;
+	for (u32 slot = 0; slot < MaterialTexture_Count; ++slot)
+	{
+		GetMaterialTexture(material, slot) = GetDefaultMaterialTexture(app, slot);
+
+		const std::string& textureFilename = cachedMaterial.textureFilenames[slot];
+		if (textureFilename.empty())
+			continue;
+
+		String filepath = MakePath(directory, MakeString(textureFilename.c_str()));
+		const u32 textureIdx = LoadTexture2D(app, filepath.str, GetMaterialTextureUsage(slot));
+		if (textureIdx != UINT32_MAX)
+			GetMaterialTexture(material, slot) = textureIdx;
+	}
+}
+
+bool IsModelCacheValid(const char* filename, u32 importFlags, u32 settingsKey)
+{
+	std::string cachePath = GetCachePath(filename);
+	MappedFile file = MapFile(cachePath.c_str());
+	if (!file.data)
+		return false;
+
+	const u8* base = (const u8*)file.data;
+	MeshCacheReader reader = { base, base + file.size };
+
+	MeshCacheHeader header;
+	bool valid = ReadBytes(reader, &header, sizeof(header)) &&
+		IsHeaderValid(header, reader, filename, importFlags, settingsKey, file.size);
+
+	UnmapFile(file);
+	return valid;
+}
+
+bool LoadModelFromCache(App* app, const char* filename, u32 importFlags, u32 settingsKey, bool keepGeometryResident, bool streamTextures, u32* modelIdx)
+{
+	std::string cachePath = GetCachePath(filename);
+	MappedFile file = MapFile(cachePath.c_str());
+	if (!file.data)
+		return false;
+
+	const u8* base = (const u8*)file.data;
+	MeshCacheReader reader = { base, base + file.size };
+
+	MeshCacheHeader header;
+	bool valid = ReadBytes(reader, &header, sizeof(header)) &&
+		IsHeaderValid(header, reader, filename, importFlags, settingsKey, file.size);
+
+	std::vector<CachedMaterial> materials(valid ? header.materialCount : 0);
+	for (u32 i = 0; valid && i < header.materialCount; ++i)
+	{
+		CachedMaterial& material = materials[i];
+		valid = ReadString(reader, material.name) &&
+			ReadBytes(reader, &material.albedo, sizeof(material.albedo)) &&
+			ReadBytes(reader, &material.emissive, sizeof(material.emissive));
+		for (u32 slot = 0; valid && slot < MaterialTexture_Count; ++slot)
+		{
+			valid = ReadString(reader, material.textureFilenames[slot]);
+		}
+	}
+
+	u64 vertexDataSize = 0;
+	u64 indexDataSize = 0;
+	std::vector<MeshCacheSubmesh> cachedSubmeshes(valid ? header.submeshCount : 0);
+	std::vector<Submesh> submeshes(valid ? header.submeshCount : 0);
+	for (u32 i = 0; valid && i < header.submeshCount; ++i)
+	{
+		MeshCacheSubmesh& cachedSubmesh = cachedSubmeshes[i];
+		valid = ReadBytes(reader, &cachedSubmesh, sizeof(cachedSubmesh)) && cachedSubmesh.materialIndex < header.materialCount;
+		for (u32 j = 0; valid && j < cachedSubmesh.attributeCount; ++j)
+		{
+			VertexBufferAttribute attribute;
+			valid = ReadBytes(reader, &attribute.location, sizeof(attribute.location)) &&
+				ReadBytes(reader, &attribute.componentCount, sizeof(attribute.componentCount)) &&
+				ReadBytes(reader, &attribute.offset, sizeof(attribute.offset)) &&
+				ReadBytes(reader, &attribute.type, sizeof(attribute.type)) &&
+				ReadBytes(reader, &attribute.normalized, sizeof(attribute.normalized));
+			submeshes[i].vertexBufferLayout.attributes.push_back(attribute);
+		}
+
+		// LOD 0 is what the LODs leave of the index count
+		u64 lodIndexCount = 0;
+		valid = valid && (u64)cachedSubmesh.lodCount * sizeof(SubmeshLod) <= (u64)(reader.end - reader.cursor);
+		submeshes[i].lods.resize(valid ? cachedSubmesh.lodCount : 0);
+		for (u32 j = 0; valid && j < cachedSubmesh.lodCount; ++j)
+		{
+			valid = ReadBytes(reader, &submeshes[i].lods[j], sizeof(SubmeshLod));
+			lodIndexCount += submeshes[i].lods[j].indexCount;
+		}
+		valid = valid && lodIndexCount <= cachedSubmesh.indexCount;
+
+		const u64 meshletBytes = (u64)cachedSubmesh.meshletCount * sizeof(Meshlet) + (u64)cachedSubmesh.meshletVertexCount * sizeof(u32) + cachedSubmesh.meshletTriangleBytes;
+		valid = valid && meshletBytes <= (u64)(reader.end - reader.cursor);
+		if (valid)
+		{
+			submeshes[i].meshlets.resize(cachedSubmesh.meshletCount);
+			submeshes[i].meshletVertices.resize(cachedSubmesh.meshletVertexCount);
+			submeshes[i].meshletTriangles.resize(cachedSubmesh.meshletTriangleBytes);
+			valid = ReadBytes(reader, submeshes[i].meshlets.data(), cachedSubmesh.meshletCount * sizeof(Meshlet)) &&
+				ReadBytes(reader, submeshes[i].meshletVertices.data(), cachedSubmesh.meshletVertexCount * sizeof(u32)) &&
+				ReadBytes(reader, submeshes[i].meshletTriangles.data(), cachedSubmesh.meshletTriangleBytes);
+		}
+		submeshes[i].vertexBufferLayout.stride = (u8)cachedSubmesh.stride;
+		submeshes[i].vertexFormat = cachedSubmesh.vertexFormat;
+		submeshes[i].positionScale = cachedSubmesh.positionScale;
+		submeshes[i].positionOffset = cachedSubmesh.positionOffset;
+		submeshes[i].vertexCount = cachedSubmesh.stride > 0 ? cachedSubmesh.vertexDataSize / cachedSubmesh.stride : 0;
+		submeshes[i].indexCount = valid ? cachedSubmesh.indexCount - (u32)lodIndexCount : 0;
+		submeshes[i].boundsMin = cachedSubmesh.boundsMin;
+		submeshes[i].boundsMax = cachedSubmesh.boundsMax;
+		submeshes[i].boundsCenter = cachedSubmesh.boundsCenter;
+		submeshes[i].boundsRadius = cachedSubmesh.boundsRadius;
+		submeshes[i].indexType = cachedSubmesh.indexType;
+		valid = valid && (cachedSubmesh.indexType == GL_UNSIGNED_SHORT || cachedSubmesh.indexType == GL_UNSIGNED_INT) &&
+			cachedSubmesh.stride > 0 && cachedSubmesh.stride <= UINT8_MAX && cachedSubmesh.vertexDataSize % cachedSubmesh.stride == 0 &&
+			AreLodsValid(submeshes[i], cachedSubmesh.indexCount) &&
+			AreMeshletsValid(submeshes[i]);
+		vertexDataSize += cachedSubmesh.vertexDataSize;
+		indexDataSize = AlignOffset(indexDataSize, GetIndexSize(cachedSubmesh.indexType));
+		indexDataSize += (u64)cachedSubmesh.indexCount * GetIndexSize(cachedSubmesh.indexType);
+	}
+	valid = valid && vertexDataSize == header.vertexDataSize && indexDataSize == header.indexDataSize;
+
+	// Node tree, parents first, and the draws that reference it
+	std::vector<ModelNode> nodes(valid ? header.nodeCount : 0);
+	for (u32 i = 0; valid && i < header.nodeCount; ++i)
+	{
+		valid = ReadBytes(reader, &nodes[i].localTransform, sizeof(nodes[i].localTransform)) &&
+			ReadBytes(reader, &nodes[i].parent, sizeof(nodes[i].parent)) &&
+			(nodes[i].parent == UINT32_MAX || nodes[i].parent < i);
+	}
+	std::vector<ModelDraw> draws(valid ? header.drawCount : 0);
+	for (u32 i = 0; valid && i < header.drawCount; ++i)
+	{
+		valid = ReadBytes(reader, &draws[i], sizeof(draws[i])) &&
+			draws[i].submeshIdx < header.submeshCount && draws[i].nodeIdx < header.nodeCount;
+	}
+
+	if (!valid)
+	{
+		ILOG("Mesh cache %s is stale or corrupt, importing %s again", cachePath.c_str(), filename);
+		UnmapFile(file);
+		return false;
+	}
+
+	// Materials
+	String directory = GetDirectoryPart(MakeString(filename));
+	u32 baseMaterialIdx = (u32)app->materials.size();
+	for (u32 i = 0; i < header.materialCount; ++i)
+	{
+		const CachedMaterial& cachedMaterial = materials[i];
+		if (streamTextures)
+		{
+			CreateMaterialAsync(app, cachedMaterial, directory);
+			continue;
+		}
+
+		Material material = {};
+		LoadCachedMaterial(app, cachedMaterial, material, directory);
+		app->materials.push_back(material);
+	}
+
+	app->meshes.push_back(Mesh{});
+	Mesh& mesh = app->meshes.back();
+	u32 meshIdx = (u32)app->meshes.size() - 1u;
+
+	app->models.push_back(Model{});
+	Model& model = app->models.back();
+	model.meshIdx = meshIdx;
+	model.nodes.swap(nodes);
+	model.draws.swap(draws);
+	UpdateModelNodeTransforms(model);
+
+	// Submeshes are stored back to back (indices aligned to their size), so their data can be
+	// found again and uploaded to the geometry pool straight from the mapped file
+	const u8* vertexData = base + header.vertexDataOffset;
+	const u8* indexData = base + header.indexDataOffset;
+	u64 verticesOffset = 0;
+	u64 indicesOffset = 0;
+	for (u32 i = 0; i < header.submeshCount; ++i)
+	{
+		const MeshCacheSubmesh& cachedSubmesh = cachedSubmeshes[i];
+		Submesh& submesh = submeshes[i];
+
+		indicesOffset = AlignOffset(indicesOffset, GetIndexSize(submesh.indexType));
+		const u64 indicesSize = (u64)GetSubmeshIndexCount(submesh) * GetIndexSize(submesh.indexType);
+
+		const u8* vertices = vertexData + verticesOffset;
+		const u8* indices = indexData + indicesOffset;
+		UploadSubmeshGeometry(app->geometryPool, submesh, vertices, indices);
+		if (keepGeometryResident)
+		{
+			submesh.vertices.assign(vertices, vertices + cachedSubmesh.vertexDataSize);
+			submesh.indices.assign(indices, indices + indicesSize);
+		}
+		verticesOffset += cachedSubmesh.vertexDataSize;
+		indicesOffset += indicesSize;
+
+		model.materialIdx.push_back(baseMaterialIdx + cachedSubmesh.materialIndex);
+		mesh.vertexBufferSize += cachedSubmesh.vertexDataSize;
+		mesh.indexBufferSize += (u32)indicesSize;
+		mesh.clusterBufferSize += submesh.clusterSize;
+
+		// The meshlet bounds stay for culling, their vertex and triangle lists are on the GPU now
+		if (!keepGeometryResident)
+		{
+			std::vector<u32>().swap(submesh.meshletVertices);
+			std::vector<u8>().swap(submesh.meshletTriangles);
+		}
+	}
+	mesh.submeshes.swap(submeshes);
+	mesh.keepGeometryResident = keepGeometryResident;
+	UpdateMeshBounds(mesh);
+	UpdateModelBounds(model, mesh);
+
+	UnmapFile(file);
+
+	*modelIdx = (u32)app->models.size() - 1u;
+	return true;
+}
+
+void SaveModelToCache(const char* filename, u32 importFlags, u32 settingsKey, const Mesh& mesh, const Model& model, u32 baseMaterialIdx, const std::vector<CachedMaterial>& materials)
+{
+	std::vector<u8> blob;
+
+	MeshCacheHeader header = {};
+	header.magic = MESH_CACHE_MAGIC;
+	header.version = MESH_CACHE_VERSION;
+	header.sourceTimestamp = GetFileLastWriteTimestamp(filename);
+	header.importFlags = importFlags;
+	header.settingsKey = settingsKey;
+	header.sourcePathLength = (u32)strlen(filename);
+	header.materialCount = (u32)materials.size();
+	header.submeshCount = (u32)mesh.submeshes.size();
+	header.nodeCount = (u32)model.nodes.size();
+	header.drawCount = (u32)model.draws.size();
+	WriteBytes(blob, &header, sizeof(header));
+	WriteBytes(blob, filename, header.sourcePathLength);
+
+	for (u32 i = 0; i < materials.size(); ++i)
+	{
+		const CachedMaterial& material = materials[i];
+		WriteString(blob, material.name);
+		WriteBytes(blob, &material.albedo, sizeof(material.albedo));
+		WriteBytes(blob, &material.emissive, sizeof(material.emissive));
+		for (u32 slot = 0; slot < MaterialTexture_Count; ++slot)
+		{
+			WriteString(blob, material.textureFilenames[slot]);
+		}
+	}
+
+	for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+	{
+		const Submesh& submesh = mesh.submeshes[i];
+
+		MeshCacheSubmesh cachedSubmesh = {};
+		cachedSubmesh.materialIndex = model.materialIdx[i] - baseMaterialIdx;
+		cachedSubmesh.vertexDataSize = (u32)submesh.vertices.size();
+		cachedSubmesh.indexCount = GetSubmeshIndexCount(submesh);
+		cachedSubmesh.indexType = submesh.indexType;
+		cachedSubmesh.attributeCount = (u32)submesh.vertexBufferLayout.attributes.size();
+		cachedSubmesh.stride = submesh.vertexBufferLayout.stride;
+		cachedSubmesh.vertexFormat = submesh.vertexFormat;
+		cachedSubmesh.positionScale = submesh.positionScale;
+		cachedSubmesh.positionOffset = submesh.positionOffset;
+		cachedSubmesh.boundsMin = submesh.boundsMin;
+		cachedSubmesh.boundsMax = submesh.boundsMax;
+		cachedSubmesh.boundsCenter = submesh.boundsCenter;
+		cachedSubmesh.boundsRadius = submesh.boundsRadius;
+		cachedSubmesh.lodCount = (u32)submesh.lods.size();
+		cachedSubmesh.meshletCount = (u32)submesh.meshlets.size();
+		cachedSubmesh.meshletVertexCount = (u32)submesh.meshletVertices.size();
+		cachedSubmesh.meshletTriangleBytes = (u32)submesh.meshletTriangles.size();
+		WriteBytes(blob, &cachedSubmesh, sizeof(cachedSubmesh));
+
+		for (u32 j = 0; j < submesh.vertexBufferLayout.attributes.size(); ++j)
+		{
+			const VertexBufferAttribute& attribute = submesh.vertexBufferLayout.attributes[j];
+			WriteBytes(blob, &attribute.location, sizeof(attribute.location));
+			WriteBytes(blob, &attribute.componentCount, sizeof(attribute.componentCount));
+			WriteBytes(blob, &attribute.offset, sizeof(attribute.offset));
+			WriteBytes(blob, &attribute.type, sizeof(attribute.type));
+			WriteBytes(blob, &attribute.normalized, sizeof(attribute.normalized));
+		}
+		WriteBytes(blob, submesh.lods.data(), (u32)(submesh.lods.size() * sizeof(SubmeshLod)));
+		WriteBytes(blob, submesh.meshlets.data(), (u32)(submesh.meshlets.size() * sizeof(Meshlet)));
+		WriteBytes(blob, submesh.meshletVertices.data(), (u32)(submesh.meshletVertices.size() * sizeof(u32)));
+		WriteBytes(blob, submesh.meshletTriangles.data(), (u32)submesh.meshletTriangles.size());
+
+		header.vertexDataSize += submesh.vertices.size();
+		header.indexDataSize = AlignOffset(header.indexDataSize, GetIndexSize(submesh.indexType));
+		header.indexDataSize += submesh.indices.size();
+	}
+
+	for (u32 i = 0; i < model.nodes.size(); ++i)
+	{
+		WriteBytes(blob, &model.nodes[i].localTransform, sizeof(model.nodes[i].localTransform));
+		WriteBytes(blob, &model.nodes[i].parent, sizeof(model.nodes[i].parent));
+	}
+	WriteBytes(blob, model.draws.data(), (u32)(model.draws.size() * sizeof(ModelDraw)));
+
+	// The geometry goes after the metadata, aligned so it can be read in place once mapped
+	header.vertexDataOffset = AlignOffset(blob.size(), 16);
+	header.indexDataOffset = header.vertexDataOffset + header.vertexDataSize;
+	blob.resize(header.vertexDataOffset, 0);
+	memcpy(blob.data(), &header, sizeof(header));
+
+	// Written aside and renamed into place: a partial file would have a valid header
+	const std::string cachePath = GetCachePath(filename);
+	const std::string tempPath = GetTempFilePath(cachePath.c_str());
+	FILE* file = fopen(tempPath.c_str(), "wb");
+	if (!file)
+	{
+		ELOG("fopen() failed writing mesh cache %s", cachePath.c_str());
+		return;
+	}
+
+	bool written = fwrite(blob.data(), 1, blob.size(), file) == blob.size();
+	for (u32 i = 0; i < mesh.submeshes.size() && written; ++i)
+	{
+		const Submesh& submesh = mesh.submeshes[i];
+		written = fwrite(submesh.vertices.data(), 1, submesh.vertices.size(), file) == submesh.vertices.size();
+	}
+	u64 indicesOffset = 0;
+	for (u32 i = 0; i < mesh.submeshes.size() && written; ++i)
+	{
+		// Same padding as the index buffer, so the block can be uploaded as is
+		const Submesh& submesh = mesh.submeshes[i];
+		const u64 padding = AlignOffset(indicesOffset, GetIndexSize(submesh.indexType)) - indicesOffset;
+		const u8 zeros[4] = {};
+		written = fwrite(zeros, 1, padding, file) == padding &&
+			fwrite(submesh.indices.data(), 1, submesh.indices.size(), file) == submesh.indices.size();
+		indicesOffset += padding + submesh.indices.size();
+	}
+
+	written = fclose(file) == 0 && written;
+	if (!written)
+	{
+		ELOG("fwrite() failed writing mesh cache %s", cachePath.c_str());
+		remove(tempPath.c_str());
+		return;
+	}
+	RenameFileOver(tempPath.c_str(), cachePath.c_str());
+}
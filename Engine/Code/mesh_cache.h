@@ -0,0 +1,71 @@
+//
+// mesh_cache.h: Binary cache of cooked models. It stores the final interleaved vertex data,
+// the indices, the meshlets, the vertex layouts, the node tree and the material table, so warm starts never touch Assimp.
+//
+
+#pragma once
+
+#include "platform.h"
+#include "texture_cooker.h"
+
+struct App;
+struct Mesh;
+struct Model;
+struct Material;
+
+#define MESH_CACHE_MAGIC     0x4853454D // "MESH"
+#define MESH_CACHE_VERSION   8
+#define MESH_CACHE_EXTENSION ".meshcache"
+
+enum MaterialTextureSlot
+{
+	MaterialTexture_Albedo,
+	MaterialTexture_ORM,     // Occlusion, roughness and metallic packed in red, green and blue, see orm_packer.h
+	MaterialTexture_Normals,
+	MaterialTexture_Count
+};
+
+struct CachedMaterial
+{
+	std::string name;
+	glm::vec3   albedo;
+	glm::vec3   emissive;
+	std::string textureFilenames[MaterialTexture_Count]; // Relative to the model directory, empty if unused
+};
+
+/**
+ * Texture used by a material slot without a map: white albedo, flat normals, black otherwise.
+ */
+u32 GetDefaultMaterialTexture(App* app, u32 slot);
+
+/**
+ * How the map of a material slot is cooked: albedo, normals, or the packed ORM channels.
+ */
+TextureUsage GetMaterialTextureUsage(u32 slot);
+
+u32& GetMaterialTexture(Material& material, u32 slot);
+
+/**
+ * Fills the material from its cached description and loads its maps right away, on the calling
+ * thread. The maps that can't be read keep the default texture of their slot. The runtime loads
+ * go through CreateMaterialAsync instead.
+ */
+void LoadCachedMaterial(App* app, const CachedMaterial& cachedMaterial, Material& material, String directory);
+
+/**
+ * Cheap check (header only) of whether LoadModelFromCache would find a valid cache.
+ * It does no GL calls, so it can be used to plan work before going wide.
+ */
+bool IsModelCacheValid(const char* filename, u32 importFlags, u32 settingsKey);
+
+/**
+ * Loads the model from its cache file if the cache exists and was cooked from the same
+ * source file (same path and last write timestamp) with the same import flags and settings.
+ * The geometry is uploaded straight from the mapped file, and only copied to the submeshes
+ * if keepGeometryResident is set. With streamTextures the materials start with the default
+ * textures and load their maps in the background. Returns false if the model has to be
+ * imported again.
+ */
+bool LoadModelFromCache(App* app, const char* filename, u32 importFlags, u32 settingsKey, bool keepGeometryResident, bool streamTextures, u32* modelIdx);
+
+void SaveModelToCache(const char* filename, u32 importFlags, u32 settingsKey, const Mesh& mesh, const Model& model, u32 baseMaterialIdx, const std::vector<CachedMaterial>& materials);
@@ -0,0 +1,409 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <chrono>
+
+static f64 SecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+}
+
+// FNV-1a over the vertex bytes
+static u32 HashVertex(const u8* vertex, u32 stride)
+{
+	u32 hash = 2166136261u;
+	for (u32 i = 0; i < stride; ++i)
+	{
+		hash = (hash ^ vertex[i]) * 16777619u;
+	}
+	return hash;
+}
+
+u32 WeldVertices(std::vector<u8>& vertices, u32 stride, std::vector<u32>& indices)
+{
+	const u32 vertexCount = (u32)(vertices.size() / stride);
+
+	// Open addressing table of unique vertex indices, at most half full
+	u32 tableSize = 1;
+	while (tableSize < vertexCount * 2)
+		tableSize *= 2;
+	std::vector<u32> table(tableSize, UINT32_MAX);
+
+	std::vector<u32> remap(vertexCount);
+	std::vector<u8> welded;
+	welded.reserve(vertices.size());
+	u32 weldedCount = 0;
+	for (u32 i = 0; i < vertexCount; ++i)
+	{
+		const u8* vertex = vertices.data() + (size_t)i * stride;
+		u32 slot = HashVertex(vertex, stride) & (tableSize - 1);
+		while (table[slot] != UINT32_MAX && memcmp(welded.data() + (size_t)table[slot] * stride, vertex, stride) != 0)
+			slot = (slot + 1) & (tableSize - 1);
+
+		if (table[slot] == UINT32_MAX)
+		{
+			table[slot] = weldedCount++;
+			welded.insert(welded.end(), vertex, vertex + stride);
+		}
+		remap[i] = table[slot];
+	}
+
+	for (u32 i = 0; i < indices.size(); ++i)
+	{
+		indices[i] = remap[indices[i]];
+	}
+	vertices.swap(welded);
+	return weldedCount;
+}
+
+static f32 ForsythVertexScore(i32 cachePosition, u32 liveTriangles)
+{
+	if (liveTriangles == 0)
+		return -1.0f;
+
+	f32 score = 0.0f;
+	if (cachePosition >= 0)
+	{
+		// The last triangle's vertices get a fixed score, so the next triangle doesn't just reuse them
+		if (cachePosition < 3)
+			score = 0.75f;
+		else
+			score = powf(1.0f - (f32)(cachePosition - 3) / (MESH_OPTIMIZER_CACHE_SIZE - 3), 1.5f);
+	}
+
+	// Vertices with few triangles left go first, so they don't linger as lone triangles
+	score += 2.0f / sqrtf((f32)liveTriangles);
+	return score;
+}
+
+void OptimizeVertexCache(std::vector<u32>& indices, u32 vertexCount)
+{
+	const u32 triangleCount = (u32)(indices.size() / 3);
+	if (triangleCount == 0)
+		return;
+
+	// Triangles of every vertex; emitted triangles are swapped out of the first liveTriangles
+	std::vector<u32> liveTriangles(vertexCount, 0);
+	for (u32 i = 0; i < triangleCount * 3; ++i)
+		++liveTriangles[indices[i]];
+
+	std::vector<u32> adjacencyOffsets(vertexCount + 1, 0);
+	for (u32 v = 0; v < vertexCount; ++v)
+		adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+
+	std::vector<u32> adjacency(triangleCount * 3);
+	std::vector<u32> adjacencyFill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (u32 t = 0; t < triangleCount; ++t)
+	{
+		for (u32 k = 0; k < 3; ++k)
+		{
+			const u32 v = indices[t * 3 + k];
+			adjacency[adjacencyFill[v]++] = t;
+		}
+	}
+
+	std::vector<i32> cachePositions(vertexCount, -1);
+	std::vector<f32> vertexScores(vertexCount);
+	for (u32 v = 0; v < vertexCount; ++v)
+		vertexScores[v] = ForsythVertexScore(-1, liveTriangles[v]);
+
+	std::vector<f32> triangleScores(triangleCount);
+	std::vector<bool> emitted(triangleCount, false);
+	u32 bestTriangle = 0;
+	for (u32 t = 0; t < triangleCount; ++t)
+	{
+		triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+		if (triangleScores[t] > triangleScores[bestTriangle])
+			bestTriangle = t;
+	}
+
+	std::vector<u32> output;
+	output.reserve(indices.size());
+	std::vector<u32> cache;
+	std::vector<u32> newCache;
+	cache.reserve(MESH_OPTIMIZER_CACHE_SIZE + 3);
+	newCache.reserve(MESH_OPTIMIZER_CACHE_SIZE + 3);
+	u32 scanCursor = 0;
+
+	for (u32 emittedCount = 0; emittedCount < triangleCount; ++emittedCount)
+	{
+		// Nothing in the cache has triangles left: restart from the first triangle not emitted yet
+		if (bestTriangle == UINT32_MAX)
+		{
+			while (emitted[scanCursor])
+				++scanCursor;
+			bestTriangle = scanCursor;
+		}
+
+		const u32* triangle = &indices[bestTriangle * 3];
+		output.insert(output.end(), triangle, triangle + 3);
+		emitted[bestTriangle] = true;
+
+		newCache.assign(triangle, triangle + 3);
+		for (u32 k = 0; k < 3; ++k)
+		{
+			const u32 v = triangle[k];
+			u32* vertexTriangles = &adjacency[adjacencyOffsets[v]];
+			for (u32 i = 0; i < liveTriangles[v]; ++i)
+			{
+				if (vertexTriangles[i] == bestTriangle)
+				{
+					vertexTriangles[i] = vertexTriangles[liveTriangles[v] - 1];
+					--liveTriangles[v];
+					break;
+				}
+			}
+		}
+		for (u32 i = 0; i < cache.size(); ++i)
+		{
+			if (cache[i] != triangle[0] && cache[i] != triangle[1] && cache[i] != triangle[2])
+				newCache.push_back(cache[i]);
+		}
+
+		// Rescore every vertex that moved in or out of the cache and the triangles around them
+		bestTriangle = UINT32_MAX;
+		f32 bestScore = -FLT_MAX;
+		for (u32 i = 0; i < newCache.size(); ++i)
+		{
+			const u32 v = newCache[i];
+			cachePositions[v] = i < MESH_OPTIMIZER_CACHE_SIZE ? (i32)i : -1;
+			const f32 score = ForsythVertexScore(cachePositions[v], liveTriangles[v]);
+			const f32 delta = score - vertexScores[v];
+			vertexScores[v] = score;
+
+			const u32* vertexTriangles = &adjacency[adjacencyOffsets[v]];
+			for (u32 j = 0; j < liveTriangles[v]; ++j)
+			{
+				const u32 t = vertexTriangles[j];
+				triangleScores[t] += delta;
+				if (triangleScores[t] > bestScore)
+				{
+					bestScore = triangleScores[t];
+					bestTriangle = t;
+				}
+			}
+		}
+
+		if (newCache.size() > MESH_OPTIMIZER_CACHE_SIZE)
+			newCache.resize(MESH_OPTIMIZER_CACHE_SIZE);
+		cache.swap(newCache);
+	}
+
+	indices.swap(output);
+}
+
+void AnalyzeVertexCache(const std::vector<u32>& indices, u32 vertexCount, u32 cacheSize, f32* acmr, f32* atvr)
+{
+	// Timestamp of the miss that brought each vertex in, the FIFO holds the last cacheSize misses
+	std::vector<u32> cacheTimestamps(vertexCount, 0);
+	u32 timestamp = cacheSize + 1;
+	u32 misses = 0;
+	u32 usedVertices = 0;
+	for (u32 i = 0; i < indices.size(); ++i)
+	{
+		const u32 v = indices[i];
+		if (cacheTimestamps[v] == 0)
+			++usedVertices;
+		if (timestamp - cacheTimestamps[v] > cacheSize)
+		{
+			cacheTimestamps[v] = timestamp++;
+			++misses;
+		}
+	}
+
+	const u32 triangleCount = (u32)(indices.size() / 3);
+	*acmr = triangleCount > 0 ? (f32)misses / triangleCount : 0.0f;
+	*atvr = usedVertices > 0 ? (f32)misses / usedVertices : 0.0f;
+}
+
+struct OverdrawCluster
+{
+	u32 firstTriangle;
+	u32 triangleCount;
+	f32 sortKey;
+};
+
+void OptimizeOverdraw(std::vector<u32>& indices, const std::vector<vec3>& positions, f32 threshold)
+{
+	const u32 triangleCount = (u32)(indices.size() / 3);
+	const u32 vertexCount = (u32)positions.size();
+	if (triangleCount < 2)
+		return;
+
+	f32 acmrBefore, atvr;
+	AnalyzeVertexCache(indices, vertexCount, MESH_OPTIMIZER_FIFO_CACHE_SIZE, &acmrBefore, &atvr);
+
+	// Hard boundaries where a triangle misses all its vertices (the cache starts over anyway),
+	// soft ones where the cluster so far already runs at the mesh ACMR or better
+	std::vector<OverdrawCluster> clusters;
+	std::vector<u32> cacheTimestamps(vertexCount, 0);
+	u32 timestamp = MESH_OPTIMIZER_FIFO_CACHE_SIZE + 1;
+	u32 clusterMisses = 0;
+	for (u32 t = 0; t < triangleCount; ++t)
+	{
+		u32 misses = 0;
+		for (u32 k = 0; k < 3; ++k)
+		{
+			const u32 v = indices[t * 3 + k];
+			if (timestamp - cacheTimestamps[v] > MESH_OPTIMIZER_FIFO_CACHE_SIZE)
+			{
+				cacheTimestamps[v] = timestamp++;
+				++misses;
+			}
+		}
+
+		const bool hardBoundary = misses == 3;
+		const bool softBoundary = !clusters.empty() && clusters.back().triangleCount > 0 &&
+			(f32)clusterMisses / clusters.back().triangleCount <= acmrBefore;
+		if (clusters.empty() || hardBoundary || softBoundary)
+		{
+			clusters.push_back(OverdrawCluster{ t, 0, 0.0f });
+			clusterMisses = 0;
+		}
+		++clusters.back().triangleCount;
+		clusterMisses += misses;
+	}
+
+	if (clusters.size() < 2)
+		return;
+
+	// Area weighted centroids and normals
+	vec3 meshCentroid = vec3(0.0f);
+	f32 meshArea = 0.0f;
+	std::vector<vec3> clusterCentroids(clusters.size(), vec3(0.0f));
+	std::vector<vec3> clusterNormals(clusters.size(), vec3(0.0f));
+	for (u32 c = 0; c < clusters.size(); ++c)
+	{
+		f32 clusterArea = 0.0f;
+		for (u32 t = clusters[c].firstTriangle; t < clusters[c].firstTriangle + clusters[c].triangleCount; ++t)
+		{
+			const vec3& p0 = positions[indices[t * 3]];
+			const vec3& p1 = positions[indices[t * 3 + 1]];
+			const vec3& p2 = positions[indices[t * 3 + 2]];
+			const vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			const f32 area = glm::length(normal);
+			const vec3 centroid = (p0 + p1 + p2) / 3.0f;
+
+			clusterCentroids[c] += centroid * area;
+			clusterNormals[c] += normal;
+			clusterArea += area;
+			meshCentroid += centroid * area;
+			meshArea += area;
+		}
+		if (clusterArea > 0.0f)
+			clusterCentroids[c] /= clusterArea;
+	}
+	if (meshArea > 0.0f)
+		meshCentroid /= meshArea;
+
+	for (u32 c = 0; c < clusters.size(); ++c)
+	{
+		const f32 normalLength = glm::length(clusterNormals[c]);
+		clusters[c].sortKey = normalLength > 0.0f ? glm::dot(clusterCentroids[c] - meshCentroid, clusterNormals[c] / normalLength) : 0.0f;
+	}
+
+	std::stable_sort(clusters.begin(), clusters.end(), [](const OverdrawCluster& a, const OverdrawCluster& b) {
+		return a.sortKey > b.sortKey;
+	});
+
+	std::vector<u32> output;
+	output.reserve(indices.size());
+	for (u32 c = 0; c < clusters.size(); ++c)
+	{
+		const u32* first = &indices[clusters[c].firstTriangle * 3];
+		output.insert(output.end(), first, first + clusters[c].triangleCount * 3);
+	}
+
+	// Keep the cache order if sorting the clusters costs more than the threshold allows
+	f32 acmrAfter;
+	AnalyzeVertexCache(output, vertexCount, MESH_OPTIMIZER_FIFO_CACHE_SIZE, &acmrAfter, &atvr);
+	if (acmrAfter <= acmrBefore * threshold)
+		indices.swap(output);
+}
+
+u32 OptimizeVertexFetch(std::vector<u8>& vertices, u32 stride, std::vector<u32>& indices)
+{
+	const u32 vertexCount = (u32)(vertices.size() / stride);
+	std::vector<u32> remap(vertexCount, UINT32_MAX);
+	std::vector<u8> reordered;
+	reordered.reserve(vertices.size());
+
+	u32 reorderedCount = 0;
+	for (u32 i = 0; i < indices.size(); ++i)
+	{
+		u32& index = indices[i];
+		if (remap[index] == UINT32_MAX)
+		{
+			const u8* vertex = vertices.data() + (size_t)index * stride;
+			reordered.insert(reordered.end(), vertex, vertex + stride);
+			remap[index] = reorderedCount++;
+		}
+		index = remap[index];
+	}
+
+	vertices.swap(reordered);
+	return reorderedCount;
+}
+
+std::vector<vec3> ReadSubmeshPositions(const Submesh& submesh, u32 vertexCount)
+{
+	std::vector<vec3> positions(vertexCount, vec3(0.0f));
+
+	const VertexBufferAttribute* positionAttribute = nullptr;
+	for (u32 i = 0; i < submesh.vertexBufferLayout.attributes.size(); ++i)
+	{
+		if (submesh.vertexBufferLayout.attributes[i].location == 0)
+			positionAttribute = &submesh.vertexBufferLayout.attributes[i];
+	}
+	if (!positionAttribute)
+		return positions;
+
+	const u32 stride = submesh.vertexBufferLayout.stride;
+	for (u32 i = 0; i < vertexCount; ++i)
+	{
+		const u8* src = submesh.vertices.data() + (size_t)i * stride + positionAttribute->offset;
+		if (positionAttribute->type == GL_UNSIGNED_SHORT)
+		{
+			u16 quantized[3];
+			memcpy(quantized, src, sizeof(quantized));
+			positions[i] = vec3(quantized[0], quantized[1], quantized[2]) / 65535.0f * submesh.positionScale + submesh.positionOffset;
+		}
+		else
+		{
+			memcpy(&positions[i], src, sizeof(vec3));
+		}
+	}
+	return positions;
+}
+
+void OptimizeSubmesh(Submesh& submesh, std::vector<u32>& indices, MeshOptimizationStats* stats)
+{
+	const u32 stride = submesh.vertexBufferLayout.stride;
+	MeshOptimizationStats localStats = {};
+	localStats.vertexCountBefore = (u32)(submesh.vertices.size() / stride);
+	localStats.triangleCount = (u32)(indices.size() / 3);
+	AnalyzeVertexCache(indices, localStats.vertexCountBefore, MESH_OPTIMIZER_FIFO_CACHE_SIZE, &localStats.acmrBefore, &localStats.atvrBefore);
+
+	auto start = std::chrono::steady_clock::now();
+	u32 vertexCount = WeldVertices(submesh.vertices, stride, indices);
+	localStats.weldSeconds = SecondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	OptimizeVertexCache(indices, vertexCount);
+	localStats.vertexCacheSeconds = SecondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	OptimizeOverdraw(indices, ReadSubmeshPositions(submesh, vertexCount));
+	localStats.overdrawSeconds = SecondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	vertexCount = OptimizeVertexFetch(submesh.vertices, stride, indices);
+	localStats.vertexFetchSeconds = SecondsSince(start);
+
+	submesh.vertexCount = vertexCount;
+	localStats.vertexCountAfter = vertexCount;
+	AnalyzeVertexCache(indices, vertexCount, MESH_OPTIMIZER_FIFO_CACHE_SIZE, &localStats.acmrAfter, &localStats.atvrAfter);
+
+	if (stats)
+		*stats = localStats;
+}
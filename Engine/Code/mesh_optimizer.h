@@ -0,0 +1,71 @@
+//
+// mesh_optimizer.h: Import-time optimization of the interleaved vertex streams built by
+// ProcessAssimpMesh. It replaces Assimp's aiProcess_JoinIdenticalVertices and
+// aiProcess_ImproveCacheLocality with four steps that run on the final vertex bytes:
+// welding, post-transform cache ordering, overdraw ordering and vertex fetch ordering.
+//
+
+#pragma once
+
+#include "geometry.h"
+
+#define MESH_OPTIMIZER_CACHE_SIZE      32    // Post-transform cache simulated by the triangle ordering
+#define MESH_OPTIMIZER_FIFO_CACHE_SIZE 16    // FIFO cache used for the ACMR/ATVR statistics
+#define MESH_OPTIMIZER_OVERDRAW_THRESHOLD 1.05f // How much ACMR the overdraw clusters may cost
+
+struct MeshOptimizationStats
+{
+	u32 vertexCountBefore;
+	u32 vertexCountAfter;
+	u32 triangleCount;
+	f32 acmrBefore;  // Average cache miss ratio: transformed vertices per triangle, 0.5 is ideal
+	f32 acmrAfter;
+	f32 atvrBefore;  // Average transform to vertex ratio: transformed vertices per vertex, 1 is ideal
+	f32 atvrAfter;
+	f64 weldSeconds;
+	f64 vertexCacheSeconds;
+	f64 overdrawSeconds;
+	f64 vertexFetchSeconds;
+};
+
+/**
+ * Merges the vertices whose bytes are identical and rewrites the indices.
+ * Returns the new vertex count.
+ */
+u32 WeldVertices(std::vector<u8>& vertices, u32 stride, std::vector<u32>& indices);
+
+/**
+ * Reorders the triangles for the post-transform vertex cache (Forsyth's linear-speed algorithm).
+ */
+void OptimizeVertexCache(std::vector<u32>& indices, u32 vertexCount);
+
+/**
+ * Splits the cache-ordered triangles into clusters and sorts the clusters so the ones facing
+ * away from the mesh center are drawn first, which lets early depth testing reject more of
+ * the rest from any point of view. Clusters only break where the cache would mostly miss,
+ * so the ACMR grows by threshold at most.
+ */
+void OptimizeOverdraw(std::vector<u32>& indices, const std::vector<vec3>& positions, f32 threshold = MESH_OPTIMIZER_OVERDRAW_THRESHOLD);
+
+/**
+ * Reorders the vertices by first use in the index list, dropping the unused ones.
+ * Returns the new vertex count.
+ */
+u32 OptimizeVertexFetch(std::vector<u8>& vertices, u32 stride, std::vector<u32>& indices);
+
+/**
+ * Simulates a FIFO post-transform cache over the index list.
+ */
+void AnalyzeVertexCache(const std::vector<u32>& indices, u32 vertexCount, u32 cacheSize, f32* acmr, f32* atvr);
+
+/**
+ * Decodes the positions of the first vertexCount vertices of the submesh stream to model
+ * units, whatever the vertex format stores.
+ */
+std::vector<vec3> ReadSubmeshPositions(const Submesh& submesh, u32 vertexCount);
+
+/**
+ * Runs the four steps on the submesh vertex stream (positions are read with its layout and
+ * dequantization) and the triangle list. Leaves the submesh vertexCount up to date.
+ */
+void OptimizeSubmesh(Submesh& submesh, std::vector<u32>& indices, MeshOptimizationStats* stats = nullptr);
@@ -0,0 +1,290 @@
+#include "mesh_simplifier.h"
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+#define MESH_SIMPLIFIER_MAX_PASSES 32
+#define MESH_SIMPLIFIER_MIN_NORMAL_DOT 0.25f // Collapses that turn a triangle further than ~75 degrees are taken as folds
+
+// Symmetric 4x4 matrix of the sum of squared distances to a set of planes
+struct Quadric
+{
+	f64 a00, a01, a02, a03;
+	f64      a11, a12, a13;
+	f64           a22, a23;
+	f64                a33;
+};
+
+static void AddPlane(Quadric& q, vec3 normal, f32 distance, f32 weight)
+{
+	const f64 x = normal.x, y = normal.y, z = normal.z, d = distance;
+	q.a00 += weight * x * x; q.a01 += weight * x * y; q.a02 += weight * x * z; q.a03 += weight * x * d;
+	q.a11 += weight * y * y; q.a12 += weight * y * z; q.a13 += weight * y * d;
+	q.a22 += weight * z * z; q.a23 += weight * z * d;
+	q.a33 += weight * d * d;
+}
+
+static void AddQuadric(Quadric& q, const Quadric& other)
+{
+	q.a00 += other.a00; q.a01 += other.a01; q.a02 += other.a02; q.a03 += other.a03;
+	q.a11 += other.a11; q.a12 += other.a12; q.a13 += other.a13;
+	q.a22 += other.a22; q.a23 += other.a23;
+	q.a33 += other.a33;
+}
+
+static f64 QuadricError(const Quadric& q, vec3 p)
+{
+	const f64 x = p.x, y = p.y, z = p.z;
+	const f64 error = q.a00 * x * x + 2.0 * q.a01 * x * y + 2.0 * q.a02 * x * z + 2.0 * q.a03 * x +
+		q.a11 * y * y + 2.0 * q.a12 * y * z + 2.0 * q.a13 * y +
+		q.a22 * z * z + 2.0 * q.a23 * z +
+		q.a33;
+	return error > 0.0 ? error : 0.0;
+}
+
+struct PositionHash
+{
+	size_t operator()(const vec3& p) const
+	{
+		u32 bits[3];
+		memcpy(bits, &p, sizeof(bits));
+		return (size_t)(bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u);
+	}
+};
+
+struct EdgeCollapse
+{
+	u32 from;  // Vertex that goes away
+	u32 to;    // Vertex that takes its triangles
+	f32 error;
+};
+
+static u64 EdgeKey(u32 a, u32 b)
+{
+	return a < b ? ((u64)a << 32) | b : ((u64)b << 32) | a;
+}
+
+static vec3 TriangleNormal(vec3 p0, vec3 p1, vec3 p2)
+{
+	return glm::cross(p1 - p0, p2 - p0);
+}
+
+std::vector<u32> SimplifyMesh(const std::vector<u32>& indices, const std::vector<vec3>& positions, u32 targetIndexCount, f32* resultError)
+{
+	const u32 vertexCount = (u32)positions.size();
+	std::vector<u32> result = indices;
+	f64 maxError = 0.0;
+
+	// Vertices that only differ in their attributes share a position id, and quadric
+	std::vector<u32> positionIds(vertexCount);
+	std::vector<u32> positionVertexCount;
+	{
+		std::unordered_map<vec3, u32, PositionHash> uniquePositions;
+		for (u32 v = 0; v < vertexCount; ++v)
+		{
+			auto it = uniquePositions.emplace(positions[v], (u32)uniquePositions.size()).first;
+			positionIds[v] = it->second;
+			if (it->second == positionVertexCount.size())
+				positionVertexCount.push_back(0);
+			++positionVertexCount[it->second];
+		}
+	}
+	const u32 positionCount = (u32)positionVertexCount.size();
+
+	// Seams and borders are locked: moving them would tear the attributes or the outline apart
+	std::vector<bool> locked(positionCount, false);
+	{
+		std::unordered_map<u64, u32> edgeTriangles;
+		for (u32 i = 0; i + 2 < result.size(); i += 3)
+		{
+			for (u32 k = 0; k < 3; ++k)
+				++edgeTriangles[EdgeKey(positionIds[result[i + k]], positionIds[result[i + (k + 1) % 3]])];
+		}
+		for (auto& edge : edgeTriangles)
+		{
+			if (edge.second == 1)
+			{
+				locked[(u32)(edge.first >> 32)] = true;
+				locked[(u32)(edge.first & 0xFFFFFFFFu)] = true;
+			}
+		}
+		for (u32 p = 0; p < positionCount; ++p)
+		{
+			if (positionVertexCount[p] > 1)
+				locked[p] = true;
+		}
+	}
+
+	std::vector<Quadric> quadrics(positionCount, Quadric{});
+	for (u32 i = 0; i + 2 < result.size(); i += 3)
+	{
+		const vec3 p0 = positions[result[i]];
+		const vec3 normal = TriangleNormal(p0, positions[result[i + 1]], positions[result[i + 2]]);
+		const f32 area = glm::length(normal);
+		if (area <= 0.0f)
+			continue;
+
+		const vec3 unitNormal = normal / area;
+		for (u32 k = 0; k < 3; ++k)
+			AddPlane(quadrics[positionIds[result[i + k]]], unitNormal, -glm::dot(unitNormal, p0), area);
+	}
+
+	std::vector<u32> collapseTargets(vertexCount);
+	std::vector<bool> touched(positionCount);
+	std::vector<u32> triangleOffsets(positionCount + 1);
+	std::vector<u32> positionTriangles;
+	std::vector<EdgeCollapse> collapses;
+
+	for (u32 pass = 0; pass < MESH_SIMPLIFIER_MAX_PASSES && result.size() > targetIndexCount; ++pass)
+	{
+		// Triangles around every position
+		std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+		for (u32 i = 0; i < result.size(); ++i)
+			++triangleOffsets[positionIds[result[i]] + 1];
+		for (u32 p = 0; p < positionCount; ++p)
+			triangleOffsets[p + 1] += triangleOffsets[p];
+		positionTriangles.resize(result.size());
+		std::vector<u32> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+		for (u32 i = 0; i < result.size(); ++i)
+			positionTriangles[fill[positionIds[result[i]]]++] = i / 3;
+
+		// Every edge can go either way, onto the vertex the triangle uses on the other end
+		collapses.clear();
+		for (u32 i = 0; i < result.size(); i += 3)
+		{
+			for (u32 k = 0; k < 3; ++k)
+			{
+				const u32 v0 = result[i + k];
+				const u32 v1 = result[i + (k + 1) % 3];
+				const u32 p0 = positionIds[v0];
+				const u32 p1 = positionIds[v1];
+				if (p0 == p1)
+					continue;
+
+				Quadric q = quadrics[p0];
+				AddQuadric(q, quadrics[p1]);
+				if (!locked[p0])
+					collapses.push_back(EdgeCollapse{ v0, v1, (f32)QuadricError(q, positions[v1]) });
+				if (!locked[p1])
+					collapses.push_back(EdgeCollapse{ v1, v0, (f32)QuadricError(q, positions[v0]) });
+			}
+		}
+
+		std::sort(collapses.begin(), collapses.end(), [](const EdgeCollapse& a, const EdgeCollapse& b) {
+			return a.error < b.error;
+		});
+
+		// Collapse the cheapest edges whose neighbourhood hasn't changed yet this pass
+		for (u32 v = 0; v < vertexCount; ++v)
+			collapseTargets[v] = v;
+		std::fill(touched.begin(), touched.end(), false);
+
+		const u32 trianglesToRemove = (u32)(result.size() - targetIndexCount) / 3;
+		u32 removedTriangles = 0;
+		u32 collapseCount = 0;
+		for (u32 c = 0; c < collapses.size() && removedTriangles < trianglesToRemove; ++c)
+		{
+			const EdgeCollapse& collapse = collapses[c];
+			const u32 pFrom = positionIds[collapse.from];
+			const u32 pTo = positionIds[collapse.to];
+			if (touched[pFrom] || touched[pTo])
+				continue;
+
+			// The triangles that stay must keep roughly their orientation (slivers can flip without reversing)
+			bool flips = false;
+			u32 sharedTriangles = 0;
+			for (u32 j = triangleOffsets[pFrom]; j < triangleOffsets[pFrom + 1] && !flips; ++j)
+			{
+				const u32* triangle = &result[positionTriangles[j] * 3];
+				const u32 t0 = positionIds[triangle[0]], t1 = positionIds[triangle[1]], t2 = positionIds[triangle[2]];
+				if (t0 == pTo || t1 == pTo || t2 == pTo)
+				{
+					++sharedTriangles;
+					continue;
+				}
+
+				vec3 p[3] = { positions[triangle[0]], positions[triangle[1]], positions[triangle[2]] };
+				const vec3 before = TriangleNormal(p[0], p[1], p[2]);
+				for (u32 k = 0; k < 3; ++k)
+				{
+					if (positionIds[triangle[k]] == pFrom)
+						p[k] = positions[collapse.to];
+				}
+				const vec3 after = TriangleNormal(p[0], p[1], p[2]);
+				flips = glm::dot(before, after) <= MESH_SIMPLIFIER_MIN_NORMAL_DOT * glm::length(before) * glm::length(after);
+			}
+			if (flips || sharedTriangles == 0)
+				continue;
+
+			// Lock the neighbourhood, the flip test above relies on it not moving
+			for (u32 j = triangleOffsets[pFrom]; j < triangleOffsets[pFrom + 1]; ++j)
+			{
+				const u32* triangle = &result[positionTriangles[j] * 3];
+				for (u32 k = 0; k < 3; ++k)
+					touched[positionIds[triangle[k]]] = true;
+			}
+
+			collapseTargets[collapse.from] = collapse.to;
+			AddQuadric(quadrics[pTo], quadrics[pFrom]);
+			maxError = glm::max(maxError, (f64)collapse.error);
+			removedTriangles += sharedTriangles;
+			++collapseCount;
+		}
+
+		if (collapseCount == 0)
+			break;
+
+		// Apply the collapses and drop the triangles that became degenerate
+		u32 writeIdx = 0;
+		for (u32 i = 0; i < result.size(); i += 3)
+		{
+			const u32 v0 = collapseTargets[result[i]];
+			const u32 v1 = collapseTargets[result[i + 1]];
+			const u32 v2 = collapseTargets[result[i + 2]];
+			const u32 p0 = positionIds[v0], p1 = positionIds[v1], p2 = positionIds[v2];
+			if (p0 == p1 || p1 == p2 || p0 == p2)
+				continue;
+
+			result[writeIdx++] = v0;
+			result[writeIdx++] = v1;
+			result[writeIdx++] = v2;
+		}
+		result.resize(writeIdx);
+	}
+
+	if (resultError)
+		*resultError = (f32)sqrt(maxError);
+	return result;
+}
+
+void BuildSubmeshLods(Submesh& submesh, std::vector<u32>& indices)
+{
+	submesh.lods.clear();
+	const std::vector<vec3> positions = ReadSubmeshPositions(submesh, submesh.vertexCount);
+
+	// Every level starts from the previous one, which is cheaper and keeps the chain nested
+	std::vector<u32> previous = indices;
+	for (u32 level = 0; level < MESH_LOD_MAX_COUNT; ++level)
+	{
+		const u32 triangleCount = (u32)previous.size() / 3;
+		if (triangleCount / 2 < MESH_LOD_MIN_TRIANGLES)
+			break;
+
+		f32 error = 0.0f;
+		std::vector<u32> simplified = SimplifyMesh(previous, positions, (triangleCount / 2) * 3, &error);
+		if (simplified.empty() || simplified.size() > previous.size() * MESH_LOD_MIN_REDUCTION)
+			break;
+
+		OptimizeVertexCache(simplified, submesh.vertexCount);
+
+		SubmeshLod lod = {};
+		lod.firstIndex = (u32)indices.size();
+		lod.indexCount = (u32)simplified.size();
+		lod.error = glm::max(error, submesh.lods.empty() ? 0.0f : submesh.lods.back().error);
+		submesh.lods.push_back(lod);
+
+		indices.insert(indices.end(), simplified.begin(), simplified.end());
+		previous.swap(simplified);
+	}
+}
@@ -0,0 +1,27 @@
+//
+// mesh_simplifier.h: Quadric error edge collapse, used at import time to build the LOD chain
+// of every submesh. The LODs only drop triangles: they index the vertices of LOD 0, so every
+// level shares the submesh vertex stream and is stored after LOD 0 in its index block.
+//
+
+#pragma once
+
+#include "geometry.h"
+
+#define MESH_LOD_MAX_COUNT       3     // Levels generated after LOD 0, each with about half the triangles of the previous
+#define MESH_LOD_MIN_REDUCTION   0.9f  // Stop the chain when a level keeps more than this fraction of the previous one
+#define MESH_LOD_MIN_TRIANGLES   64    // Don't simplify below this
+
+/**
+ * Collapses edges, cheapest quadric error first, until the index list is down to
+ * targetIndexCount or no edge can go without flipping a triangle. Vertices on borders and
+ * attribute seams (several vertices at the same position) stay where they are, so the
+ * simplified mesh never opens cracks. The largest error taken is returned in resultError.
+ */
+std::vector<u32> SimplifyMesh(const std::vector<u32>& indices, const std::vector<vec3>& positions, u32 targetIndexCount, f32* resultError);
+
+/**
+ * Builds the LOD chain of a submesh from its LOD 0 triangle list. The indices of the new
+ * levels are appended to indices and described in submesh.lods.
+ */
+void BuildSubmeshLods(Submesh& submesh, std::vector<u32>& indices);
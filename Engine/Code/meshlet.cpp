@@ -0,0 +1,212 @@
+#include "meshlet.h"
+#include "mesh_optimizer.h"
+#include "buffer.h"
+
+#include <algorithm>
+#include <array>
+
+static_assert(sizeof(Meshlet) == 64, "Meshlet must match the std430 layout of the cluster buffer");
+
+std::vector<u8> PackSubmeshClusters(const Submesh& submesh)
+{
+	const u32 meshletsSize = (u32)(submesh.meshlets.size() * sizeof(Meshlet));
+	const u32 verticesSize = (u32)(submesh.meshletVertices.size() * sizeof(u32));
+	const u32 trianglesSize = Align((u32)submesh.meshletTriangles.size(), sizeof(u32));
+
+	std::vector<u8> clusters(meshletsSize + verticesSize + trianglesSize, 0);
+	memcpy(clusters.data(), submesh.meshlets.data(), meshletsSize);
+	memcpy(clusters.data() + meshletsSize, submesh.meshletVertices.data(), verticesSize);
+	memcpy(clusters.data() + meshletsSize + verticesSize, submesh.meshletTriangles.data(), submesh.meshletTriangles.size());
+	return clusters;
+}
+
+static void ComputeMeshletBounds(Meshlet& meshlet, const Submesh& submesh, const std::vector<vec3>& positions)
+{
+	const u32* vertices = &submesh.meshletVertices[meshlet.vertexOffset];
+	const u8* triangles = &submesh.meshletTriangles[meshlet.triangleOffset];
+
+	// Sphere around the center of the bounding box
+	vec3 boundsMin = vec3(FLT_MAX);
+	vec3 boundsMax = vec3(-FLT_MAX);
+	for (u32 i = 0; i < meshlet.vertexCount; ++i)
+	{
+		boundsMin = glm::min(boundsMin, positions[vertices[i]]);
+		boundsMax = glm::max(boundsMax, positions[vertices[i]]);
+	}
+	meshlet.center = 0.5f * (boundsMin + boundsMax);
+	meshlet.radius = 0.0f;
+	for (u32 i = 0; i < meshlet.vertexCount; ++i)
+		meshlet.radius = glm::max(meshlet.radius, glm::length(positions[vertices[i]] - meshlet.center));
+
+	// Normal cone: the axis is the average facing, the cutoff the sine of the widest angle from it
+	std::array<vec3, MESHLET_MAX_TRIANGLES> normals;
+	vec3 axis = vec3(0.0f);
+	for (u32 t = 0; t < meshlet.triangleCount; ++t)
+	{
+		const vec3 p0 = positions[vertices[triangles[t * 3]]];
+		const vec3 p1 = positions[vertices[triangles[t * 3 + 1]]];
+		const vec3 p2 = positions[vertices[triangles[t * 3 + 2]]];
+		const vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		const f32 area = glm::length(normal);
+		normals[t] = area > 0.0f ? normal / area : vec3(0.0f);
+		axis += normals[t];
+	}
+
+	meshlet.coneApex = meshlet.center;
+	meshlet.coneCutoff = 1.0f;
+	meshlet.coneAxis = vec3(0.0f, 0.0f, 1.0f);
+	const f32 axisLength = glm::length(axis);
+	if (axisLength <= 0.0f)
+		return;
+	axis /= axisLength;
+
+	f32 minDot = 1.0f;
+	for (u32 t = 0; t < meshlet.triangleCount; ++t)
+	{
+		if (normals[t] != vec3(0.0f))
+			minDot = glm::min(minDot, glm::dot(normals[t], axis));
+	}
+
+	// Triangles spread over more than a hemisphere can always be seen from somewhere
+	meshlet.coneAxis = axis;
+	if (minDot <= 0.0f)
+		return;
+
+	// The apex goes back along the axis until every triangle plane is in front of it
+	f32 maxT = 0.0f;
+	for (u32 t = 0; t < meshlet.triangleCount; ++t)
+	{
+		if (normals[t] == vec3(0.0f))
+			continue;
+		const vec3 p0 = positions[vertices[triangles[t * 3]]];
+		maxT = glm::max(maxT, glm::dot(meshlet.center - p0, normals[t]) / glm::dot(axis, normals[t]));
+	}
+	meshlet.coneApex = meshlet.center - axis * maxT;
+	meshlet.coneCutoff = sqrtf(1.0f - minDot * minDot);
+}
+
+void BuildSubmeshMeshlets(Submesh& submesh, const std::vector<u32>& indices)
+{
+	submesh.meshlets.clear();
+	submesh.meshletVertices.clear();
+	submesh.meshletTriangles.clear();
+
+	// Local index of every submesh vertex in the meshlet being built, UINT32_MAX if not in it yet
+	std::vector<u32> localIndices(submesh.vertexCount, UINT32_MAX);
+	Meshlet meshlet = {};
+
+	for (u32 i = 0; i + 2 < indices.size(); i += 3)
+	{
+		u32 newVertices = 0;
+		for (u32 k = 0; k < 3; ++k)
+			newVertices += localIndices[indices[i + k]] == UINT32_MAX ? 1 : 0;
+
+		if (meshlet.vertexCount + newVertices > MESHLET_MAX_VERTICES || meshlet.triangleCount + 1 > MESHLET_MAX_TRIANGLES)
+		{
+			for (u32 v = 0; v < meshlet.vertexCount; ++v)
+				localIndices[submesh.meshletVertices[meshlet.vertexOffset + v]] = UINT32_MAX;
+			submesh.meshlets.push_back(meshlet);
+
+			meshlet = {};
+			meshlet.vertexOffset = (u32)submesh.meshletVertices.size();
+			meshlet.triangleOffset = (u32)submesh.meshletTriangles.size();
+		}
+
+		for (u32 k = 0; k < 3; ++k)
+		{
+			u32& localIndex = localIndices[indices[i + k]];
+			if (localIndex == UINT32_MAX)
+			{
+				localIndex = meshlet.vertexCount++;
+				submesh.meshletVertices.push_back(indices[i + k]);
+			}
+			submesh.meshletTriangles.push_back((u8)localIndex);
+		}
+		++meshlet.triangleCount;
+	}
+	if (meshlet.triangleCount > 0)
+		submesh.meshlets.push_back(meshlet);
+
+	const std::vector<vec3> positions = ReadSubmeshPositions(submesh, submesh.vertexCount);
+	for (u32 i = 0; i < submesh.meshlets.size(); ++i)
+		ComputeMeshletBounds(submesh.meshlets[i], submesh, positions);
+}
+
+// Rotated so the smallest index goes first, which keeps the winding
+static std::array<u32, 3> CanonicalTriangle(u32 a, u32 b, u32 c)
+{
+	if (b < a && b < c)
+		return { b, c, a };
+	if (c < a && c < b)
+		return { c, a, b };
+	return { a, b, c };
+}
+
+bool ValidateSubmeshMeshlets(const Submesh& submesh, const std::vector<u32>& indices)
+{
+	std::vector<std::array<u32, 3>> expected;
+	for (u32 i = 0; i + 2 < indices.size(); i += 3)
+		expected.push_back(CanonicalTriangle(indices[i], indices[i + 1], indices[i + 2]));
+
+	std::vector<std::array<u32, 3>> found;
+	for (u32 m = 0; m < submesh.meshlets.size(); ++m)
+	{
+		const Meshlet& meshlet = submesh.meshlets[m];
+		if (meshlet.vertexCount > MESHLET_MAX_VERTICES || meshlet.triangleCount > MESHLET_MAX_TRIANGLES ||
+			meshlet.vertexOffset + meshlet.vertexCount > submesh.meshletVertices.size() ||
+			meshlet.triangleOffset + meshlet.triangleCount * 3 > submesh.meshletTriangles.size())
+			return false;
+
+		const u32* vertices = &submesh.meshletVertices[meshlet.vertexOffset];
+		const u8* triangles = &submesh.meshletTriangles[meshlet.triangleOffset];
+		for (u32 t = 0; t < meshlet.triangleCount * 3; t += 3)
+		{
+			if (triangles[t] >= meshlet.vertexCount || triangles[t + 1] >= meshlet.vertexCount || triangles[t + 2] >= meshlet.vertexCount)
+				return false;
+			found.push_back(CanonicalTriangle(vertices[triangles[t]], vertices[triangles[t + 1]], vertices[triangles[t + 2]]));
+		}
+	}
+
+	std::sort(expected.begin(), expected.end());
+	std::sort(found.begin(), found.end());
+	return expected == found;
+}
+
+u32 CullSubmeshMeshlets(const Submesh& submesh, const mat4& world, const mat4& viewProjection, vec3 cameraPosition, std::vector<u32>& visibleMeshlets)
+{
+	// Frustum planes (Gribb-Hartmann), normalized so the sphere test works in world units
+	const mat4 m = glm::transpose(viewProjection);
+	glm::vec4 planes[6] = { m[3] + m[0], m[3] - m[0], m[3] + m[1], m[3] - m[1], m[3] + m[2], m[3] - m[2] };
+	for (u32 p = 0; p < 6; ++p)
+		planes[p] /= glm::length(vec3(planes[p]));
+
+	const f32 scale = GetMaxScale(world);
+
+	u32 visibleCount = 0;
+	for (u32 i = 0; i < submesh.meshlets.size(); ++i)
+	{
+		const Meshlet& meshlet = submesh.meshlets[i];
+		const vec3 center = vec3(world * glm::vec4(meshlet.center, 1.0f));
+		const f32 radius = meshlet.radius * scale;
+
+		bool visible = true;
+		for (u32 p = 0; p < 6 && visible; ++p)
+			visible = glm::dot(vec3(planes[p]), center) + planes[p].w >= -radius;
+
+		if (visible && meshlet.coneCutoff < 1.0f)
+		{
+			const vec3 apex = vec3(world * glm::vec4(meshlet.coneApex, 1.0f));
+			const vec3 axis = glm::normalize(vec3(world * glm::vec4(meshlet.coneAxis, 0.0f)));
+			const vec3 toApex = apex - cameraPosition;
+			const f32 distance = glm::length(toApex);
+			visible = distance <= 0.0f || glm::dot(toApex / distance, axis) < meshlet.coneCutoff;
+		}
+
+		if (visible)
+		{
+			visibleMeshlets.push_back(i);
+			++visibleCount;
+		}
+	}
+	return visibleCount;
+}
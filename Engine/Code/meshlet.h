@@ -0,0 +1,40 @@
+//
+// meshlet.h: Splits submeshes into small clusters of triangles (meshlets) with their own
+// bounding sphere and normal cone, so whole clusters can be culled when they are off screen
+// or facing away from the camera. The cluster data of a submesh is packed into one block of
+// the geometry pool cluster buffer, next to its vertices and indices.
+//
+
+#pragma once
+
+#include "geometry.h"
+
+#define MESHLET_MAX_VERTICES  64
+#define MESHLET_MAX_TRIANGLES 124
+
+/**
+ * Packs the meshlets of a submesh the way they are laid out in the cluster buffer (std430):
+ *   Meshlet  meshlets[meshletCount]
+ *   uint     vertices[meshletVertexCount]       // Submesh vertex index of every meshlet vertex
+ *   uint     triangles[(triangleBytes + 3) / 4] // 3 bytes per triangle, meshlet local indices
+ */
+std::vector<u8> PackSubmeshClusters(const Submesh& submesh);
+
+/**
+ * Splits the triangle list into meshlets of at most MESHLET_MAX_VERTICES vertices and
+ * MESHLET_MAX_TRIANGLES triangles, following the index order (so it should run after the
+ * vertex cache ordering), and computes their bounds from the submesh positions.
+ */
+void BuildSubmeshMeshlets(Submesh& submesh, const std::vector<u32>& indices);
+
+/**
+ * Checks the meshlets hold exactly the triangles of the index list, with the same winding.
+ */
+bool ValidateSubmeshMeshlets(const Submesh& submesh, const std::vector<u32>& indices);
+
+/**
+ * CPU reference of the cluster culling: appends to visibleMeshlets the meshlets of the
+ * submesh that are inside the frustum and not facing away from the camera. The world
+ * matrix must not have non-uniform scale. Returns the number of meshlets appended.
+ */
+u32 CullSubmeshMeshlets(const Submesh& submesh, const mat4& world, const mat4& viewProjection, vec3 cameraPosition, std::vector<u32>& visibleMeshlets);
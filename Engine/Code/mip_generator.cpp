@@ -0,0 +1,243 @@
+#include "mip_generator.h"
+#include "job_system.h"
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define MIP_GENERATOR_SSE 1
+#else
+#define MIP_GENERATOR_SSE 0
+#endif
+
+#define MIP_LINEAR_TO_SRGB_TABLE_SIZE 4096
+#define MIP_COVERAGE_SEARCH_STEPS     10
+
+static f32 SrgbToLinear(f32 value)
+{
+	return value <= 0.04045f ? value / 12.92f : powf((value + 0.055f) / 1.055f, 2.4f);
+}
+
+static f32 LinearToSrgb(f32 value)
+{
+	return value <= 0.0031308f ? value * 12.92f : 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+}
+
+// Taps of one destination pixel along one axis
+struct FilterTaps
+{
+	i32 first;                 // Source index of the first weight, out of range indices are clamped
+	std::vector<f32> weights;  // Normalized, they add up to 1
+};
+
+// Zeroth order modified Bessel function of the first kind
+static f32 BesselI0(f32 x)
+{
+	f32 sum = 1.0f, term = 1.0f;
+	for (u32 k = 1; k < 32 && term > sum * 1e-8f; ++k)
+	{
+		const f32 half = x / (2.0f * k);
+		term *= half * half;
+		sum += term;
+	}
+	return sum;
+}
+
+static f32 KaiserSinc(f32 distance)
+{
+	const f32 t = distance / MIP_KAISER_RADIUS;
+	if (fabsf(t) >= 1.0f)
+		return 0.0f;
+
+	const f32 window = BesselI0(MIP_KAISER_ALPHA * sqrtf(1.0f - t * t)) / BesselI0(MIP_KAISER_ALPHA);
+	const f32 x = PI * distance;
+	const f32 sinc = fabsf(x) < 1e-5f ? 1.0f : sinf(x) / x;
+	return window * sinc;
+}
+
+static std::vector<FilterTaps> ComputeFilterTaps(u32 sourceSize, u32 destinationSize, MipFilter filter)
+{
+	const f32 scale = (f32)sourceSize / (f32)destinationSize;
+	std::vector<FilterTaps> taps(destinationSize);
+	for (u32 d = 0; d < destinationSize; ++d)
+	{
+		FilterTaps& tap = taps[d];
+		const f32 center = (d + 0.5f) * scale; // In source pixels, pixel i covers [i, i + 1)
+		if (filter == MipFilter_Box)
+		{
+			tap.first = (i32)(d * scale);
+			const i32 last = glm::max(tap.first, (i32)ceilf((d + 1) * scale) - 1);
+			tap.weights.assign(last - tap.first + 1, 1.0f);
+		}
+		else
+		{
+			const f32 radius = MIP_KAISER_RADIUS * scale;
+			tap.first = (i32)floorf(center - radius);
+			const i32 last = (i32)ceilf(center + radius);
+			for (i32 s = tap.first; s <= last; ++s)
+				tap.weights.push_back(KaiserSinc((s + 0.5f - center) / scale));
+		}
+
+		f32 sum = 0.0f;
+		for (u32 i = 0; i < tap.weights.size(); ++i)
+			sum += tap.weights[i];
+		for (u32 i = 0; i < tap.weights.size(); ++i)
+			tap.weights[i] /= sum;
+	}
+	return taps;
+}
+
+// Weighted sum of the RGBA pixels under the taps, stride floats apart
+static void FilterPixel(const f32* source, i32 stride, i32 sourceSize, const FilterTaps& tap, f32* destination)
+{
+#if MIP_GENERATOR_SSE
+	__m128 sum = _mm_setzero_ps();
+	for (u32 i = 0; i < tap.weights.size(); ++i)
+	{
+		const i32 s = glm::clamp(tap.first + (i32)i, 0, sourceSize - 1);
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(source + s * stride), _mm_set1_ps(tap.weights[i])));
+	}
+	_mm_storeu_ps(destination, sum);
+#else
+	f32 sum[4] = {};
+	for (u32 i = 0; i < tap.weights.size(); ++i)
+	{
+		const i32 s = glm::clamp(tap.first + (i32)i, 0, sourceSize - 1);
+		for (u32 c = 0; c < 4; ++c)
+			sum[c] += source[s * stride + c] * tap.weights[i];
+	}
+	memcpy(destination, sum, sizeof(sum));
+#endif
+}
+
+// Separable: rows first into a (width x source height) buffer, then columns
+static std::vector<f32> DownsampleLevel(const std::vector<f32>& source, u32 width, u32 height, u32 nextWidth, u32 nextHeight, MipFilter filter)
+{
+	const std::vector<FilterTaps> rowTaps = ComputeFilterTaps(width, nextWidth, filter);
+	const std::vector<FilterTaps> columnTaps = ComputeFilterTaps(height, nextHeight, filter);
+
+	std::vector<f32> rows((u64)nextWidth * height * 4);
+	ParallelFor(height, [&](u32 y) {
+		const f32* sourceRow = &source[(u64)y * width * 4];
+		for (u32 x = 0; x < nextWidth; ++x)
+			FilterPixel(sourceRow, 4, (i32)width, rowTaps[x], &rows[((u64)y * nextWidth + x) * 4]);
+	});
+
+	std::vector<f32> next((u64)nextWidth * nextHeight * 4);
+	ParallelFor(nextHeight, [&](u32 y) {
+		for (u32 x = 0; x < nextWidth; ++x)
+			FilterPixel(&rows[(u64)x * 4], (i32)nextWidth * 4, (i32)height, columnTaps[y], &next[((u64)y * nextWidth + x) * 4]);
+	});
+	return next;
+}
+
+static f32 ComputeAlphaCoverage(const std::vector<f32>& pixels, f32 reference, f32 scale)
+{
+	const u64 pixelCount = pixels.size() / 4;
+	u64 covered = 0;
+	for (u64 i = 0; i < pixelCount; ++i)
+		covered += pixels[i * 4 + 3] * scale >= reference ? 1 : 0;
+	return (f32)covered / (f32)pixelCount;
+}
+
+// Alpha scale that brings the coverage of the level back to the one of level 0 (binary search)
+static f32 FindAlphaCoverageScale(const std::vector<f32>& pixels, f32 reference, f32 targetCoverage)
+{
+	f32 low = 0.0f, high = 4.0f, scale = 1.0f;
+	for (u32 step = 0; step < MIP_COVERAGE_SEARCH_STEPS; ++step)
+	{
+		const f32 coverage = ComputeAlphaCoverage(pixels, reference, scale);
+		if (coverage < targetCoverage)
+			low = scale;
+		else if (coverage > targetCoverage)
+			high = scale;
+		else
+			break;
+		scale = 0.5f * (low + high);
+	}
+	return scale;
+}
+
+static void NormalizeNormals(std::vector<f32>& pixels)
+{
+	for (u64 i = 0; i < pixels.size(); i += 4)
+	{
+		glm::vec3 normal = glm::vec3(pixels[i], pixels[i + 1], pixels[i + 2]);
+		const f32 length = glm::length(normal);
+		normal = length > 1e-6f ? normal / length : glm::vec3(0.0f, 0.0f, 1.0f);
+		pixels[i] = normal.x;
+		pixels[i + 1] = normal.y;
+		pixels[i + 2] = normal.z;
+	}
+}
+
+static MipLevel EncodeLevel(const std::vector<f32>& pixels, u32 width, u32 height, const MipSettings& settings, const u8* linearToSrgb, f32 alphaScale)
+{
+	MipLevel level;
+	level.width = width;
+	level.height = height;
+	level.rgba.resize((u64)width * height * 4);
+	for (u64 i = 0; i < level.rgba.size(); i += 4)
+	{
+		for (u32 c = 0; c < 3; ++c)
+		{
+			const f32 value = settings.normalMap ? pixels[i + c] * 0.5f + 0.5f : pixels[i + c];
+			const f32 clamped = glm::clamp(value, 0.0f, 1.0f);
+			level.rgba[i + c] = settings.srgb ? linearToSrgb[(u32)(clamped * (MIP_LINEAR_TO_SRGB_TABLE_SIZE - 1) + 0.5f)] : (u8)(clamped * 255.0f + 0.5f);
+		}
+		level.rgba[i + 3] = (u8)(glm::clamp(pixels[i + 3] * alphaScale, 0.0f, 1.0f) * 255.0f + 0.5f);
+	}
+	return level;
+}
+
+std::vector<MipLevel> GenerateMipChain(const u8* rgba, u32 width, u32 height, const MipSettings& settings)
+{
+	std::vector<MipLevel> levels;
+	if (!rgba || width == 0 || height == 0)
+		return levels;
+
+	f32 srgbToLinear[256];
+	for (u32 i = 0; i < 256; ++i)
+		srgbToLinear[i] = SrgbToLinear(i / 255.0f);
+	u8 linearToSrgb[MIP_LINEAR_TO_SRGB_TABLE_SIZE];
+	for (u32 i = 0; i < MIP_LINEAR_TO_SRGB_TABLE_SIZE; ++i)
+		linearToSrgb[i] = (u8)(LinearToSrgb(i / (f32)(MIP_LINEAR_TO_SRGB_TABLE_SIZE - 1)) * 255.0f + 0.5f);
+
+	// Level 0 is kept as is, the float copy is only the source of the next level
+	MipLevel level0;
+	level0.width = width;
+	level0.height = height;
+	level0.rgba.assign(rgba, rgba + (u64)width * height * 4);
+	levels.push_back(level0);
+
+	std::vector<f32> pixels((u64)width * height * 4);
+	for (u64 i = 0; i < pixels.size(); i += 4)
+	{
+		for (u32 c = 0; c < 3; ++c)
+		{
+			const u8 value = rgba[i + c];
+			pixels[i + c] = settings.normalMap ? value / 255.0f * 2.0f - 1.0f : settings.srgb ? srgbToLinear[value] : value / 255.0f;
+		}
+		pixels[i + 3] = rgba[i + 3] / 255.0f;
+	}
+
+	const bool keepCoverage = settings.alphaCoverageReference > 0.0f;
+	const f32 targetCoverage = keepCoverage ? ComputeAlphaCoverage(pixels, settings.alphaCoverageReference, 1.0f) : 0.0f;
+
+	u32 levelWidth = width, levelHeight = height;
+	while (levelWidth > 1 || levelHeight > 1)
+	{
+		const u32 nextWidth = glm::max(levelWidth / 2, 1u);
+		const u32 nextHeight = glm::max(levelHeight / 2, 1u);
+		pixels = DownsampleLevel(pixels, levelWidth, levelHeight, nextWidth, nextHeight, settings.filter);
+		levelWidth = nextWidth;
+		levelHeight = nextHeight;
+
+		if (settings.normalMap)
+			NormalizeNormals(pixels);
+
+		// The scale only goes into the stored level, the next one filters the unscaled alpha
+		const f32 alphaScale = keepCoverage ? FindAlphaCoverageScale(pixels, settings.alphaCoverageReference, targetCoverage) : 1.0f;
+		levels.push_back(EncodeLevel(pixels, levelWidth, levelHeight, settings, linearToSrgb, alphaScale));
+	}
+
+	return levels;
+}
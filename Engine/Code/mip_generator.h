@@ -0,0 +1,40 @@
+//
+// mip_generator.h: CPU generation of the mip chains stored in cooked textures. Levels are
+// filtered in linear float RGBA: sRGB colors are decoded first, normal maps are renormalized
+// after every level, and the alpha of cutout textures is rescaled so each level keeps the
+// alpha test coverage of the full resolution image.
+//
+
+#pragma once
+
+#include "platform.h"
+
+#define MIP_KAISER_RADIUS 3.0f // Half width of the kernel, in destination pixels
+#define MIP_KAISER_ALPHA  4.0f // Window sharpness: higher trades sharpness for less ringing
+
+enum MipFilter
+{
+	MipFilter_Box,    // Average of the 2x2 source pixels
+	MipFilter_Kaiser, // Kaiser windowed sinc, sharper and without the box aliasing
+};
+
+struct MipSettings
+{
+	MipFilter filter = MipFilter_Kaiser;
+	bool      srgb = false;                 // RGB is sRGB encoded
+	bool      normalMap = false;            // RGB is a unit vector encoded to [0, 1]
+	f32       alphaCoverageReference = 0.0f; // Alpha test reference whose coverage is kept, 0 to filter alpha as is
+};
+
+struct MipLevel
+{
+	u32 width;
+	u32 height;
+	std::vector<u8> rgba;
+};
+
+/**
+ * Builds the levels of an RGBA8 image from width x height down to 1x1. Level 0 is a copy of
+ * the image, every other level is filtered from the float result of the previous one.
+ */
+std::vector<MipLevel> GenerateMipChain(const u8* rgba, u32 width, u32 height, const MipSettings& settings);
@@ -0,0 +1,264 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "orm_packer.h"
+
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <unordered_set>
+
+#ifdef _DEBUG
+#include <stb_image.h>
+#include <stb_image_write.h>
+#endif // _DEBUG
+
+#ifndef _DEBUG
+#include "../ThirdParty/stb/stb_image.h"
+#include "../ThirdParty/stb/stb_image_write.h"
+#endif // !_DEBUG
+
+// Packed maps being written. Imports run on the workers, and two of them sharing a directory
+// and a material name would write the same file: the second waits and reuses it.
+static std::mutex OrmPackMutex;
+static std::condition_variable OrmPackFinished;
+static std::unordered_set<std::string> OrmPackPaths;
+
+static void BeginOrmPack(const std::string& packedPath)
+{
+	std::unique_lock<std::mutex> lock(OrmPackMutex);
+	OrmPackFinished.wait(lock, [&packedPath] { return OrmPackPaths.count(packedPath) == 0; });
+	OrmPackPaths.insert(packedPath);
+}
+
+static void EndOrmPack(const std::string& packedPath)
+{
+	{
+		std::lock_guard<std::mutex> lock(OrmPackMutex);
+		OrmPackPaths.erase(packedPath);
+	}
+	OrmPackFinished.notify_all();
+}
+
+static std::string JoinPath(const std::string& directory, const std::string& filename)
+{
+	return directory.empty() ? filename : directory + "/" + filename;
+}
+
+// The packed map exists and is newer than every source
+static bool IsPackedOrmMapUpToDate(const OrmSources& sources, const std::string& directory, const std::string& packedPath)
+{
+	const u64 packedTimestamp = GetFileLastWriteTimestamp(packedPath.c_str());
+	bool upToDate = packedTimestamp != 0;
+	for (u32 i = 0; i < OrmChannel_Count && upToDate; ++i)
+	{
+		if (!sources.filenames[i].empty())
+			upToDate = GetFileLastWriteTimestamp(JoinPath(directory, sources.filenames[i]).c_str()) <= packedTimestamp;
+	}
+	return upToDate;
+}
+
+// Name of the file, lower case and without its directory
+static std::string GetLowerFileName(const std::string& filepath)
+{
+	const size_t slash = filepath.find_last_of("/\\");
+	std::string name = slash == std::string::npos ? filepath : filepath.substr(slash + 1);
+	for (u32 i = 0; i < name.size(); ++i)
+		name[i] = (char)tolower((unsigned char)name[i]);
+	return name;
+}
+
+static bool IsImageFile(const std::string& filename)
+{
+	const std::string name = GetLowerFileName(filename);
+	const size_t dot = name.find_last_of('.');
+	const std::string extension = dot == std::string::npos ? std::string() : name.substr(dot);
+	return extension == ".png" || extension == ".jpg" || extension == ".jpeg" || extension == ".tga" || extension == ".bmp";
+}
+
+// ORM channel a label names, OrmChannel_Count if none
+static u32 GetLabelOrmChannel(const std::string& label)
+{
+	if (label.find("occlusion") != std::string::npos || label == "ao")
+		return OrmChannel_Occlusion;
+	if (label.find("rough") != std::string::npos)
+		return OrmChannel_Roughness;
+	if (label.find("metal") != std::string::npos)
+		return OrmChannel_Metallic;
+	return OrmChannel_Count;
+}
+
+bool DetectPackedOrmMap(const std::string& filename, u32 channels[OrmChannel_Count])
+{
+	for (u32 i = 0; i < OrmChannel_Count; ++i)
+		channels[i] = UINT32_MAX;
+	if (!IsImageFile(filename))
+		return false;
+
+	std::string name = GetLowerFileName(filename);
+	name = name.substr(0, name.find_last_of('.'));
+
+	// Labels are "<channel>-<name>" parts of the name, between underscores
+	const std::string imageChannels = "rgba";
+	bool labelled = false;
+	size_t begin = 0;
+	while (begin < name.size())
+	{
+		size_t end = name.find('_', begin);
+		if (end == std::string::npos)
+			end = name.size();
+
+		const std::string part = name.substr(begin, end - begin);
+		if (part.size() > 2 && part[1] == '-')
+		{
+			const size_t imageChannel = imageChannels.find(part[0]);
+			const u32 channel = GetLabelOrmChannel(part.substr(2));
+			if (imageChannel != std::string::npos && channel != OrmChannel_Count && channels[channel] == UINT32_MAX)
+			{
+				channels[channel] = (u32)imageChannel;
+				labelled = true;
+			}
+		}
+		begin = end + 1;
+	}
+	return labelled;
+}
+
+std::string FindPackedOrmMap(const std::string& directory, u32 channels[OrmChannel_Count])
+{
+	std::string result;
+	std::error_code error;
+	std::filesystem::directory_iterator it(directory.empty() ? std::string(".") : directory, error);
+	for (; !error && it != std::filesystem::directory_iterator(); it.increment(error))
+	{
+		const std::string filename = it->path().filename().string();
+		u32 fileChannels[OrmChannel_Count];
+		if (!it->is_regular_file() || !DetectPackedOrmMap(filename, fileChannels))
+			continue;
+
+		// Several of them, there's no telling which one belongs to the material
+		if (!result.empty())
+			return std::string();
+
+		result = filename;
+		memcpy(channels, fileChannels, sizeof(fileChannels));
+	}
+	return result;
+}
+
+std::string ResolveOrmMap(const OrmSources& sources, const std::string& directory, const std::string& packedName)
+{
+	u32 firstSource = OrmChannel_Count;
+	bool inOrmOrder = true;
+	for (u32 i = 0; i < OrmChannel_Count; ++i)
+	{
+		if (!sources.filenames[i].empty() && firstSource == OrmChannel_Count)
+			firstSource = i;
+		inOrmOrder = inOrmOrder && sources.filenames[i] == sources.filenames[0] && sources.channels[i] == i;
+	}
+	if (firstSource == OrmChannel_Count)
+		return std::string();
+	if (inOrmOrder)
+		return sources.filenames[0];
+
+	// Next to the first source, named after the material
+	const std::string& firstFilename = sources.filenames[firstSource];
+	const size_t slash = firstFilename.find_last_of("/\\");
+	std::string packedFilename = slash == std::string::npos ? std::string() : firstFilename.substr(0, slash + 1);
+	for (u32 i = 0; i < packedName.size(); ++i)
+		packedFilename += isalnum((unsigned char)packedName[i]) || packedName[i] == '-' || packedName[i] == '.' ? packedName[i] : '_';
+	packedFilename += ORM_PACKED_SUFFIX;
+	const std::string packedPath = JoinPath(directory, packedFilename);
+
+	if (IsPackedOrmMapUpToDate(sources, directory, packedPath))
+		return packedFilename;
+
+	// Checked again once this import owns the output, another one may have just written it
+	BeginOrmPack(packedPath);
+	if (IsPackedOrmMapUpToDate(sources, directory, packedPath))
+	{
+		EndOrmPack(packedPath);
+		return packedFilename;
+	}
+
+	// Every image is decoded once, as RGBA so any channel can be read whatever the image has
+	u8* pixels[OrmChannel_Count] = {};
+	i32 widths[OrmChannel_Count] = {};
+	i32 heights[OrmChannel_Count] = {};
+	bool owned[OrmChannel_Count] = {};
+	bool valid = true;
+	i32 width = 0, height = 0;
+	stbi_set_flip_vertically_on_load_thread(0);
+	for (u32 i = 0; i < OrmChannel_Count; ++i)
+	{
+		if (sources.filenames[i].empty())
+			continue;
+
+		for (u32 j = 0; j < i && !pixels[i]; ++j)
+		{
+			if (pixels[j] && sources.filenames[j] == sources.filenames[i])
+			{
+				pixels[i] = pixels[j];
+				widths[i] = widths[j];
+				heights[i] = heights[j];
+			}
+		}
+		if (!pixels[i])
+		{
+			const std::string sourcePath = JoinPath(directory, sources.filenames[i]);
+			i32 channelCount = 0;
+			pixels[i] = stbi_load(sourcePath.c_str(), &widths[i], &heights[i], &channelCount, 4);
+			owned[i] = pixels[i] != nullptr;
+			if (!pixels[i])
+			{
+				ELOG("Could not open file %s", sourcePath.c_str());
+				valid = false;
+			}
+		}
+		width = glm::max(width, widths[i]);
+		height = glm::max(height, heights[i]);
+	}
+
+	if (valid)
+	{
+		// Sources smaller than the largest one are read at the nearest pixel
+		std::vector<u8> packed((u64)width * height * 3, 0);
+		for (i32 y = 0; y < height; ++y)
+		{
+			for (i32 x = 0; x < width; ++x)
+			{
+				u8* dst = &packed[((u64)y * width + x) * 3];
+				for (u32 i = 0; i < OrmChannel_Count; ++i)
+				{
+					if (!pixels[i])
+						continue;
+					const i32 sx = (i32)((i64)x * widths[i] / width);
+					const i32 sy = (i32)((i64)y * heights[i] / height);
+					dst[i] = pixels[i][((u64)sy * widths[i] + sx) * 4 + sources.channels[i]];
+				}
+			}
+		}
+
+		// Written aside and renamed into place, so nobody reads a partial PNG
+		const std::string tempPath = GetTempFilePath(packedPath.c_str());
+		valid = stbi_write_png(tempPath.c_str(), width, height, 3, packed.data(), width * 3) != 0;
+		if (!valid)
+			remove(tempPath.c_str());
+		valid = valid && RenameFileOver(tempPath.c_str(), packedPath.c_str());
+		if (valid)
+		{
+			ILOG("Packed ORM map %s (%dx%d)", packedPath.c_str(), width, height);
+		}
+		else
+		{
+			ELOG("Could not write the packed ORM map %s", packedPath.c_str());
+		}
+	}
+
+	for (u32 i = 0; i < OrmChannel_Count; ++i)
+	{
+		if (owned[i])
+			stbi_image_free(pixels[i]);
+	}
+	EndOrmPack(packedPath);
+	return valid ? packedFilename : std::string();
+}
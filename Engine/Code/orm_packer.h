@@ -0,0 +1,50 @@
+//
+// orm_packer.h: Occlusion, roughness and metallic maps packed in the red, green and blue
+// channels of one texture, so the PBR shaders read the three from a single sample. Models that
+// ship separate maps get a packed PNG written next to them at import, rebuilt whenever one of
+// its sources is newer. Maps that already hold the three channels are used as they are when
+// their channels are in ORM order, and swizzled into a packed PNG otherwise.
+//
+
+#pragma once
+
+#include "platform.h"
+
+#define ORM_PACKED_SUFFIX "_orm.png"
+
+enum OrmChannel
+{
+	OrmChannel_Occlusion, // Red
+	OrmChannel_Roughness, // Green
+	OrmChannel_Metallic,  // Blue
+	OrmChannel_Count
+};
+
+// Where every ORM channel comes from: an image and the channel of it holding the values.
+// Channels without an image are 0, like the black texture the materials used without a map.
+struct OrmSources
+{
+	std::string filenames[OrmChannel_Count]; // Relative to the model directory, empty if unused
+	u32         channels[OrmChannel_Count];  // 0 to 3, red to alpha
+};
+
+/**
+ * Reads the channel layout from the name of an already packed map, such as
+ * "knight_R-occlusion_G-metal_B-roughness.png": the channel of the image holding every ORM
+ * channel, UINT32_MAX for the ones it doesn't label. Returns false if it labels none.
+ */
+bool DetectPackedOrmMap(const std::string& filename, u32 channels[OrmChannel_Count]);
+
+/**
+ * Name of the only packed map DetectPackedOrmMap recognizes in the directory, empty if there is
+ * none or more than one.
+ */
+std::string FindPackedOrmMap(const std::string& directory, u32 channels[OrmChannel_Count]);
+
+/**
+ * Texture holding the sources in ORM order, relative to the directory: the source itself if it
+ * already is one, or a PNG named after packedName next to the first source, written (again) if
+ * it is missing or older than a source. Empty if there are no sources or they could not be
+ * read. No GL, safe to call from any thread.
+ */
+std::string ResolveOrmMap(const OrmSources& sources, const std::string& directory, const std::string& packedName);
@@ -12,10 +12,14 @@
 #else
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 #endif
 
 #include "engine.h"
+#include "gpu_uploader.h"
+#include "job_system.h"
 
 #ifdef _DEBUG
 #include <GLFW/glfw3.h>
@@ -33,6 +37,8 @@
 
 
 #include <stdio.h>
+#include <functional>
+#include <thread>
 
 #define WINDOW_TITLE  "Advanced Graphics Programming"
 #define WINDOW_WIDTH  800
@@ -152,6 +158,13 @@ int main()
         return -1;
     }
 
+    // Never shown, it only carries the context of the upload thread (sharing the objects of the main one)
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* uploadWindow = glfwCreateWindow(1, 1, "", NULL, window);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+    if (!uploadWindow)
+        ELOG("glfwCreateWindow() failed for the upload context, uploads stay on the main thread\n");
+
     glfwSetWindowUserPointer(window, &app);
 
     glfwSetMouseButtonCallback(window, OnGlfwMouseEvent);
@@ -170,6 +183,8 @@ int main()
         ELOG("Failed to initialize OpenGL context\n");
         return -1;
     }
+    LoadBindlessTextureFunctions((GLADloadproc) glfwGetProcAddress);
+    InitGpuUploader(uploadWindow, (GLADloadproc) glfwGetProcAddress);
 
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
@@ -210,6 +225,8 @@ int main()
 
     GlobalFrameArenaMemory = (u8*)malloc(GLOBAL_FRAME_ARENA_SIZE);
 
+    InitJobSystem();
+
     Init(&app);
 
     while (app.isRunning)
@@ -273,11 +290,16 @@ int main()
         GlobalFrameArenaHead = 0;
     }
 
+    ShutdownJobSystem();
+    ShutdownGpuUploader();
+
     free(GlobalFrameArenaMemory);
 
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
 
+    if (uploadWindow)
+        glfwDestroyWindow(uploadWindow);
     glfwDestroyWindow(window);
 
     glfwTerminate();
@@ -410,6 +432,99 @@ u64 GetFileLastWriteTimestamp(const char* filepath)
     return 0;
 }
 
+MappedFile MapFile(const char* filepath)
+{
+    MappedFile file = {};
+
+#ifdef _WIN32
+    HANDLE fileHandle = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+        return file;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(fileHandle);
+        return file;
+    }
+
+    HANDLE mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mappingHandle) {
+        CloseHandle(fileHandle);
+        return file;
+    }
+
+    void* data = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+    if (!data) {
+        CloseHandle(mappingHandle);
+        CloseHandle(fileHandle);
+        return file;
+    }
+
+    file.data = data;
+    file.size = (u64)fileSize.QuadPart;
+    file.fileHandle = fileHandle;
+    file.mappingHandle = mappingHandle;
+#else
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0)
+        return file;
+
+    struct stat attrib;
+    if (fstat(fd, &attrib) != 0 || attrib.st_size == 0) {
+        close(fd);
+        return file;
+    }
+
+    void* data = mmap(NULL, (size_t)attrib.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return file;
+
+    file.data = data;
+    file.size = (u64)attrib.st_size;
+#endif
+
+    return file;
+}
+
+void UnmapFile(MappedFile& file)
+{
+    if (!file.data)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(file.data);
+    CloseHandle((HANDLE)file.mappingHandle);
+    CloseHandle((HANDLE)file.fileHandle);
+#else
+    munmap(file.data, (size_t)file.size);
+#endif
+
+    file = {};
+}
+
+std::string GetTempFilePath(const char* filepath)
+{
+    char suffix[32];
+    sprintf(suffix, ".%08x.tmp", (u32)std::hash<std::thread::id>()(std::this_thread::get_id()));
+    return std::string(filepath) + suffix;
+}
+
+bool RenameFileOver(const char* tempPath, const char* filepath)
+{
+#ifdef _WIN32
+    const bool renamed = MoveFileExA(tempPath, filepath, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    const bool renamed = rename(tempPath, filepath) == 0;
+#endif
+    if (!renamed)
+    {
+        ELOG("Could not replace %s, it may be open", filepath);
+        remove(tempPath);
+    }
+    return renamed;
+}
+
 void LogString(const char* str)
 {
 #ifdef _WIN32
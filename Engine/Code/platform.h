@@ -93,6 +93,34 @@ String ReadTextFile(const char *filepath);
  */
 u64 GetFileLastWriteTimestamp(const char *filepath);
 
+struct MappedFile
+{
+    void* data;
+    u64   size;
+    void* fileHandle;
+    void* mappingHandle;
+};
+
+/**
+ * Maps a whole file into memory for reading. The returned data stays valid until
+ * UnmapFile is called. If the file can't be opened or mapped, data is NULL.
+ */
+MappedFile MapFile(const char *filepath);
+
+void UnmapFile(MappedFile& file);
+
+/**
+ * A path next to filepath, unique to the calling thread, to write a file before it replaces
+ * filepath with RenameFileOver. Readers then never see a partially written file.
+ */
+std::string GetTempFilePath(const char *filepath);
+
+/**
+ * Moves the file at tempPath to filepath, replacing it if it exists. On failure the temporary
+ * file is removed and false is returned.
+ */
+bool RenameFileOver(const char *tempPath, const char *filepath);
+
 /**
  * It logs a string to whichever outputs are configured in the platform layer.
  * By default, the string is printed in the output console of VisualStudio.
@@ -0,0 +1,149 @@
+#include "spherical_harmonics.h"
+#include "job_system.h"
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define SH_PROJECTION_SSE 1
+#else
+#define SH_PROJECTION_SSE 0
+#endif
+
+// Clamped cosine convolution of each band, divided by pi: pi, 2pi/3 and pi/4 over pi
+static const f32 SHBandConvolution[3] = { 1.0f, 2.0f / 3.0f, 0.25f };
+
+// Real L2 basis, in the order the shaders evaluate it
+static void EvaluateSHBasis(const vec3& n, f32 basis[SH_COEFFICIENT_COUNT])
+{
+	basis[0] = 0.282095f;
+	basis[1] = 0.488603f * n.y;
+	basis[2] = 0.488603f * n.z;
+	basis[3] = 0.488603f * n.x;
+	basis[4] = 1.092548f * n.x * n.y;
+	basis[5] = 1.092548f * n.y * n.z;
+	basis[6] = 0.315392f * (3.0f * n.z * n.z - 1.0f);
+	basis[7] = 1.092548f * n.x * n.z;
+	basis[8] = 0.546274f * (n.x * n.x - n.y * n.y);
+}
+
+// Direction through the texel at (u, v) in [-1, 1] of a face, as GL samples cubemaps
+static vec3 GetCubemapDirection(u32 face, f32 u, f32 v)
+{
+	switch (face)
+	{
+	case 0:  return vec3(1.0f, -v, -u);
+	case 1:  return vec3(-1.0f, -v, u);
+	case 2:  return vec3(u, 1.0f, v);
+	case 3:  return vec3(u, -1.0f, -v);
+	case 4:  return vec3(u, -v, 1.0f);
+	default: return vec3(-u, -v, -1.0f);
+	}
+}
+
+struct SHFaceSum
+{
+	f32 coefficients[SH_COEFFICIENT_COUNT][4]; // RGB and padding
+	f32 weight;
+};
+
+static void ProjectCubemapFace(const u8* pixels, u32 face, u32 faceSize, u32 channels, SHFaceSum& sum)
+{
+	const f32 texelSize = 2.0f / faceSize;
+#if SH_PROJECTION_SSE
+	__m128 accumulators[SH_COEFFICIENT_COUNT];
+	for (u32 k = 0; k < SH_COEFFICIENT_COUNT; ++k)
+		accumulators[k] = _mm_setzero_ps();
+#else
+	memset(sum.coefficients, 0, sizeof(sum.coefficients));
+#endif
+	f32 weight = 0.0f;
+
+	for (u32 y = 0; y < faceSize; ++y)
+	{
+		const f32 v = (y + 0.5f) * texelSize - 1.0f;
+		for (u32 x = 0; x < faceSize; ++x)
+		{
+			const f32 u = (x + 0.5f) * texelSize - 1.0f;
+
+			// Solid angle of the texel, the projection of a face texel on the sphere
+			const f32 d = 1.0f + u * u + v * v;
+			const f32 solidAngle = texelSize * texelSize / (d * sqrtf(d));
+			weight += solidAngle;
+
+			f32 basis[SH_COEFFICIENT_COUNT];
+			EvaluateSHBasis(glm::normalize(GetCubemapDirection(face, u, v)), basis);
+
+			const u8* pixel = pixels + ((u64)y * faceSize + x) * channels;
+			const f32 scale = solidAngle / 255.0f;
+#if SH_PROJECTION_SSE
+			const __m128 radiance = _mm_mul_ps(_mm_set_ps(0.0f, pixel[2], pixel[1], pixel[0]), _mm_set1_ps(scale));
+			for (u32 k = 0; k < SH_COEFFICIENT_COUNT; ++k)
+				accumulators[k] = _mm_add_ps(accumulators[k], _mm_mul_ps(radiance, _mm_set1_ps(basis[k])));
+#else
+			for (u32 k = 0; k < SH_COEFFICIENT_COUNT; ++k)
+			{
+				for (u32 c = 0; c < 3; ++c)
+					sum.coefficients[k][c] += pixel[c] * scale * basis[k];
+			}
+#endif
+		}
+	}
+
+#if SH_PROJECTION_SSE
+	for (u32 k = 0; k < SH_COEFFICIENT_COUNT; ++k)
+		_mm_storeu_ps(sum.coefficients[k], accumulators[k]);
+#endif
+	sum.weight = weight;
+}
+
+SHIrradiance ProjectCubemapIrradiance(const u8* faces, u32 faceSize, u32 channels)
+{
+	const u64 faceBytes = (u64)faceSize * faceSize * channels;
+	SHFaceSum sums[6];
+	ParallelFor(6, [&](u32 face) {
+		ProjectCubemapFace(faces + face * faceBytes, face, faceSize, channels, sums[face]);
+	});
+
+	// The texel solid angles add up to a bit more or less than the sphere, normalize them
+	SHIrradiance irradiance = {};
+	f32 weight = 0.0f;
+	for (u32 face = 0; face < 6; ++face)
+	{
+		weight += sums[face].weight;
+		for (u32 k = 0; k < SH_COEFFICIENT_COUNT; ++k)
+			irradiance.coefficients[k] += glm::vec4(sums[face].coefficients[k][0], sums[face].coefficients[k][1], sums[face].coefficients[k][2], 0.0f);
+	}
+
+	const f32 normalization = 4.0f * PI / weight;
+	for (u32 k = 0; k < SH_COEFFICIENT_COUNT; ++k)
+	{
+		const u32 band = k == 0 ? 0 : (k < 4 ? 1 : 2);
+		irradiance.coefficients[k] *= normalization * SHBandConvolution[band];
+	}
+	return irradiance;
+}
+
+std::vector<u8> ReadCubemapLevel(GLuint cubemap, u32 level, u32& faceSize)
+{
+	GLenum err;
+
+	GLint width = 0;
+	glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+	glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X, level, GL_TEXTURE_WIDTH, &width);
+	faceSize = (u32)width;
+
+	std::vector<u8> pixels((u64)faceSize * faceSize * 3 * 6);
+	const u64 faceBytes = (u64)faceSize * faceSize * 3;
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	for (u32 face = 0; face < 6 && faceSize > 0; ++face)
+		glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGB, GL_UNSIGNED_BYTE, pixels.data() + face * faceBytes);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+	if ((err = glGetError()) != GL_NO_ERROR)
+	{
+		ELOG("OpenGL error %d reading back level %u of the environment cubemap\n", err, level);
+		faceSize = 0;
+		pixels.clear();
+	}
+	return pixels;
+}
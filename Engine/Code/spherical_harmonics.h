@@ -0,0 +1,31 @@
+//
+// spherical_harmonics.h: Diffuse irradiance of the environment as nine L2 spherical harmonics.
+// The environment cubemap is projected on the CPU once per environment, and the shaders evaluate
+// the nine coefficients with the surface normal instead of sampling an irradiance cubemap.
+//
+
+#pragma once
+
+#include "geometry.h"
+
+#define SH_COEFFICIENT_COUNT 9
+#define SH_IRRADIANCE_LEVEL  3 // Environment cubemap level projected, 64x64 for a 512 cubemap
+
+// Already convolved with the clamped cosine and divided by pi: evaluated with a normal they give
+// the diffuse lighting to multiply by the albedo. vec4 so they can be copied to std140 as is.
+struct SHIrradiance
+{
+	glm::vec4 coefficients[SH_COEFFICIENT_COUNT];
+};
+
+/**
+ * Projects the six faces of a cubemap level, one after the other in GL face order, rows from
+ * t = 0, with 3 or 4 bytes per pixel. The faces are spread over the job system, each one
+ * accumulated with SSE. No GL, safe to call from any thread.
+ */
+SHIrradiance ProjectCubemapIrradiance(const u8* faces, u32 faceSize, u32 channels);
+
+/**
+ * Reads a level of a cubemap back to the CPU for ProjectCubemapIrradiance, as RGB. Main thread.
+ */
+std::vector<u8> ReadCubemapLevel(GLuint cubemap, u32 level, u32& faceSize);
@@ -0,0 +1,257 @@
+#include "texture_array.h"
+
+u32 GetMipLevelCount(u32 width, u32 height)
+{
+	u32 levelCount = 1;
+	while (width > 1 || height > 1)
+	{
+		width = glm::max(width / 2, 1u);
+		height = glm::max(height / 2, 1u);
+		++levelCount;
+	}
+	return levelCount;
+}
+
+// Bytes of one layer with its whole mip chain
+static u64 GetTextureLayerBytes(const TextureArray& array)
+{
+	u32 blockBytes = 0, pixelBytes = 0;
+	switch (array.internalFormat)
+	{
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RED_RGTC1:         blockBytes = 8; break;
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+	case GL_COMPRESSED_RG_RGTC2:
+	case GL_COMPRESSED_RGBA_BPTC_UNORM:   blockBytes = 16; break;
+	case GL_R8:                           pixelBytes = 1; break;
+	case GL_RGB8:                         pixelBytes = 3; break;
+	default:                              pixelBytes = 4; break;
+	}
+
+	u64 bytes = 0;
+	u32 width = array.width, height = array.height;
+	for (u32 level = 0; level < array.levelCount; ++level)
+	{
+		bytes += blockBytes ? (u64)((width + 3) / 4) * ((height + 3) / 4) * blockBytes : (u64)width * height * pixelBytes;
+		width = glm::max(width / 2, 1u);
+		height = glm::max(height / 2, 1u);
+	}
+	return bytes;
+}
+
+static GLuint CreateTextureArrayStorage(GLenum internalFormat, u32 width, u32 height, u32 levelCount, u32 layerCapacity)
+{
+	GLenum err;
+
+	GLuint handle = 0;
+	glGenTextures(1, &handle);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, handle);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, levelCount, internalFormat, width, height, layerCapacity);
+	if ((err = glGetError()) != GL_NO_ERROR)
+		ELOG("OpenGL error %d allocating a %ux%u texture array of %u layers\n", err, width, height, layerCapacity);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	return handle;
+}
+
+// Reallocates the array with twice the layers and copies every level of the used ones over
+static void GrowTextureArray(TextureArray& array)
+{
+	GLenum err;
+
+	const u32 newCapacity = array.layerCapacity * 2;
+	GLuint newHandle = CreateTextureArrayStorage(array.internalFormat, array.width, array.height, array.levelCount, newCapacity);
+
+	u32 width = array.width, height = array.height;
+	for (u32 level = 0; level < array.levelCount; ++level)
+	{
+		glCopyImageSubData(array.handle, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0,
+			newHandle, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0,
+			width, height, array.layerCount);
+		width = glm::max(width / 2, 1u);
+		height = glm::max(height / 2, 1u);
+	}
+	if ((err = glGetError()) != GL_NO_ERROR)
+		ELOG("OpenGL error %d copying texture array layers\n", err);
+	glDeleteTextures(1, &array.handle);
+
+	ILOG("Texture array %ux%u grown from %u to %u layers", array.width, array.height, array.layerCapacity, newCapacity);
+	array.handle = newHandle;
+	array.layerCapacity = newCapacity;
+}
+
+GLenum GetCookedTextureInternalFormat(u32 format)
+{
+	switch (format)
+	{
+	case CookedTextureFormat_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	case CookedTextureFormat_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case CookedTextureFormat_BC4: return GL_COMPRESSED_RED_RGTC1;
+	case CookedTextureFormat_BC5: return GL_COMPRESSED_RG_RGTC2;
+	default:                      return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	}
+}
+
+void GetImageTextureFormats(u32 channels, GLenum* internalFormat, GLenum* dataFormat)
+{
+	*internalFormat = GL_RGBA8;
+	*dataFormat = GL_RGBA;
+	switch (channels)
+	{
+	case 1: *dataFormat = GL_RED; *internalFormat = GL_R8; break;
+	case 3: *dataFormat = GL_RGB; *internalFormat = GL_RGB8; break;
+	case 4: *dataFormat = GL_RGBA; *internalFormat = GL_RGBA8; break;
+	default: ELOG("GetImageTextureFormats() - Unsupported number of channels");
+	}
+}
+
+void InitTextureArrayPool(TextureArrayPool& pool)
+{
+	pool.arrays.clear();
+
+	glGenSamplers(SamplerObject_Count, pool.samplers);
+	const GLint minFilters[SamplerObject_Count] = { GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR };
+	const GLint wraps[SamplerObject_Count] = { GL_CLAMP_TO_EDGE, GL_REPEAT, GL_CLAMP_TO_EDGE };
+	for (u32 i = 0; i < SamplerObject_Count; ++i)
+	{
+		glSamplerParameteri(pool.samplers[i], GL_TEXTURE_MIN_FILTER, minFilters[i]);
+		glSamplerParameteri(pool.samplers[i], GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glSamplerParameteri(pool.samplers[i], GL_TEXTURE_WRAP_S, wraps[i]);
+		glSamplerParameteri(pool.samplers[i], GL_TEXTURE_WRAP_T, wraps[i]);
+		glSamplerParameteri(pool.samplers[i], GL_TEXTURE_WRAP_R, wraps[i]);
+	}
+}
+
+void DestroyTextureArrayPool(TextureArrayPool& pool)
+{
+	for (u32 i = 0; i < pool.arrays.size(); ++i)
+		glDeleteTextures(1, &pool.arrays[i].handle);
+	pool.arrays.clear();
+
+	glDeleteSamplers(SamplerObject_Count, pool.samplers);
+	memset(pool.samplers, 0, sizeof(pool.samplers));
+}
+
+TextureLayer AllocateTextureLayer(TextureArrayPool& pool, GLenum internalFormat, u32 width, u32 height, u32 levelCount)
+{
+	u32 arrayIdx = 0;
+	while (arrayIdx < pool.arrays.size())
+	{
+		const TextureArray& array = pool.arrays[arrayIdx];
+		if (array.internalFormat == internalFormat && array.width == width && array.height == height && array.levelCount == levelCount)
+			break;
+		++arrayIdx;
+	}
+
+	if (arrayIdx == pool.arrays.size())
+	{
+		TextureArray array = {};
+		array.internalFormat = internalFormat;
+		array.width = width;
+		array.height = height;
+		array.levelCount = levelCount;
+		array.layerCapacity = TEXTURE_ARRAY_INITIAL_LAYERS;
+		array.handle = CreateTextureArrayStorage(internalFormat, width, height, levelCount, array.layerCapacity);
+		pool.arrays.push_back(array);
+	}
+
+	TextureArray& array = pool.arrays[arrayIdx];
+	TextureLayer result;
+	result.arrayIdx = arrayIdx;
+	if (!array.freeLayers.empty())
+	{
+		result.layer = array.freeLayers.back();
+		array.freeLayers.pop_back();
+		return result;
+	}
+
+	if (array.layerCount == array.layerCapacity)
+		GrowTextureArray(array);
+	result.layer = array.layerCount++;
+	return result;
+}
+
+void ReleaseTextureLayer(TextureArrayPool& pool, TextureLayer layer)
+{
+	if (layer.arrayIdx >= pool.arrays.size())
+		return;
+
+	// The contents stay until the layer is reused, nothing samples it in the meantime
+	pool.arrays[layer.arrayIdx].freeLayers.push_back(layer.layer);
+}
+
+TextureLayer AddCookedTextureLayer(TextureArrayPool& pool, const CookedTexture& texture)
+{
+	GLenum err;
+
+	const GLenum internalFormat = GetCookedTextureInternalFormat(texture.format);
+	TextureLayer layer = AllocateTextureLayer(pool, internalFormat, texture.width, texture.height, (u32)texture.levels.size());
+	glBindTexture(GL_TEXTURE_2D_ARRAY, pool.arrays[layer.arrayIdx].handle);
+	for (u32 i = 0; i < texture.levels.size(); ++i)
+	{
+		const CookedTextureLevel& level = texture.levels[i];
+		glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, layer.layer, level.width, level.height, 1, internalFormat, level.size, texture.data.data() + level.offset);
+	}
+	if ((err = glGetError()) != GL_NO_ERROR)
+		ELOG("OpenGL error %d uploading a cooked texture layer\n", err);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	return layer;
+}
+
+TextureLayer AddImageTextureLayer(TextureArrayPool& pool, const void* pixels, u32 width, u32 height, u32 channels)
+{
+	GLenum err;
+
+	GLenum internalFormat, dataFormat;
+	GetImageTextureFormats(channels, &internalFormat, &dataFormat);
+
+	const u32 levelCount = GetMipLevelCount(width, height);
+	TextureLayer layer = AllocateTextureLayer(pool, internalFormat, width, height, levelCount);
+	const GLuint arrayHandle = pool.arrays[layer.arrayIdx].handle;
+	glBindTexture(GL_TEXTURE_2D_ARRAY, arrayHandle);
+
+	// Rows are tightly packed, RGB and red rows are not always 4 byte aligned
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer.layer, width, height, 1, dataFormat, GL_UNSIGNED_BYTE, pixels);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	// Mips of the new layer only, through a 2D view of it: on the whole array glGenerateMipmap
+	// would filter every layer again each time one is added
+	GLuint view = 0;
+	glGenTextures(1, &view);
+	glTextureView(view, GL_TEXTURE_2D, arrayHandle, internalFormat, 0, levelCount, layer.layer, 1);
+	glBindTexture(GL_TEXTURE_2D, view);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glDeleteTextures(1, &view);
+	if ((err = glGetError()) != GL_NO_ERROR)
+		ELOG("OpenGL error %d uploading an image texture layer\n", err);
+	return layer;
+}
+
+TextureLayer AddTextureLayerFromTexture(TextureArrayPool& pool, GLuint texture, GLenum internalFormat, u32 width, u32 height, u32 levelCount)
+{
+	GLenum err;
+
+	TextureLayer layer = AllocateTextureLayer(pool, internalFormat, width, height, levelCount);
+	const GLuint arrayHandle = pool.arrays[layer.arrayIdx].handle;
+	for (u32 level = 0; level < levelCount; ++level)
+	{
+		glCopyImageSubData(texture, GL_TEXTURE_2D, level, 0, 0, 0,
+			arrayHandle, GL_TEXTURE_2D_ARRAY, level, 0, 0, layer.layer,
+			width, height, 1);
+		width = glm::max(width / 2, 1u);
+		height = glm::max(height / 2, 1u);
+	}
+	if ((err = glGetError()) != GL_NO_ERROR)
+		ELOG("OpenGL error %d copying a texture into an array layer\n", err);
+	return layer;
+}
+
+u64 GetTextureArrayPoolBytes(const TextureArrayPool& pool)
+{
+	u64 bytes = 0;
+	for (u32 i = 0; i < pool.arrays.size(); ++i)
+		bytes += GetTextureLayerBytes(pool.arrays[i]) * pool.arrays[i].layerCapacity;
+	return bytes;
+}
@@ -0,0 +1,105 @@
+//
+// texture_array.h: Material textures with the same size, level count and format share one
+// immutable GL_TEXTURE_2D_ARRAY (glTexStorage3D), each texture being one layer of it. The
+// filtering state lives in a few sampler objects shared by every array, so drawing a material
+// only binds the arrays that changed since the previous draw and passes the layer of each map.
+//
+
+#pragma once
+
+#include "geometry.h"
+#include "texture_cooker.h"
+
+#define TEXTURE_ARRAY_INITIAL_LAYERS 8
+
+// EXT_texture_compression_s3tc is exposed by every desktop driver, but the glad loader was generated without it
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT  0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+enum SamplerObject
+{
+	SamplerObject_TrilinearClamp,  // Material maps
+	SamplerObject_TrilinearRepeat, // Tiled material maps
+	SamplerObject_LinearClamp,     // Lookup tables, no mips
+	SamplerObject_Count
+};
+
+struct TextureArray
+{
+	GLuint handle;
+	GLenum internalFormat;
+	u32    width;
+	u32    height;
+	u32    levelCount;
+	u32    layerCapacity;           // Layers allocated by glTexStorage3D
+	u32    layerCount;              // Layers handed out so far, released ones included
+	std::vector<u32> freeLayers;    // Released layers below layerCount, reused first
+};
+
+struct TextureLayer
+{
+	u32 arrayIdx = UINT32_MAX; // Into TextureArrayPool::arrays, UINT32_MAX for standalone textures
+	u32 layer = 0;
+};
+
+struct TextureArrayPool
+{
+	std::vector<TextureArray> arrays;
+	GLuint samplers[SamplerObject_Count];
+};
+
+/**
+ * GL internal format of a cooked texture format.
+ */
+GLenum GetCookedTextureInternalFormat(u32 format);
+
+/**
+ * GL internal and pixel formats of an 8 bit image of 1, 3 or 4 channels.
+ */
+void GetImageTextureFormats(u32 channels, GLenum* internalFormat, GLenum* dataFormat);
+
+/**
+ * Levels of a full mip chain down to 1x1.
+ */
+u32 GetMipLevelCount(u32 width, u32 height);
+
+void InitTextureArrayPool(TextureArrayPool& pool);
+
+void DestroyTextureArrayPool(TextureArrayPool& pool);
+
+/**
+ * Takes a layer of the array holding textures of this format, size and level count, creating
+ * the array if there is none. A full array is reallocated with twice the layers and its
+ * contents copied over: its handle changes, the layers of the textures already in it don't.
+ */
+TextureLayer AllocateTextureLayer(TextureArrayPool& pool, GLenum internalFormat, u32 width, u32 height, u32 levelCount);
+
+/**
+ * Gives the layer back to its array, the next texture of the same kind reuses it.
+ */
+void ReleaseTextureLayer(TextureArrayPool& pool, TextureLayer layer);
+
+/**
+ * Uploads every level of a cooked texture into a new layer.
+ */
+TextureLayer AddCookedTextureLayer(TextureArrayPool& pool, const CookedTexture& texture);
+
+/**
+ * Uploads an 8 bit image (1, 3 or 4 channels) into a new layer and generates its mips.
+ */
+TextureLayer AddImageTextureLayer(TextureArrayPool& pool, const void* pixels, u32 width, u32 height, u32 channels);
+
+/**
+ * Copies every level of a 2D texture, created elsewhere with the same format, size and level
+ * count, into a new layer. The copy stays on the GPU.
+ */
+TextureLayer AddTextureLayerFromTexture(TextureArrayPool& pool, GLuint texture, GLenum internalFormat, u32 width, u32 height, u32 levelCount);
+
+/**
+ * GPU memory of every array, free layers included.
+ */
+u64 GetTextureArrayPoolBytes(const TextureArrayPool& pool);
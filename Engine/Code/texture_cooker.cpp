@@ -0,0 +1,630 @@
+#include "texture_cooker.h"
+#include "job_system.h"
+#include "buffer.h"
+#include "mip_generator.h"
+
+#include <algorithm>
+
+struct CookedTextureHeader
+{
+	u32 magic;
+	u32 version;
+	u64 sourceTimestamp;
+	u32 usage;
+	u32 format;
+	u32 width;
+	u32 height;
+	u32 levelCount;
+	u32 sourcePathLength;
+	u32 flippedVertically;
+	u32 padding;
+	u64 dataOffset;       // The level data, aligned so it can be uploaded in place once mapped
+	u64 dataSize;
+};
+
+// 4x4 pixels, RGBA
+typedef u8 PixelBlock[16][4];
+
+CookedTextureFormat ChooseCookedTextureFormat(TextureUsage usage, TextureCookQuality quality, bool hasAlpha)
+{
+	switch (usage)
+	{
+	case TextureUsage_Normal: return CookedTextureFormat_BC5;
+	case TextureUsage_Mask:   return CookedTextureFormat_BC4;
+	default:
+		if (quality == TextureCookQuality_High)
+			return CookedTextureFormat_BC7;
+		return hasAlpha && usage == TextureUsage_Albedo ? CookedTextureFormat_BC3 : CookedTextureFormat_BC1;
+	}
+}
+
+u32 GetCookedTextureBlockSize(u32 format)
+{
+	return format == CookedTextureFormat_BC1 || format == CookedTextureFormat_BC4 ? 8 : 16;
+}
+
+static u32 GetLevelSize(u32 format, u32 width, u32 height)
+{
+	return ((width + 3) / 4) * ((height + 3) / 4) * GetCookedTextureBlockSize(format);
+}
+
+// Principal axis of the colors by power iteration, channels is 3 (RGB) or 4 (RGBA)
+static glm::vec4 ComputePrincipalAxis(const PixelBlock& block, u32 channels, glm::vec4& mean)
+{
+	mean = glm::vec4(0.0f);
+	for (u32 i = 0; i < 16; ++i)
+		for (u32 c = 0; c < channels; ++c)
+			mean[c] += block[i][c] / 16.0f;
+
+	f32 covariance[4][4] = {};
+	for (u32 i = 0; i < 16; ++i)
+	{
+		f32 d[4] = {};
+		for (u32 c = 0; c < channels; ++c)
+			d[c] = block[i][c] - mean[c];
+		for (u32 a = 0; a < channels; ++a)
+			for (u32 b = 0; b < channels; ++b)
+				covariance[a][b] += d[a] * d[b];
+	}
+
+	glm::vec4 axis = glm::vec4(1.0f, 1.0f, 1.0f, channels == 4 ? 1.0f : 0.0f);
+	for (u32 iteration = 0; iteration < 8; ++iteration)
+	{
+		glm::vec4 next = glm::vec4(0.0f);
+		for (u32 a = 0; a < channels; ++a)
+			for (u32 b = 0; b < channels; ++b)
+				next[a] += covariance[a][b] * axis[b];
+
+		const f32 length = glm::length(next);
+		if (length <= 1e-6f)
+			break;
+		axis = next / length;
+	}
+	return axis;
+}
+
+/* BC1 */
+
+static u16 PackRgb565(glm::vec3 color)
+{
+	const u32 r = (u32)glm::clamp(color.r * 31.0f / 255.0f + 0.5f, 0.0f, 31.0f);
+	const u32 g = (u32)glm::clamp(color.g * 63.0f / 255.0f + 0.5f, 0.0f, 63.0f);
+	const u32 b = (u32)glm::clamp(color.b * 31.0f / 255.0f + 0.5f, 0.0f, 31.0f);
+	return (u16)((r << 11) | (g << 5) | b);
+}
+
+static glm::vec3 UnpackRgb565(u16 color)
+{
+	const u32 r = (color >> 11) & 31;
+	const u32 g = (color >> 5) & 63;
+	const u32 b = color & 31;
+	return glm::vec3((f32)((r << 3) | (r >> 2)), (f32)((g << 2) | (g >> 4)), (f32)((b << 3) | (b >> 2)));
+}
+
+// Picks the closest of the four colors for every pixel, returns the squared error
+static f32 AssignBC1Indices(const PixelBlock& block, u16 color0, u16 color1, u32& indices)
+{
+	glm::vec3 palette[4];
+	palette[0] = UnpackRgb565(color0);
+	palette[1] = UnpackRgb565(color1);
+	palette[2] = (2.0f * palette[0] + palette[1]) / 3.0f;
+	palette[3] = (palette[0] + 2.0f * palette[1]) / 3.0f;
+
+	f32 error = 0.0f;
+	indices = 0;
+	for (u32 i = 0; i < 16; ++i)
+	{
+		const glm::vec3 color = glm::vec3(block[i][0], block[i][1], block[i][2]);
+		u32 best = 0;
+		f32 bestDistance = FLT_MAX;
+		for (u32 p = 0; p < (color0 == color1 ? 1u : 4u); ++p)
+		{
+			const glm::vec3 d = color - palette[p];
+			const f32 distance = glm::dot(d, d);
+			if (distance < bestDistance)
+			{
+				bestDistance = distance;
+				best = p;
+			}
+		}
+		indices |= best << (i * 2);
+		error += bestDistance;
+	}
+	return error;
+}
+
+// Endpoints that minimize the squared error for the given indices (least squares)
+static bool FitBC1Endpoints(const PixelBlock& block, u32 indices, glm::vec3& endpoint0, glm::vec3& endpoint1)
+{
+	static const f32 Weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f }; // Of endpoint1
+
+	f32 aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	glm::vec3 ax = glm::vec3(0.0f), bx = glm::vec3(0.0f);
+	for (u32 i = 0; i < 16; ++i)
+	{
+		const f32 w = Weights[(indices >> (i * 2)) & 3];
+		const glm::vec3 color = glm::vec3(block[i][0], block[i][1], block[i][2]);
+		aa += (1.0f - w) * (1.0f - w);
+		ab += (1.0f - w) * w;
+		bb += w * w;
+		ax += (1.0f - w) * color;
+		bx += w * color;
+	}
+
+	const f32 determinant = aa * bb - ab * ab;
+	if (fabsf(determinant) < 1e-6f)
+		return false;
+	endpoint0 = glm::clamp((ax * bb - bx * ab) / determinant, 0.0f, 255.0f);
+	endpoint1 = glm::clamp((bx * aa - ax * ab) / determinant, 0.0f, 255.0f);
+	return true;
+}
+
+static void EncodeBC1(const PixelBlock& block, u8* out)
+{
+	glm::vec4 mean;
+	const glm::vec4 axis = ComputePrincipalAxis(block, 3, mean);
+
+	f32 minT = FLT_MAX, maxT = -FLT_MAX;
+	for (u32 i = 0; i < 16; ++i)
+	{
+		const f32 t = glm::dot(glm::vec3(block[i][0], block[i][1], block[i][2]) - glm::vec3(mean), glm::vec3(axis));
+		minT = glm::min(minT, t);
+		maxT = glm::max(maxT, t);
+	}
+
+	u16 color0 = PackRgb565(glm::vec3(mean) + glm::vec3(axis) * maxT);
+	u16 color1 = PackRgb565(glm::vec3(mean) + glm::vec3(axis) * minT);
+	u32 indices;
+	f32 error = AssignBC1Indices(block, color0, color1, indices);
+
+	// One refinement of the endpoints for the indices just picked
+	glm::vec3 endpoint0, endpoint1;
+	if (color0 != color1 && FitBC1Endpoints(block, indices, endpoint0, endpoint1))
+	{
+		const u16 refined0 = PackRgb565(endpoint0);
+		const u16 refined1 = PackRgb565(endpoint1);
+		u32 refinedIndices;
+		const f32 refinedError = AssignBC1Indices(block, refined0, refined1, refinedIndices);
+		if (refinedError < error)
+		{
+			color0 = refined0;
+			color1 = refined1;
+			indices = refinedIndices;
+		}
+	}
+
+	// color0 > color1 selects the four color mode, swapping the endpoints swaps indices 0-1 and 2-3
+	if (color0 < color1)
+	{
+		std::swap(color0, color1);
+		indices ^= 0x55555555;
+	}
+
+	memcpy(out, &color0, 2);
+	memcpy(out + 2, &color1, 2);
+	memcpy(out + 4, &indices, 4);
+}
+
+/* BC4 */
+
+static void EncodeBC4(const u8 values[16], u8* out)
+{
+	u8 minValue = 255, maxValue = 0;
+	for (u32 i = 0; i < 16; ++i)
+	{
+		minValue = glm::min(minValue, values[i]);
+		maxValue = glm::max(maxValue, values[i]);
+	}
+
+	// value0 > value1 selects the eight value mode: value0, value1 and six steps in between
+	out[0] = maxValue;
+	out[1] = minValue;
+	u64 indices = 0;
+	if (maxValue > minValue)
+	{
+		u8 palette[8];
+		palette[0] = maxValue;
+		palette[1] = minValue;
+		for (u32 p = 1; p < 7; ++p)
+			palette[p + 1] = (u8)(((7 - p) * maxValue + p * minValue + 3) / 7);
+
+		for (u32 i = 0; i < 16; ++i)
+		{
+			u32 best = 0;
+			u32 bestDistance = UINT32_MAX;
+			for (u32 p = 0; p < 8; ++p)
+			{
+				const u32 distance = (u32)abs((i32)values[i] - (i32)palette[p]);
+				if (distance < bestDistance)
+				{
+					bestDistance = distance;
+					best = p;
+				}
+			}
+			indices |= (u64)best << (i * 3);
+		}
+	}
+
+	for (u32 b = 0; b < 6; ++b)
+		out[2 + b] = (u8)(indices >> (b * 8));
+}
+
+/* BC7 */
+
+static const u32 BC7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct BC7Mode6Block
+{
+	u8  endpoints[2][4]; // 7 bits per channel
+	u8  pbits[2];
+	u8  indices[16];     // 4 bits
+	f32 error;
+};
+
+static glm::vec4 ExpandBC7Endpoint(const u8 endpoint[4], u8 pbit)
+{
+	return glm::vec4((f32)((endpoint[0] << 1) | pbit), (f32)((endpoint[1] << 1) | pbit),
+		(f32)((endpoint[2] << 1) | pbit), (f32)((endpoint[3] << 1) | pbit));
+}
+
+// Quantizes both endpoints for the given p-bits and picks the indices
+static void EvaluateBC7Mode6(const PixelBlock& block, glm::vec4 endpoint0, glm::vec4 endpoint1, u8 pbit0, u8 pbit1, BC7Mode6Block& result)
+{
+	for (u32 c = 0; c < 4; ++c)
+	{
+		result.endpoints[0][c] = (u8)glm::clamp((endpoint0[c] - pbit0) * 0.5f + 0.5f, 0.0f, 127.0f);
+		result.endpoints[1][c] = (u8)glm::clamp((endpoint1[c] - pbit1) * 0.5f + 0.5f, 0.0f, 127.0f);
+	}
+	result.pbits[0] = pbit0;
+	result.pbits[1] = pbit1;
+
+	const glm::vec4 e0 = ExpandBC7Endpoint(result.endpoints[0], pbit0);
+	const glm::vec4 e1 = ExpandBC7Endpoint(result.endpoints[1], pbit1);
+	glm::vec4 palette[16];
+	for (u32 p = 0; p < 16; ++p)
+		palette[p] = glm::floor(((64.0f - BC7Weights4[p]) * e0 + (f32)BC7Weights4[p] * e1 + 32.0f) / 64.0f);
+
+	result.error = 0.0f;
+	for (u32 i = 0; i < 16; ++i)
+	{
+		const glm::vec4 color = glm::vec4(block[i][0], block[i][1], block[i][2], block[i][3]);
+		u32 best = 0;
+		f32 bestDistance = FLT_MAX;
+		for (u32 p = 0; p < 16; ++p)
+		{
+			const glm::vec4 d = color - palette[p];
+			const f32 distance = glm::dot(d, d);
+			if (distance < bestDistance)
+			{
+				bestDistance = distance;
+				best = p;
+			}
+		}
+		result.indices[i] = (u8)best;
+		result.error += bestDistance;
+	}
+}
+
+static void EvaluateBC7Mode6AllPbits(const PixelBlock& block, glm::vec4 endpoint0, glm::vec4 endpoint1, BC7Mode6Block& best)
+{
+	for (u8 pbits = 0; pbits < 4; ++pbits)
+	{
+		BC7Mode6Block candidate;
+		EvaluateBC7Mode6(block, endpoint0, endpoint1, pbits & 1, pbits >> 1, candidate);
+		if (candidate.error < best.error)
+			best = candidate;
+	}
+}
+
+static void WriteBits(u8* out, u32& bitOffset, u32 value, u32 bitCount)
+{
+	for (u32 b = 0; b < bitCount; ++b, ++bitOffset)
+	{
+		if (value & (1u << b))
+			out[bitOffset >> 3] |= (u8)(1u << (bitOffset & 7));
+	}
+}
+
+static void EncodeBC7(const PixelBlock& block, u8* out)
+{
+	glm::vec4 mean;
+	const glm::vec4 axis = ComputePrincipalAxis(block, 4, mean);
+
+	f32 minT = FLT_MAX, maxT = -FLT_MAX;
+	for (u32 i = 0; i < 16; ++i)
+	{
+		const f32 t = glm::dot(glm::vec4(block[i][0], block[i][1], block[i][2], block[i][3]) - mean, axis);
+		minT = glm::min(minT, t);
+		maxT = glm::max(maxT, t);
+	}
+
+	BC7Mode6Block best = {};
+	best.error = FLT_MAX;
+	EvaluateBC7Mode6AllPbits(block, glm::clamp(mean + axis * minT, 0.0f, 255.0f), glm::clamp(mean + axis * maxT, 0.0f, 255.0f), best);
+
+	// One least squares refinement of the endpoints for the indices just picked
+	f32 aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	glm::vec4 ax = glm::vec4(0.0f), bx = glm::vec4(0.0f);
+	for (u32 i = 0; i < 16; ++i)
+	{
+		const f32 w = BC7Weights4[best.indices[i]] / 64.0f;
+		const glm::vec4 color = glm::vec4(block[i][0], block[i][1], block[i][2], block[i][3]);
+		aa += (1.0f - w) * (1.0f - w);
+		ab += (1.0f - w) * w;
+		bb += w * w;
+		ax += (1.0f - w) * color;
+		bx += w * color;
+	}
+	const f32 determinant = aa * bb - ab * ab;
+	if (fabsf(determinant) > 1e-6f)
+	{
+		const glm::vec4 endpoint0 = glm::clamp((ax * bb - bx * ab) / determinant, 0.0f, 255.0f);
+		const glm::vec4 endpoint1 = glm::clamp((bx * aa - ax * ab) / determinant, 0.0f, 255.0f);
+		EvaluateBC7Mode6AllPbits(block, endpoint0, endpoint1, best);
+	}
+
+	// The first index is stored without its top bit, so it must be below 8
+	if (best.indices[0] >= 8)
+	{
+		std::swap(best.endpoints[0], best.endpoints[1]);
+		std::swap(best.pbits[0], best.pbits[1]);
+		for (u32 i = 0; i < 16; ++i)
+			best.indices[i] = 15 - best.indices[i];
+	}
+
+	memset(out, 0, 16);
+	u32 bitOffset = 0;
+	WriteBits(out, bitOffset, 1u << 6, 7); // Mode 6
+	for (u32 c = 0; c < 4; ++c)
+	{
+		WriteBits(out, bitOffset, best.endpoints[0][c], 7);
+		WriteBits(out, bitOffset, best.endpoints[1][c], 7);
+	}
+	WriteBits(out, bitOffset, best.pbits[0], 1);
+	WriteBits(out, bitOffset, best.pbits[1], 1);
+	WriteBits(out, bitOffset, best.indices[0], 3);
+	for (u32 i = 1; i < 16; ++i)
+		WriteBits(out, bitOffset, best.indices[i], 4);
+}
+
+/* COOKING */
+
+// Pixels out of the image repeat the last row and column
+static void ReadPixelBlock(const u8* rgba, u32 width, u32 height, u32 blockX, u32 blockY, PixelBlock& block)
+{
+	for (u32 y = 0; y < 4; ++y)
+	{
+		const u32 py = glm::min(blockY * 4 + y, height - 1);
+		for (u32 x = 0; x < 4; ++x)
+		{
+			const u32 px = glm::min(blockX * 4 + x, width - 1);
+			memcpy(block[y * 4 + x], rgba + ((u64)py * width + px) * 4, 4);
+		}
+	}
+}
+
+static void EncodeBlock(const PixelBlock& block, u32 format, u8* out)
+{
+	u8 channel[16];
+	switch (format)
+	{
+	case CookedTextureFormat_BC1:
+		EncodeBC1(block, out);
+		break;
+	case CookedTextureFormat_BC3:
+		for (u32 i = 0; i < 16; ++i)
+			channel[i] = block[i][3];
+		EncodeBC4(channel, out);
+		EncodeBC1(block, out + 8);
+		break;
+	case CookedTextureFormat_BC4:
+		for (u32 i = 0; i < 16; ++i)
+			channel[i] = block[i][0];
+		EncodeBC4(channel, out);
+		break;
+	case CookedTextureFormat_BC5:
+		for (u32 c = 0; c < 2; ++c)
+		{
+			for (u32 i = 0; i < 16; ++i)
+				channel[i] = block[i][c];
+			EncodeBC4(channel, out + c * 8);
+		}
+		break;
+	default:
+		EncodeBC7(block, out);
+		break;
+	}
+}
+
+static void EncodeLevel(const u8* rgba, u32 width, u32 height, u32 format, u8* out)
+{
+	const u32 blocksX = (width + 3) / 4;
+	const u32 blocksY = (height + 3) / 4;
+	const u32 blockSize = GetCookedTextureBlockSize(format);
+
+	ParallelFor(blocksY, [&](u32 blockY) {
+		PixelBlock block;
+		for (u32 blockX = 0; blockX < blocksX; ++blockX)
+		{
+			ReadPixelBlock(rgba, width, height, blockX, blockY, block);
+			EncodeBlock(block, format, out + ((u64)blockY * blocksX + blockX) * blockSize);
+		}
+	});
+}
+
+bool CookTexture(const u8* pixels, u32 width, u32 height, u32 channels, TextureUsage usage, TextureCookQuality quality, CookedTexture& result)
+{
+	if (usage == TextureUsage_Raw || !pixels || width == 0 || height == 0 || channels == 0 || channels > 4)
+		return false;
+
+	// Everything is encoded from RGBA, gray images (with or without alpha) spread to RGB
+	std::vector<u8> rgba((u64)width * height * 4);
+	bool hasAlpha = false;
+	for (u64 i = 0; i < (u64)width * height; ++i)
+	{
+		const u8* src = pixels + i * channels;
+		u8* dst = &rgba[i * 4];
+		if (channels <= 2)
+			dst[0] = dst[1] = dst[2] = src[0];
+		else
+			memcpy(dst, src, 3);
+		dst[3] = channels == 2 ? src[1] : channels == 4 ? src[3] : 255;
+		hasAlpha |= dst[3] != 255;
+	}
+
+	result = {};
+	result.usage = usage;
+	result.format = ChooseCookedTextureFormat(usage, quality, hasAlpha);
+	result.width = width;
+	result.height = height;
+
+	// Colors are filtered in linear space, normals renormalized, and cutout alpha keeps its coverage
+	MipSettings mipSettings;
+	mipSettings.filter = quality == TextureCookQuality_High ? MipFilter_Kaiser : MipFilter_Box;
+	mipSettings.srgb = usage == TextureUsage_Albedo;
+	mipSettings.normalMap = usage == TextureUsage_Normal;
+	mipSettings.alphaCoverageReference = usage == TextureUsage_Albedo && hasAlpha ? COOKED_TEXTURE_ALPHA_REFERENCE : 0.0f;
+	const std::vector<MipLevel> mips = GenerateMipChain(rgba.data(), width, height, mipSettings);
+
+	for (u32 i = 0; i < mips.size(); ++i)
+	{
+		CookedTextureLevel level = {};
+		level.width = mips[i].width;
+		level.height = mips[i].height;
+		level.offset = (u32)result.data.size();
+		level.size = GetLevelSize(result.format, level.width, level.height);
+		result.levels.push_back(level);
+
+		result.data.resize(result.data.size() + level.size);
+		EncodeLevel(mips[i].rgba.data(), level.width, level.height, result.format, result.data.data() + level.offset);
+	}
+
+	return true;
+}
+
+/* CONTAINER */
+
+// One file per usage and row order, so a source used as two kinds of map keeps both cooked
+static std::string GetCookedTexturePath(const char* sourcePath, u32 usage, bool flippedVertically)
+{
+	static const char* UsageNames[] = { ".raw", ".albedo", ".normal", ".mask", ".orm" };
+	std::string path = sourcePath;
+	path += usage < ARRAY_COUNT(UsageNames) ? UsageNames[usage] : ".unknown";
+	if (!flippedVertically)
+		path += ".unflipped";
+	return path + COOKED_TEXTURE_EXTENSION;
+}
+
+bool SaveCookedTexture(const char* sourcePath, const CookedTexture& texture)
+{
+	CookedTextureHeader header = {};
+	header.magic = COOKED_TEXTURE_MAGIC;
+	header.version = COOKED_TEXTURE_VERSION;
+	header.sourceTimestamp = GetFileLastWriteTimestamp(sourcePath);
+	header.usage = texture.usage;
+	header.format = texture.format;
+	header.width = texture.width;
+	header.height = texture.height;
+	header.levelCount = (u32)texture.levels.size();
+	header.flippedVertically = texture.flippedVertically ? 1 : 0;
+	header.sourcePathLength = (u32)strlen(sourcePath);
+	header.dataOffset = Align((u32)(sizeof(header) + header.sourcePathLength + header.levelCount * sizeof(CookedTextureLevel)), 16);
+	header.dataSize = texture.data.size();
+
+	// Written aside and renamed into place: a partial file would have a valid header
+	std::string cookedPath = GetCookedTexturePath(sourcePath, texture.usage, texture.flippedVertically);
+	const std::string tempPath = GetTempFilePath(cookedPath.c_str());
+	FILE* file = fopen(tempPath.c_str(), "wb");
+	if (!file)
+	{
+		ELOG("fopen() failed writing cooked texture %s", cookedPath.c_str());
+		return false;
+	}
+
+	const u8 zeros[16] = {};
+	const u64 metadataSize = sizeof(header) + header.sourcePathLength + header.levelCount * sizeof(CookedTextureLevel);
+	const u64 paddingSize = header.dataOffset - metadataSize;
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(sourcePath, 1, header.sourcePathLength, file) == header.sourcePathLength &&
+		fwrite(texture.levels.data(), sizeof(CookedTextureLevel), texture.levels.size(), file) == texture.levels.size() &&
+		fwrite(zeros, 1, paddingSize, file) == paddingSize &&
+		fwrite(texture.data.data(), 1, texture.data.size(), file) == texture.data.size();
+	written = fclose(file) == 0 && written;
+	if (!written)
+	{
+		ELOG("fwrite() failed writing cooked texture %s", cookedPath.c_str());
+		remove(tempPath.c_str());
+		return false;
+	}
+	return RenameFileOver(tempPath.c_str(), cookedPath.c_str());
+}
+
+bool LoadCookedTexture(const char* sourcePath, TextureUsage usage, bool flippedVertically, CookedTexture& result)
+{
+	return LoadCookedTextureLevels(sourcePath, usage, flippedVertically, 0, UINT32_MAX, result);
+}
+
+bool LoadCookedTextureLevels(const char* sourcePath, TextureUsage usage, bool flippedVertically, u32 firstLevel, u32 lastLevel, CookedTexture& result)
+{
+	std::string cookedPath = GetCookedTexturePath(sourcePath, usage, flippedVertically);
+	MappedFile file = MapFile(cookedPath.c_str());
+	if (!file.data)
+		return false;
+
+	const u8* base = (const u8*)file.data;
+	CookedTextureHeader header;
+	bool valid = file.size >= sizeof(header);
+	if (valid)
+	{
+		memcpy(&header, base, sizeof(header));
+		const u64 levelsOffset = sizeof(header) + header.sourcePathLength;
+		valid = header.magic == COOKED_TEXTURE_MAGIC &&
+			header.version == COOKED_TEXTURE_VERSION &&
+			header.usage == (u32)usage &&
+			header.flippedVertically == (flippedVertically ? 1u : 0u) &&
+			header.format <= CookedTextureFormat_BC7 &&
+			header.sourceTimestamp == GetFileLastWriteTimestamp(sourcePath) &&
+			header.sourcePathLength == (u32)strlen(sourcePath) &&
+			levelsOffset + header.levelCount * sizeof(CookedTextureLevel) <= header.dataOffset &&
+			header.dataOffset + header.dataSize <= file.size &&
+			memcmp(base + sizeof(header), sourcePath, header.sourcePathLength) == 0;
+
+		if (valid)
+		{
+			result = {};
+			result.usage = header.usage;
+			result.format = header.format;
+			result.width = header.width;
+			result.height = header.height;
+			result.flippedVertically = flippedVertically;
+			result.levels.resize(header.levelCount);
+			memcpy(result.levels.data(), base + levelsOffset, header.levelCount * sizeof(CookedTextureLevel));
+
+			// Every level must be where and as big as its size says
+			for (u32 i = 0; i < header.levelCount && valid; ++i)
+			{
+				const CookedTextureLevel& level = result.levels[i];
+				valid = level.size == GetLevelSize(header.format, level.width, level.height) &&
+					(u64)level.offset + level.size <= header.dataSize;
+			}
+			valid = valid && header.levelCount > 0 && firstLevel < header.levelCount && firstLevel <= lastLevel;
+		}
+	}
+
+	if (valid)
+	{
+		// Levels are stored from the largest, the range is one contiguous block of data
+		lastLevel = glm::min(lastLevel, header.levelCount - 1);
+		const u32 dataBegin = result.levels[firstLevel].offset;
+		const u32 dataEnd = result.levels[lastLevel].offset + result.levels[lastLevel].size;
+		result.levels = std::vector<CookedTextureLevel>(result.levels.begin() + firstLevel, result.levels.begin() + lastLevel + 1);
+		for (u32 i = 0; i < result.levels.size(); ++i)
+			result.levels[i].offset -= dataBegin;
+		result.width = result.levels[0].width;
+		result.height = result.levels[0].height;
+		result.data.assign(base + header.dataOffset + dataBegin, base + header.dataOffset + dataEnd);
+	}
+
+	UnmapFile(file);
+	return valid;
+}
@@ -0,0 +1,96 @@
+//
+// texture_cooker.h: CPU encoder of block compressed (BC) textures and the container they are
+// stored in next to their source image. A cooked texture holds its whole mip chain already
+// encoded, so loading it is a plain glCompressedTexImage2D per level. Nothing here touches GL,
+// so the cooker also runs on machines without a GPU.
+//
+
+#pragma once
+
+#include "platform.h"
+
+#define COOKED_TEXTURE_MAGIC     0x58455443 // "CTEX"
+#define COOKED_TEXTURE_VERSION   3
+#define COOKED_TEXTURE_EXTENSION ".ctex"
+#define COOKED_TEXTURE_ALPHA_REFERENCE 0.5f // Alpha test reference whose coverage the albedo mips keep
+
+enum TextureUsage
+{
+	TextureUsage_Raw,    // Uploaded as decoded, never cooked (default textures, lookup tables, panoramas...)
+	TextureUsage_Albedo, // Color, with alpha if the image has any
+	TextureUsage_Normal, // Tangent space normals, only X and Y are kept (the shaders rebuild Z)
+	TextureUsage_Mask,   // One channel, read from red
+	TextureUsage_ORM,    // Occlusion, roughness and metallic in red, green and blue
+};
+
+enum TextureCookQuality
+{
+	TextureCookQuality_Fast, // BC1 or BC3 for albedo, BC1 for ORM
+	TextureCookQuality_High, // BC7 for albedo and ORM
+};
+
+enum CookedTextureFormat
+{
+	CookedTextureFormat_BC1, // RGB, 4 bits per pixel
+	CookedTextureFormat_BC3, // RGB as BC1 plus alpha as BC4, 8 bits per pixel
+	CookedTextureFormat_BC4, // R, 4 bits per pixel
+	CookedTextureFormat_BC5, // RG as two BC4 blocks, 8 bits per pixel
+	CookedTextureFormat_BC7, // RGBA (mode 6 blocks), 8 bits per pixel
+};
+
+struct CookedTextureLevel
+{
+	u32 width;
+	u32 height;
+	u32 offset; // Into CookedTexture::data
+	u32 size;
+};
+
+struct CookedTexture
+{
+	u32 usage;
+	u32 format;
+	u32 width;
+	u32 height;
+	bool flippedVertically; // The source rows were flipped when decoded (bottom row first)
+	std::vector<CookedTextureLevel> levels; // Level 0 first, down to 1x1
+	std::vector<u8> data;
+};
+
+/**
+ * Block format used for a usage: BC5 for normals, BC4 for masks, and for albedo and ORM BC7
+ * with the high quality, BC1 (BC3 if an albedo image has alpha) otherwise.
+ */
+CookedTextureFormat ChooseCookedTextureFormat(TextureUsage usage, TextureCookQuality quality, bool hasAlpha);
+
+/**
+ * Bytes of each 4x4 block of the format.
+ */
+u32 GetCookedTextureBlockSize(u32 format);
+
+/**
+ * Builds the mip chain of the image (1 to 4 channels, 8 bits each, rows tightly packed) with
+ * the mip generator, Kaiser filtered with the high quality and box filtered otherwise, and
+ * encodes every level. The blocks are spread over the job system. Returns false for
+ * TextureUsage_Raw or an empty image.
+ */
+bool CookTexture(const u8* pixels, u32 width, u32 height, u32 channels, TextureUsage usage, TextureCookQuality quality, CookedTexture& result);
+
+/**
+ * Writes the cooked texture next to the source image, keyed by the source path and last
+ * write timestamp. Each usage and row order has its own file (image.png.albedo.ctex).
+ */
+bool SaveCookedTexture(const char* sourcePath, const CookedTexture& texture);
+
+/**
+ * Reads the cooked texture of the source image if there is one, it was cooked for the same
+ * usage and row order, and the source hasn't changed since. Safe to call from any thread.
+ */
+bool LoadCookedTexture(const char* sourcePath, TextureUsage usage, bool flippedVertically, CookedTexture& result);
+
+/**
+ * Like LoadCookedTexture, but only reads the levels from firstLevel to lastLevel (clamped to
+ * the last one). The result is the texture those levels make: its size is the one of
+ * firstLevel and its level offsets start at 0.
+ */
+bool LoadCookedTextureLevels(const char* sourcePath, TextureUsage usage, bool flippedVertically, u32 firstLevel, u32 lastLevel, CookedTexture& result);
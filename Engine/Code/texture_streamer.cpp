@@ -0,0 +1,381 @@
+#include "texture_streamer.h"
+#include "engine.h"
+#include "gpu_uploader.h"
+#include "job_system.h"
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+
+// Levels read by the workers, waiting for UpdateTextureStreamer to upload them
+struct TextureStreamingQueue
+{
+	struct Completion
+	{
+		u32           streamIdx;
+		u32           firstLevel;
+		bool          valid;
+		CookedTexture levels;          // Without their data once uploaded
+		GLuint        uploadedTexture; // The levels in a 2D texture made by the upload thread, 0 if not
+	};
+
+	std::mutex             mutex;
+	std::deque<Completion> completed;
+};
+
+bool ShouldStreamTexture(const CookedTexture& texture)
+{
+	return glm::max(texture.width, texture.height) > TEXTURE_STREAMING_MIN_SIZE && texture.levels.size() > 1;
+}
+
+u32 GetStreamingInitialLevel(const CookedTexture& texture)
+{
+	u32 level = 0;
+	while (level + 1 < texture.levels.size() && glm::max(texture.levels[level].width, texture.levels[level].height) > TEXTURE_STREAMING_RESIDENT_SIZE)
+		++level;
+	return level;
+}
+
+static u64 GetLevelRangeBytes(const StreamedTexture& texture, u32 firstLevel, u32 endLevel)
+{
+	u64 bytes = 0;
+	for (u32 i = firstLevel; i < endLevel && i < texture.levels.size(); ++i)
+		bytes += texture.levels[i].size;
+	return bytes;
+}
+
+// Uploads the levels of the cooked texture from srcFirst on to the bound texture, from dstFirst on
+static void UploadCookedLevels(GLenum target, GLenum internalFormat, const CookedTexture& texture, u32 srcFirst, u32 dstFirst)
+{
+	for (u32 i = srcFirst; i < texture.levels.size(); ++i)
+	{
+		const CookedTextureLevel& level = texture.levels[i];
+		const GLint dstLevel = (GLint)(dstFirst + i - srcFirst);
+		if (target == GL_TEXTURE_2D_ARRAY)
+			glCompressedTexSubImage3D(target, dstLevel, 0, 0, 0, level.width, level.height, 1, internalFormat, level.size, texture.data.data() + level.offset);
+		else
+			glCompressedTexSubImage2D(target, dstLevel, 0, 0, level.width, level.height, internalFormat, level.size, texture.data.data() + level.offset);
+	}
+}
+
+static GLuint CreateStreamedTextureStorage(GLenum target, GLenum internalFormat, u32 width, u32 height, u32 levelCount)
+{
+	GLenum err;
+
+	GLuint handle = 0;
+	glGenTextures(1, &handle);
+	glBindTexture(target, handle);
+	if (target == GL_TEXTURE_2D_ARRAY)
+		glTexStorage3D(target, levelCount, internalFormat, width, height, 1);
+	else
+		glTexStorage2D(target, levelCount, internalFormat, width, height);
+	if ((err = glGetError()) != GL_NO_ERROR)
+		ELOG("OpenGL error %d allocating a %ux%u streamed texture\n", err, width, height);
+	return handle;
+}
+
+GLuint CreateStreamedTexture(const CookedTexture& texture, u32 firstLevel, bool bindless)
+{
+	GLenum err;
+
+	const GLenum target = bindless ? GL_TEXTURE_2D : GL_TEXTURE_2D_ARRAY;
+	const GLenum internalFormat = GetCookedTextureInternalFormat(texture.format);
+	const CookedTextureLevel& first = texture.levels[firstLevel];
+	GLuint handle = CreateStreamedTextureStorage(target, internalFormat, first.width, first.height, (u32)texture.levels.size() - firstLevel);
+	UploadCookedLevels(target, internalFormat, texture, firstLevel, 0);
+	if ((err = glGetError()) != GL_NO_ERROR)
+		ELOG("OpenGL error %d uploading a streamed texture\n", err);
+	glBindTexture(target, 0);
+	return handle;
+}
+
+u32 AddStreamedTexture(TextureStreamer& streamer, u32 textureIdx, const std::string& filepath, TextureUsage usage, const CookedTexture& texture, u32 residentLevel)
+{
+	if (!streamer.queue)
+		streamer.queue = std::make_shared<TextureStreamingQueue>();
+
+	StreamedTexture streamed = {};
+	streamed.textureIdx = textureIdx;
+	streamed.filepath = filepath;
+	streamed.usage = usage;
+	streamed.flippedVertically = texture.flippedVertically;
+	streamed.format = texture.format;
+	streamed.levels = texture.levels;
+	streamed.residentLevel = residentLevel;
+	streamed.minimumLevel = residentLevel;
+	streamed.requestedLevel = residentLevel;
+	streamed.requestFrame = UINT64_MAX;
+	streamer.textures.push_back(streamed);
+
+	streamer.residentBytes += GetLevelRangeBytes(streamed, residentLevel, (u32)texture.levels.size());
+	return (u32)streamer.textures.size() - 1;
+}
+
+void RemoveStreamedTexture(TextureStreamer& streamer, u32 streamIdx)
+{
+	if (streamIdx >= streamer.textures.size())
+		return;
+
+	StreamedTexture& streamed = streamer.textures[streamIdx];
+	streamer.residentBytes -= GetLevelRangeBytes(streamed, streamed.residentLevel, (u32)streamed.levels.size());
+	streamed.textureIdx = UINT32_MAX;
+	streamed.levels.clear();
+}
+
+static void RequestTextureLevel(App* app, u32 textureIdx, f32 screenPixels)
+{
+	if (textureIdx >= app->textures.size() || app->textures[textureIdx].streamIdx == UINT32_MAX)
+		return;
+
+	TextureStreamer& streamer = app->textureStreamer;
+	StreamedTexture& streamed = streamer.textures[app->textures[textureIdx].streamIdx];
+	const f32 texels = (f32)glm::max(streamed.levels[0].width, streamed.levels[0].height);
+	const f32 levelf = screenPixels > 0.0f ? floorf(log2f(texels / screenPixels)) : (f32)streamed.levels.size();
+	const u32 level = (u32)glm::clamp(levelf, 0.0f, (f32)streamed.levels.size() - 1.0f);
+
+	if (streamed.requestFrame != streamer.frame)
+	{
+		streamed.requestFrame = streamer.frame;
+		streamed.requestedLevel = level;
+	}
+	streamed.requestedLevel = glm::min(streamed.requestedLevel, level);
+	streamed.lastUsedFrame = streamer.frame;
+}
+
+void RequestModelTextureLevels(App* app, const Model& model, f32 screenPixels)
+{
+	for (u32 i = 0; i < model.materialIdx.size(); ++i)
+	{
+		if (model.materialIdx[i] >= app->materials.size())
+			continue;
+
+		const Material& material = app->materials[model.materialIdx[i]];
+		RequestTextureLevel(app, material.albedoTextureIdx, screenPixels);
+		RequestTextureLevel(app, material.normalsTextureIdx, screenPixels);
+		RequestTextureLevel(app, material.ormTextureIdx, screenPixels);
+	}
+}
+
+// Moves the texture to new storage holding the levels from firstLevel on. The levels it already has
+// are copied, the finer ones come from the levels read from disk (which start at firstLevel), copied
+// on the GPU too if the upload thread already made a texture of them.
+static void SetResidentLevel(App* app, StreamedTexture& streamed, u32 firstLevel, const TextureStreamingQueue::Completion* loaded)
+{
+	GLenum err;
+
+	Texture& tex = app->textures[streamed.textureIdx];
+	const GLenum target = app->bindlessTextures ? GL_TEXTURE_2D : GL_TEXTURE_2D_ARRAY;
+	const GLenum internalFormat = GetCookedTextureInternalFormat(streamed.format);
+	const u32 levelCount = (u32)streamed.levels.size();
+	const CookedTextureLevel& first = streamed.levels[firstLevel];
+	GLuint handle = CreateStreamedTextureStorage(target, internalFormat, first.width, first.height, levelCount - firstLevel);
+
+	for (u32 level = glm::max(firstLevel, streamed.residentLevel); level < levelCount; ++level)
+	{
+		const CookedTextureLevel& copied = streamed.levels[level];
+		glCopyImageSubData(tex.handle, target, level - streamed.residentLevel, 0, 0, 0,
+			handle, target, level - firstLevel, 0, 0, 0,
+			copied.width, copied.height, 1);
+	}
+	if (loaded)
+	{
+		// Only the levels the texture didn't have, the read may overlap the resident ones
+		const u32 missingCount = glm::min((u32)loaded->levels.levels.size(), streamed.residentLevel - firstLevel);
+		if (loaded->uploadedTexture != 0)
+		{
+			for (u32 i = 0; i < missingCount; ++i)
+			{
+				const CookedTextureLevel& copied = loaded->levels.levels[i];
+				glCopyImageSubData(loaded->uploadedTexture, GL_TEXTURE_2D, i, 0, 0, 0,
+					handle, target, i, 0, 0, 0,
+					copied.width, copied.height, 1);
+			}
+		}
+		else
+		{
+			CookedTexture missing = loaded->levels;
+			missing.levels.resize(missingCount);
+			UploadCookedLevels(target, internalFormat, missing, 0, 0);
+		}
+	}
+	glBindTexture(target, 0);
+	if ((err = glGetError()) != GL_NO_ERROR)
+		ELOG("OpenGL error %d changing the resident levels of %s\n", err, streamed.filepath.c_str());
+
+	MakeTextureNonResident(tex.bindlessHandle);
+	glDeleteTextures(1, &tex.handle);
+	tex.handle = handle;
+	tex.bindlessHandle = app->bindlessTextures ? MakeTextureResident(handle, app->textureArrays.samplers[SamplerObject_TrilinearClamp]) : 0;
+
+	TextureStreamer& streamer = app->textureStreamer;
+	const u64 oldBytes = GetLevelRangeBytes(streamed, streamed.residentLevel, levelCount);
+	const u64 newBytes = GetLevelRangeBytes(streamed, firstLevel, levelCount);
+	streamer.residentBytes = streamer.residentBytes - oldBytes + newBytes;
+	if (firstLevel < streamed.residentLevel)
+		streamer.streamedLevels += streamed.residentLevel - firstLevel;
+	else
+		streamer.evictedLevels += firstLevel - streamed.residentLevel;
+	tex.byteSize = newBytes;
+	streamed.residentLevel = firstLevel;
+}
+
+// Finest level the texture still needs: the finer of what it was asked for this frame and its
+// minimum, or only its minimum when nothing asked for it
+static u32 GetNeededLevel(const TextureStreamer& streamer, const StreamedTexture& streamed)
+{
+	return streamed.requestFrame == streamer.frame ? glm::min(streamed.requestedLevel, streamed.minimumLevel) : streamed.minimumLevel;
+}
+
+// Drops the levels the least recently used textures don't need until the bytes are free. Only
+// the levels finer than the needed one go, so nothing requested this frame is ever evicted.
+// Returns the bytes freed.
+static u64 EvictTextureLevels(App* app, u64 bytes, u32 excludedStreamIdx)
+{
+	TextureStreamer& streamer = app->textureStreamer;
+
+	std::vector<u32> candidates;
+	for (u32 i = 0; i < streamer.textures.size(); ++i)
+	{
+		const StreamedTexture& streamed = streamer.textures[i];
+		if (i != excludedStreamIdx && streamed.textureIdx != UINT32_MAX && streamed.loadingBytes == 0 && streamed.residentLevel < GetNeededLevel(streamer, streamed))
+			candidates.push_back(i);
+	}
+	std::sort(candidates.begin(), candidates.end(), [&streamer](u32 a, u32 b) {
+		return streamer.textures[a].lastUsedFrame < streamer.textures[b].lastUsedFrame;
+	});
+
+	u64 freed = 0;
+	for (u32 i = 0; i < candidates.size() && freed < bytes; ++i)
+	{
+		StreamedTexture& streamed = streamer.textures[candidates[i]];
+
+		// Finest levels first, only as many as needed
+		u32 level = streamed.residentLevel;
+		const u32 neededLevel = GetNeededLevel(streamer, streamed);
+		while (level < neededLevel && freed + GetLevelRangeBytes(streamed, streamed.residentLevel, level) < bytes)
+			++level;
+		freed += GetLevelRangeBytes(streamed, streamed.residentLevel, level);
+		SetResidentLevel(app, streamed, level, nullptr);
+	}
+	return freed;
+}
+
+static void UploadStreamedLevels(App* app)
+{
+	TextureStreamer& streamer = app->textureStreamer;
+
+	for (;;)
+	{
+		TextureStreamingQueue::Completion completion;
+		{
+			std::lock_guard<std::mutex> lock(streamer.queue->mutex);
+			if (streamer.queue->completed.empty())
+				break;
+			completion = std::move(streamer.queue->completed.front());
+			streamer.queue->completed.pop_front();
+		}
+
+		StreamedTexture& streamed = streamer.textures[completion.streamIdx];
+		streamer.loadCount--;
+		streamer.loadingBytes -= streamed.loadingBytes;
+		streamed.loadingBytes = 0;
+		if (streamed.textureIdx != UINT32_MAX && !completion.valid)
+		{
+			ELOG("Could not stream the levels of %s", streamed.filepath.c_str());
+			streamed.failed = true;
+		}
+		else if (streamed.textureIdx != UINT32_MAX && completion.firstLevel < streamed.residentLevel)
+		{
+			SetResidentLevel(app, streamed, completion.firstLevel, &completion);
+		}
+		glDeleteTextures(1, &completion.uploadedTexture);
+	}
+}
+
+static void StartTextureLoad(TextureStreamer& streamer, u32 streamIdx, u32 firstLevel)
+{
+	StreamedTexture& streamed = streamer.textures[streamIdx];
+	streamed.loadingBytes = GetLevelRangeBytes(streamed, firstLevel, streamed.residentLevel);
+	streamer.loadingBytes += streamed.loadingBytes;
+	streamer.loadCount++;
+
+	std::shared_ptr<TextureStreamingQueue> queue = streamer.queue;
+	const std::string filepath = streamed.filepath;
+	const TextureUsage usage = streamed.usage;
+	const bool flippedVertically = streamed.flippedVertically;
+	const u32 lastLevel = streamed.residentLevel - 1;
+	SubmitJob([queue, filepath, usage, flippedVertically, streamIdx, firstLevel, lastLevel] {
+		std::shared_ptr<TextureStreamingQueue::Completion> completion = std::make_shared<TextureStreamingQueue::Completion>();
+		completion->streamIdx = streamIdx;
+		completion->firstLevel = firstLevel;
+		completion->valid = LoadCookedTextureLevels(filepath.c_str(), usage, flippedVertically, firstLevel, lastLevel, completion->levels);
+		completion->uploadedTexture = 0;
+
+		if (!completion->valid || !IsGpuUploaderRunning())
+		{
+			std::lock_guard<std::mutex> lock(queue->mutex);
+			queue->completed.push_back(std::move(*completion));
+			return;
+		}
+
+		// The upload thread makes a texture of the levels, UpdateTextureStreamer only copies them
+		GpuUpload upload = {};
+		upload.type = GpuUploadType_CookedTexture;
+		upload.target = GL_TEXTURE_2D;
+		upload.cooked = &completion->levels;
+		SubmitGpuUpload(upload, [queue, completion](GpuUpload& uploaded) {
+			completion->uploadedTexture = uploaded.handle;
+			if (uploaded.handle != 0)
+				std::vector<u8>().swap(completion->levels.data);
+
+			std::lock_guard<std::mutex> lock(queue->mutex);
+			queue->completed.push_back(std::move(*completion));
+		});
+	});
+}
+
+void UpdateTextureStreamer(App* app)
+{
+	TextureStreamer& streamer = app->textureStreamer;
+	if (!streamer.queue)
+		return;
+
+	UploadStreamedLevels(app);
+
+	// A lowered budget gives the unneeded levels back right away
+	if (streamer.residentBytes > streamer.budgetBytes)
+		EvictTextureLevels(app, streamer.residentBytes - streamer.budgetBytes, UINT32_MAX);
+
+	// The textures missing the most levels load first
+	std::vector<u32> candidates;
+	for (u32 i = 0; i < streamer.textures.size(); ++i)
+	{
+		const StreamedTexture& streamed = streamer.textures[i];
+		if (streamed.textureIdx != UINT32_MAX && !streamed.failed && streamed.loadingBytes == 0 && GetNeededLevel(streamer, streamed) < streamed.residentLevel)
+			candidates.push_back(i);
+	}
+	std::sort(candidates.begin(), candidates.end(), [&streamer](u32 a, u32 b) {
+		const StreamedTexture& ta = streamer.textures[a];
+		const StreamedTexture& tb = streamer.textures[b];
+		return ta.residentLevel - GetNeededLevel(streamer, ta) > tb.residentLevel - GetNeededLevel(streamer, tb);
+	});
+
+	for (u32 i = 0; i < candidates.size() && streamer.loadCount < TEXTURE_STREAMING_MAX_LOADS; ++i)
+	{
+		StreamedTexture& streamed = streamer.textures[candidates[i]];
+
+		// Make room for the levels, or settle for coarser ones if there isn't enough to evict
+		u32 firstLevel = GetNeededLevel(streamer, streamed);
+		const u64 usedBytes = streamer.residentBytes + streamer.loadingBytes;
+		const u64 neededBytes = GetLevelRangeBytes(streamed, firstLevel, streamed.residentLevel);
+		if (usedBytes + neededBytes > streamer.budgetBytes)
+			EvictTextureLevels(app, usedBytes + neededBytes - streamer.budgetBytes, candidates[i]);
+		while (firstLevel < streamed.residentLevel && streamer.residentBytes + streamer.loadingBytes + GetLevelRangeBytes(streamed, firstLevel, streamed.residentLevel) > streamer.budgetBytes)
+			++firstLevel;
+
+		if (firstLevel < streamed.residentLevel)
+			StartTextureLoad(streamer, candidates[i], firstLevel);
+	}
+
+	streamer.frame++;
+}
@@ -0,0 +1,93 @@
+//
+// texture_streamer.h: Mip streaming of the big material textures. They load with only their
+// small levels resident, then every frame the entities request the level their screen size
+// needs for the textures of their materials, and the streamer reads the missing levels from
+// the cooked file on the job system. The resident levels stay under a VRAM budget: when a load
+// does not fit, the levels the least recently used textures no longer need are dropped first.
+//
+// A texture only holds its resident levels: each residency change moves it to new immutable
+// storage (the levels it keeps are copied on the GPU, and so are the read ones once the upload
+// thread has made a texture of them, see gpu_uploader.h). Neither the bindless handles nor the
+// texture arrays allow changing the level range of a texture in place.
+//
+
+#pragma once
+
+#include "geometry.h"
+#include "texture_cooker.h"
+
+#include <memory>
+
+#define TEXTURE_STREAMING_MIN_SIZE       512                          // Textures up to this size are never streamed
+#define TEXTURE_STREAMING_RESIDENT_SIZE  64                           // Largest level resident from load time
+#define TEXTURE_STREAMING_DEFAULT_BUDGET (256ull * 1024 * 1024)       // Bytes of streamed levels
+#define TEXTURE_STREAMING_MAX_LOADS      4                            // Reads in flight
+
+struct App;
+struct Model;
+struct TextureStreamingQueue;
+
+struct StreamedTexture
+{
+	u32          textureIdx;        // UINT32_MAX once the texture is released
+	std::string  filepath;
+	TextureUsage usage;
+	bool         flippedVertically;
+	u32          format;
+	std::vector<CookedTextureLevel> levels; // Every level of the cooked file, level 0 first
+	u32          residentLevel;     // Finest level in memory, the coarser ones are all resident
+	u32          minimumLevel;      // Finest level kept whatever the budget (the load time one)
+	u32          requestedLevel;    // Finest level requested on requestFrame
+	u64          requestFrame;
+	u64          lastUsedFrame;
+	u64          loadingBytes;      // Of the levels being read, 0 if none
+	bool         failed;            // The cooked file could not be read again, never retried
+};
+
+struct TextureStreamer
+{
+	std::vector<StreamedTexture> textures;
+	std::shared_ptr<TextureStreamingQueue> queue;
+	u64 budgetBytes = TEXTURE_STREAMING_DEFAULT_BUDGET;
+	u64 residentBytes;  // Of every streamed texture
+	u64 loadingBytes;   // Of the levels being read
+	u64 frame;
+	u32 loadCount;      // Reads in flight
+	u32 streamedLevels; // Levels read so far
+	u32 evictedLevels;  // Levels dropped so far
+};
+
+/**
+ * Whether a cooked material texture is big enough to stream, and the finest level it keeps
+ * resident from load time.
+ */
+bool ShouldStreamTexture(const CookedTexture& texture);
+u32 GetStreamingInitialLevel(const CookedTexture& texture);
+
+/**
+ * Creates the texture holding the levels of the cooked texture from firstLevel on: a 2D texture
+ * with bindless textures, a texture array of one layer otherwise.
+ */
+GLuint CreateStreamedTexture(const CookedTexture& texture, u32 firstLevel, bool bindless);
+
+/**
+ * Registers a texture created by CreateStreamedTexture. Returns its index in the streamer.
+ */
+u32 AddStreamedTexture(TextureStreamer& streamer, u32 textureIdx, const std::string& filepath, TextureUsage usage, const CookedTexture& texture, u32 residentLevel);
+
+/**
+ * Forgets a released texture. A read still in flight for it is thrown away.
+ */
+void RemoveStreamedTexture(TextureStreamer& streamer, u32 streamIdx);
+
+/**
+ * Requests, for the textures of every material of the model, the level that gives about one
+ * texel per pixel when the model covers screenPixels pixels across.
+ */
+void RequestModelTextureLevels(App* app, const Model& model, f32 screenPixels);
+
+/**
+ * Uploads the levels read since the last call, evicts levels to stay under the budget and
+ * starts the reads of the levels requested this frame. Once per frame, after the requests.
+ */
+void UpdateTextureStreamer(App* app);
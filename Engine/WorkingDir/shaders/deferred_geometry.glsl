@@ -22,6 +22,7 @@ layout(binding = 0, std140) uniform GlobalParams
     unsigned int uRenderMode;
     vec3         uCameraPosition;
     unsigned int uLightCount;
+    vec4         uIrradianceSH[9]; // Diffuse IBL, L2 spherical harmonics already divided by pi
     Light        uLight[16];
 };
 
@@ -39,20 +40,36 @@ out vec4 FragColor;
 
 uniform mat4 projectionViewMatrix;
 
+// Vertex stream decoding (see VertexFormat in geometry.h)
+uniform int  uVertexFormat;   // 0: float, 1: compact
+uniform vec3 uPositionScale;  // Dequantization of 16-bit positions
+uniform vec3 uPositionOffset;
+
+vec3 DecodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
 void main()
 {
+    vec3 position = aPosition * uPositionScale + uPositionOffset;
+    vec3 normal = uVertexFormat == 1 ? DecodeOctahedral(aNormal.xy) : aNormal;
+
     vTexCoord = aTexCoord;
     
     mat4 model = mat4(1.0f);
     //vNormal   = vec3(uWorldMatrix * vec4(aNormal, 0.0));
-    vNormal = mat3(transpose(inverse(model))) * aNormal;
+    vNormal = mat3(transpose(inverse(model))) * normal;
 
     //vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
-    vPosition = vec3(model * vec4(aPosition, 1.0f));
+    vPosition = vec3(model * vec4(position, 1.0f));
 
     vViewDir  = uCameraPosition - vPosition;
 
-    gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0f);
+    gl_Position = uWorldViewProjectionMatrix * vec4(position, 1.0f);
 }   
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
@@ -79,6 +96,7 @@ layout(binding = 0, std140) uniform GlobalParams
     unsigned int uRenderMode;
     vec3 uCameraPosition;
     unsigned int uLightCount;
+    vec4         uIrradianceSH[9]; // Diffuse IBL, L2 spherical harmonics already divided by pi
     Light uLight[16];
 };
 
@@ -2,15 +2,37 @@
 
 layout (location = 0) in vec3 aPos;
 
-out vec3 WorldPos;
+out vec3 vPos;
+
+void main()
+{
+    vPos = aPos;
+}
 
-uniform mat4 projection;
-uniform mat4 view;
+#elif defined(GEOMETRY)
+
+// One invocation per cubemap face, each one writes its layer of the attached cubemap level
+layout (triangles, invocations = 6) in;
+layout (triangle_strip, max_vertices = 3) out;
+
+layout(binding = 2, std140) uniform CubemapCapture
+{
+    mat4 uFaceViewProjection[6];
+};
+
+in vec3 vPos[];
+out vec3 WorldPos;
 
 void main()
 {
-    WorldPos = aPos;  
-    gl_Position =  projection * view * vec4(WorldPos, 1.0);
+    for (int i = 0; i < 3; ++i)
+    {
+        WorldPos = vPos[i];
+        gl_Layer = gl_InvocationID;
+        gl_Position = uFaceViewProjection[gl_InvocationID] * vec4(vPos[i], 1.0);
+        EmitVertex();
+    }
+    EndPrimitive();
 }
 
 #elif defined(FRAGMENT) 
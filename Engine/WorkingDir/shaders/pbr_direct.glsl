@@ -18,6 +18,7 @@ layout(binding = 0, std140) uniform GlobalParams
     unsigned int uRenderMode;
     vec3         uCameraPosition;
     unsigned int uLightCount;
+    vec4         uIrradianceSH[9]; // Diffuse IBL, L2 spherical harmonics already divided by pi
     Light        uLight[16];
 };
 
@@ -61,11 +62,12 @@ in vec3 vNormal;   //In worldspace
 in vec3 vViewDir;  //In worldspace
 
 // Material properties
-uniform sampler2D albedoMap;
-uniform sampler2D normalMap;
-uniform sampler2D metallicMap;
-uniform sampler2D roughnessMap;
-uniform sampler2D aoMap;
+// Material maps are layers of texture arrays, uMaterialLayers holds the layer of each one
+// in the order of MaterialTextureSlot: albedo, ORM (occlusion, roughness, metallic), normals
+uniform sampler2DArray albedoMap;
+uniform sampler2DArray ormMap;
+uniform sampler2DArray normalMap;
+uniform int uMaterialLayers[3];
 
 struct Light
 {
@@ -81,6 +83,7 @@ layout(binding = 0, std140) uniform GlobalParams
     unsigned int uRenderMode;
     vec3         uCameraPosition;
     unsigned int uLightCount;
+    vec4         uIrradianceSH[9]; // Diffuse IBL, L2 spherical harmonics already divided by pi
     Light        uLight[16];
 };
 
@@ -96,7 +99,10 @@ const float PI = 3.14159265359;
 vec3 getNormalFromMap()
 {
     // Obtain normal from normal map
-    vec3 tangentNormal = texture(normalMap, vTexCoord).xyz * 2.0 - 1.0;
+    // Only X and Y are read, block compressed normal maps (BC5) don't store Z
+    vec3 tangentNormal;
+    tangentNormal.xy = texture(normalMap, vec3(vTexCoord, uMaterialLayers[2])).xy * 2.0 - 1.0;
+    tangentNormal.z = sqrt(max(1.0 - dot(tangentNormal.xy, tangentNormal.xy), 0.0));
 
     // Calculate derivative of coordinates
     vec3 Q1  = dFdx(vPosition);
@@ -160,10 +166,11 @@ vec3 fresnelSchlick(float cosTheta, vec3 F0)
 // Main PBR lighting calculation
 void main()
 {       
-    vec3 albedo     = pow(texture(albedoMap, vTexCoord).rgb, vec3(2.2));
-    float metallic  = texture(metallicMap, vTexCoord).r;
-    float roughness = texture(roughnessMap, vTexCoord).r;
-    float ao        = texture(aoMap, vTexCoord).r;
+    vec3 albedo     = pow(texture(albedoMap, vec3(vTexCoord, uMaterialLayers[0])).rgb, vec3(2.2));
+    vec3 orm        = texture(ormMap, vec3(vTexCoord, uMaterialLayers[1])).rgb;
+    float ao        = orm.r;
+    float roughness = orm.g;
+    float metallic  = orm.b;
 
     vec3 N = getNormalFromMap();
     vec3 V = normalize(uCameraPosition - vPosition);
@@ -1,3 +1,7 @@
+#if defined(PBR_IBL_DIRECT_BINDLESS)
+#extension GL_ARB_bindless_texture : require
+#endif
+
 #if defined(VERTEX)
 
 layout (location = 0) in vec3 aPos;
@@ -18,6 +22,7 @@ layout(binding = 0, std140) uniform GlobalParams
     unsigned int uRenderMode;
     vec3         uCameraPosition;
     unsigned int uLightCount;
+    vec4         uIrradianceSH[9]; // Diffuse IBL, L2 spherical harmonics already divided by pi
     Light        uLight[16];
 };
 
@@ -31,11 +36,27 @@ out vec2 TexCoords;
 out vec3 WorldPos;
 out vec3 Normal;
 
+// Vertex stream decoding (see VertexFormat in geometry.h)
+uniform int  uVertexFormat;   // 0: float, 1: compact
+uniform vec3 uPositionScale;  // Dequantization of 16-bit positions
+uniform vec3 uPositionOffset;
+
+vec3 DecodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
 void main()
 {
+    vec3 position = aPos * uPositionScale + uPositionOffset;
+    vec3 normal = uVertexFormat == 1 ? DecodeOctahedral(aNormal.xy) : aNormal;
+
     TexCoords = aTexCoords;
-    WorldPos = vec3(uWorldMatrix * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(uWorldMatrix))) * aNormal;
+    WorldPos = vec3(uWorldMatrix * vec4(position, 1.0));
+    Normal = mat3(transpose(inverse(uWorldMatrix))) * normal;
 
     gl_Position = uWorldViewProjectionMatrix * vec4(WorldPos, 1.0);
 }
@@ -61,6 +82,7 @@ layout(binding = 0, std140) uniform GlobalParams
     unsigned int uRenderMode;
     vec3         uCameraPosition;
     unsigned int uLightCount;
+    vec4         uIrradianceSH[9]; // Diffuse IBL, L2 spherical harmonics already divided by pi
     Light        uLight[16];
 };
 
@@ -71,26 +93,73 @@ layout(binding = 1, std140) uniform LocalParams
 };
 
 // material parameters
-uniform sampler2D albedoMap;
-uniform sampler2D normalMap;
-uniform sampler2D metallicMap;
-uniform sampler2D roughnessMap;
-uniform sampler2D aoMap;
+// Maps in the order of MaterialTextureSlot: albedo, ORM (occlusion, roughness, metallic), normals
+#if defined(PBR_IBL_DIRECT_BINDLESS)
+// Bindless handles of every material, uMaterialIndex picks the one of the draw
+struct MaterialMaps
+{
+    uvec2 maps[3];
+};
+
+layout(binding = 0, std430) readonly buffer MaterialTable
+{
+    MaterialMaps uMaterials[];
+};
+
+uniform uint uMaterialIndex;
+
+vec4 SampleMaterialMap(int slot, vec2 uv)
+{
+    return texture(sampler2D(uMaterials[uMaterialIndex].maps[slot]), uv);
+}
+#else
+// Layers of texture arrays, uMaterialLayers holds the layer of each map
+uniform sampler2DArray albedoMap;
+uniform sampler2DArray ormMap;
+uniform sampler2DArray normalMap;
+uniform int uMaterialLayers[3];
+
+vec4 SampleMaterialMap(int slot, vec2 uv)
+{
+    vec3 coords = vec3(uv, uMaterialLayers[slot]);
+    if (slot == 0) return texture(albedoMap, coords);
+    if (slot == 1) return texture(ormMap, coords);
+    return texture(normalMap, coords);
+}
+#endif
 
 // IBL
-uniform samplerCube irradianceMap;
 uniform samplerCube prefilterMap;
 uniform sampler2D brdfLUT;
 
 const float PI = 3.14159265359;
 // ----------------------------------------------------------------------------
+// Diffuse lighting of the environment around a world-space normal, from the
+// spherical harmonics the engine projects once per environment.
+vec3 evaluateIrradianceSH(vec3 n)
+{
+    vec3 irradiance = uIrradianceSH[0].rgb * 0.282095;
+    irradiance += uIrradianceSH[1].rgb * 0.488603 * n.y;
+    irradiance += uIrradianceSH[2].rgb * 0.488603 * n.z;
+    irradiance += uIrradianceSH[3].rgb * 0.488603 * n.x;
+    irradiance += uIrradianceSH[4].rgb * 1.092548 * n.x * n.y;
+    irradiance += uIrradianceSH[5].rgb * 1.092548 * n.y * n.z;
+    irradiance += uIrradianceSH[6].rgb * 0.315392 * (3.0 * n.z * n.z - 1.0);
+    irradiance += uIrradianceSH[7].rgb * 1.092548 * n.x * n.z;
+    irradiance += uIrradianceSH[8].rgb * 0.546274 * (n.x * n.x - n.y * n.y);
+    return max(irradiance, vec3(0.0));
+}
+// ----------------------------------------------------------------------------
 // Easy trick to get tangent-normals to world-space to keep PBR code simplified.
 // Don't worry if you don't get what's going on; you generally want to do normal 
 // mapping the usual way for performance anyways; I do plan make a note of this 
 // technique somewhere later in the normal mapping tutorial.
 vec3 getNormalFromMap()
 {
-    vec3 tangentNormal = texture(normalMap, TexCoords).xyz * 2.0 - 1.0;
+    // Only X and Y are read, block compressed normal maps (BC5) don't store Z
+    vec3 tangentNormal;
+    tangentNormal.xy = SampleMaterialMap(2, TexCoords).xy * 2.0 - 1.0;
+    tangentNormal.z = sqrt(max(1.0 - dot(tangentNormal.xy, tangentNormal.xy), 0.0));
 
     vec3 Q1  = dFdx(WorldPos);
     vec3 Q2  = dFdy(WorldPos);
@@ -153,10 +222,11 @@ vec3 fresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness)
 void main()
 {		
     // material properties
-    vec3 albedo = pow(texture(albedoMap, TexCoords).rgb, vec3(2.2));
-    float metallic = texture(metallicMap, TexCoords).r;
-    float roughness = texture(roughnessMap, TexCoords).r;
-    float ao = texture(aoMap, TexCoords).r;
+    vec3 albedo = pow(SampleMaterialMap(0, TexCoords).rgb, vec3(2.2));
+    vec3 orm = SampleMaterialMap(1, TexCoords).rgb;
+    float ao = orm.r;
+    float roughness = orm.g;
+    float metallic = orm.b;
 
     // input lighting data
     vec3 N = getNormalFromMap();
@@ -213,7 +283,7 @@ void main()
     vec3 kD = 1.0 - kS;
     kD *= 1.0 - metallic;	  
     
-    vec3 irradiance = texture(irradianceMap, N).rgb;
+    vec3 irradiance = evaluateIrradianceSH(N);
     vec3 diffuse      = irradiance * albedo;
     
     // sample both the pre-filter map and the BRDF lut and combine them together as per the Split-Sum approximation to get the IBL specular part.